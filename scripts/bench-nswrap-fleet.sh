@@ -0,0 +1,108 @@
+#!/bin/bash
+set -euo pipefail
+
+# Starts many nswrap instances with the fake wine64 from scripts/fakewine
+# instead of Wine and the game, and measures the wrapper itself: the time from
+# starting nswrap to wine being executed, the CPU and memory used by each nswrap
+# process while the fake server is ticking, and the time for every nswrap to
+# exit after SIGTERM (or after the fake server exits or crashes, if the scenario
+# does that before the end).
+#
+# The scenario file is passed to every instance (see fakewine.c for the
+# format); without one, the fake server ticks at 10Hz until it's terminated.
+# nswrap starts the fake Xvfb too. Extra nswrap options can be set in the
+# environment (e.g., NSWRAP_CONSOLE_LOG_DIR).
+#
+#     gcc -std=gnu11 -O3 -pthread -o nswrap src/nswrap/nswrap.c -lm
+#     gcc -std=gnu11 -O2 -o fakewine/wine64 scripts/fakewine/fakewine.c && ln -s wine64 fakewine/Xvfb
+
+if [[ $# -lt 3 ]]; then
+    echo "usage: $0 nswrap_binary fakewine_dir instances [seconds] [scenario_file]"
+    exit 2
+fi
+
+nswrap="$(realpath "$1")"; shift
+fakewine="$(realpath "$1")"; shift
+n="$1"; shift
+sec="${1:-30}"; shift || true
+scenario="${1:-}"; shift || true
+
+if [[ $EUID -eq 0 ]]; then
+    echo "error: nswrap refuses to run as root; run this as a regular user"
+    exit 2
+fi
+
+tmp="$(mktemp -d)"
+trap 'kill $(cat "$tmp"/*/pid 2>/dev/null) 2>/dev/null || true; rm -rf "$tmp"' EXIT
+
+mkdir "$tmp/game"
+touch "$tmp/game/NorthstarLauncher.exe"
+
+now() {
+    date +%s.%N
+}
+
+# prints "p50 p99 max" of the numbers on stdin
+stats() {
+    sort -n | awk '{ v[NR] = $1 } END { if (!NR) { print "- - -"; exit } printf "%.3f %.3f %.3f\n", v[int((NR-1)*0.5)+1], v[int((NR-1)*0.99)+1], v[NR] }'
+}
+
+echo "starting $n instances"
+for i in $(seq "$n"); do
+    d="$tmp/$i"
+    mkdir -p "$d/prefix"
+    [[ -z "$scenario" ]] || cp "$scenario" "$d/prefix/fakewine.txt"
+    now > "$d/start"
+    (
+        PATH="$fakewine:$PATH" WINEPREFIX="$d/prefix" DISPLAY=xvfb \
+            "$nswrap" "$tmp/game" > "$d/log" 2>&1 &
+        echo $! > "$d/pid"
+        wait $! || true
+        now > "$d/exit"
+    ) &
+done
+
+# wait for everything to settle before sampling
+sleep 2
+
+cpu() {
+    local total=0
+    for i in $(seq "$n"); do
+        if [[ -r "/proc/$(cat "$tmp/$i/pid")/stat" ]]; then
+            total=$(( total + $(awk '{ sub(/.*\) /, ""); print $12 + $13 }' "/proc/$(cat "$tmp/$i/pid")/stat") ))
+        fi
+    done
+    echo $total
+}
+
+cpu0=$(cpu); t0=$(now)
+sleep "$sec"
+cpu1=$(cpu); t1=$(now)
+
+rss=$(for i in $(seq "$n"); do
+    awk '/^VmRSS:/ { print $2 }' "/proc/$(cat "$tmp/$i/pid")/status" 2>/dev/null || true
+done | stats)
+
+echo "terminating"
+tterm=$(now)
+for i in $(seq "$n"); do
+    [[ -e "$tmp/$i/exit" ]] || kill -TERM "$(cat "$tmp/$i/pid")" 2>/dev/null || true
+done
+wait
+
+echo "== $n instances, ${sec}s"
+for i in $(seq "$n"); do
+    awk -v s="$(cat "$tmp/$i/start")" '/^fakewine: [0-9.]+ started as pid/ { print $2 - s; exit }' "$tmp/$i/log"
+done | stats | awk '{ printf "exec latency (s): p50 %s, p99 %s, max %s\n", $1, $2, $3 }'
+awk -v c0="$cpu0" -v c1="$cpu1" -v t0="$t0" -v t1="$t1" -v n="$n" -v hz="$(getconf CLK_TCK)" \
+    'BEGIN { printf "nswrap cpu: %.3f%% of a core per instance\n", 100 * (c1 - c0) / hz / (t1 - t0) / n }'
+awk '{ printf "nswrap rss (KiB): p50 %s, p99 %s, max %s\n", $1, $2, $3 }' <<< "$rss"
+for i in $(seq "$n"); do
+    # from the last fakewine event if it exited by itself, otherwise from when we sent SIGTERM
+    awk -v e="$(cat "$tmp/$i/exit")" -v t="$tterm" '
+        /^fakewine: [0-9.]+ (crashing|exiting|end of scenario)/ { x = $2 }
+        /^nswrap: received SIGTERM/ { x = t }
+        END { print e - (x ? x : t) }' "$tmp/$i/log"
+done | stats | awk '{ printf "exit latency (s): p50 %s, p99 %s, max %s\n", $1, $2, $3 }'
+grep -h -F "nswrap: title cadence:" "$tmp"/*/log | sed 's/^nswrap: //' | head -n 3 || true
+grep -h -F -e "nswrap: warning" -e "nswrap: error" "$tmp"/*/log | sed 's/^nswrap: //' | sort | uniq -c | sort -rn | head -n 10 || true
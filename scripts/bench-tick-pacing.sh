@@ -0,0 +1,42 @@
+#!/bin/bash
+set -euo pipefail
+
+# Compares the server loop pacing (as measured by nswrap from the title update
+# interval), memory usage, and process count with Xvfb and without it
+# (NSWRAP_HEADLESS=1). The same game files and image are used for both runs.
+#
+# Other settings can be compared by setting VARIANTS to a space-separated list
+# of environment variable assignments, one per run (e.g.,
+# VARIANTS="NSWRAP_TIMERSLACK=50000 NSWRAP_TIMERSLACK=1000").
+
+if [[ $# -lt 2 ]]; then
+    echo "usage: $0 image_name titanfall_dir [seconds] [docker_run_args...]"
+    exit 2
+fi
+
+img="$1"; shift
+tf="$(realpath "$1")"; shift
+sec="${1:-300}"; shift || true
+
+run() {
+    local variant="$1"; shift
+    local name="nsbench-tick-$$-$(tr -c 'a-zA-Z0-9\n' - <<< "${variant,,}")"
+    docker run --detach --name "$name" \
+        --mount "type=bind,source=$tf,target=/mnt/titanfall,readonly" \
+        --env NS_SERVER_NAME="tick pacing benchmark" \
+        --env NS_MASTERSERVER_REGISTER=0 \
+        --env NS_INSECURE=1 \
+        --env "$variant" \
+        "$@" "$img" > /dev/null
+    sleep "$sec"
+    echo "== $variant"
+    echo "memory: $(docker stats --no-stream --format '{{.MemUsage}}' "$name")"
+    echo "processes: $(docker top "$name" -o pid | tail -n +2 | wc -l)"
+    docker stop --time 10 "$name" > /dev/null
+    docker logs "$name" 2>&1 | grep -F "nswrap: title cadence:" | sed 's/^nswrap: //' || true
+    docker rm "$name" > /dev/null
+}
+
+for variant in ${VARIANTS:-NSWRAP_HEADLESS=0 NSWRAP_HEADLESS=1}; do
+    run "$variant" "$@"
+done
@@ -0,0 +1,351 @@
+/**
+ * Stand-in for wine64 (and Xvfb) for testing nswrap without Wine or the game.
+ *
+ * When run as wine64, it follows a scenario script, writing console output and
+ * title updates in the same format as NorthstarLauncher, so the title parsing,
+ * watchdog, signal handling, exit timer, and subreaping in nswrap can be
+ * exercised deterministically. When run as Xvfb, it writes display 99 to the
+ * -displayfd and waits to be terminated.
+ *
+ *     gcc -Wall -Wextra -std=gnu11 -O2 -o wine64 fakewine.c && ln -s wine64 Xvfb
+ *
+ * Put the directory first in the PATH when starting nswrap, with the game dir
+ * only containing an empty NorthstarLauncher.exe and WINEPREFIX set to any
+ * directory. Since nswrap doesn't pass the environment through to wine, the
+ * scenario is read from the file after a -fakewine argument (i.e., extra
+ * nswrap arguments), $WINEPREFIX/fakewine.txt, or fakewine.txt in the game dir,
+ * in that order. Without one, it boots and ticks forever.
+ *
+ * The scenario is one command per line (# starts a comment):
+ *
+ *     map <name> <playlist> <max>   set the map shown in titles (default: mp_lobby private_match 16)
+ *     players <n>                   set the player count shown in titles
+ *     tick <sec> [hz]               update the title at hz (default 10) for sec (0 for forever)
+ *     spam <sec> <lines/s> [len]    write colored log lines (default length 100) for sec
+ *     sleep <sec>                   do nothing for sec (i.e., a hang if the watchdog is running)
+ *     spawn <sec> [ignterm]         start a child (like the wineserver) which outlives us for sec
+ *     onterm exit <code> [sec]      on SIGTERM, exit with code after sec (a slow exit)
+ *     onterm ignore                 ignore SIGTERM (so nswrap needs to SIGKILL it)
+ *     crash <signal>                kill ourselves with a signal (e.g., SEGV or ABRT)
+ *     exit <code>                   exit with code
+ *     loop                          restart from the first line
+ *
+ * Reaching the end of the scenario is the same as exit 0, and the default
+ * SIGTERM behaviour is onterm exit 0. Lines written to the console (e.g., by
+ * drain mode) are logged as events while sleeping or ticking. Important events are written to the
+ * console with a CLOCK_REALTIME timestamp so latencies can be measured against
+ * the time nswrap exits (see bench-nswrap-fleet.sh).
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/resource.h>
+
+#define DEFAULT_SCENARIO \
+    "spam 1 200\n" \
+    "tick 0 10\n"
+
+static volatile sig_atomic_t got_term;
+
+static struct {
+    char map[64];
+    char playlist[64];
+    int players, max;
+    bool ignore_term;
+    int term_code;
+    double term_delay;
+    uint64_t line;
+} st = {
+    .map = "mp_lobby",
+    .playlist = "private_match",
+    .max = 16,
+};
+
+static double now_real(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void on_term(int sig) {
+    (void) sig;
+    got_term = 1;
+}
+
+static void event(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+static void event(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    printf("fakewine: %.6f ", now_real());
+    vprintf(fmt, ap);
+    printf("\n");
+    fflush(stdout);
+    va_end(ap);
+}
+
+/** Handles a pending SIGTERM. */
+static void check_term(void) {
+    if (!got_term) {
+        return;
+    }
+    got_term = 0;
+    if (st.ignore_term) {
+        event("ignoring SIGTERM");
+        return;
+    }
+    event("got SIGTERM; exiting with status %d in %.3fs", st.term_code, st.term_delay);
+    signal(SIGTERM, SIG_IGN);
+    if (st.term_delay > 0) {
+        uint64_t ns = st.term_delay * 1e9;
+        nanosleep(&(struct timespec){ .tv_sec = ns / 1000000000ULL, .tv_nsec = ns % 1000000000ULL }, NULL);
+    }
+    event("exiting");
+    exit(st.term_code);
+}
+
+/** Logs console input (e.g., from NSWRAP_CONSOLE_FD or drain mode in nswrap) as events. */
+static void check_input(void) {
+    static char buf[512];
+    static size_t n;
+    ssize_t r = read(0, buf + n, sizeof(buf) - n);
+    if (r <= 0) {
+        return;
+    }
+    n += r;
+    char *l = buf;
+    for (char *e; (e = memchr(l, '\n', buf + n - l)); l = e + 1) {
+        *e = '\0';
+        event("console input: %s", l);
+    }
+    n -= l - buf;
+    memmove(buf, l, n);
+    if (n == sizeof(buf)) {
+        n = 0; // drop lines which are too long
+    }
+}
+
+/** Sleeps until the deadline, handling SIGTERM and console input. */
+static void sleep_until(uint64_t deadline) {
+    for (uint64_t t; (t = now_ns()) < deadline;) {
+        struct pollfd pfd = { .fd = 0, .events = POLLIN };
+        if (ppoll(&pfd, 1, &(struct timespec){ .tv_sec = (deadline - t) / 1000000000ULL, .tv_nsec = (deadline - t) % 1000000000ULL }, NULL) > 0) {
+            if (pfd.revents & POLLIN) {
+                check_input();
+            } else {
+                // stdin isn't usable (e.g., /dev/null at EOF), so just sleep
+                nanosleep(&(struct timespec){ .tv_sec = (deadline - t) / 1000000000ULL, .tv_nsec = (deadline - t) % 1000000000ULL }, NULL);
+            }
+        }
+        check_term();
+    }
+    check_term();
+}
+
+static void title(void) {
+    printf("\x1B]0;Titanfall 2 - %s %d/%d players (%s)\x07", st.map, st.players, st.max, st.playlist);
+    fflush(stdout);
+}
+
+static void line(size_t len) {
+    static const char pad[] = "Lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor incididunt ut labore ";
+    int n = printf("\x1B[0m[\x1B[32m\x1B[1minfo\x1B[0m] [SERVER SCRIPT] line %llu ", (unsigned long long)(st.line++));
+    for (size_t i = n > 0 ? n : 0; i < len; i++) {
+        putchar(pad[i % (sizeof(pad) - 1)]);
+    }
+    putchar('\n');
+}
+
+static void cmd_tick(double sec, double hz) {
+    uint64_t start = now_ns(), interval = 1e9 / hz;
+    for (uint64_t i = 1; sec <= 0 || i * interval <= sec * 1e9; i++) {
+        title();
+        sleep_until(start + i * interval);
+    }
+}
+
+static void cmd_spam(double sec, double rate, size_t len) {
+    uint64_t start = now_ns(), interval = 1e9 / rate;
+    for (uint64_t i = 1; i * interval <= sec * 1e9; i++) {
+        line(len);
+        if (i % 64 == 0 || interval >= 1000000) {
+            fflush(stdout);
+            sleep_until(start + i * interval);
+        }
+    }
+    fflush(stdout);
+}
+
+static void cmd_spawn(double sec, bool ignterm) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        event("spawn failed: %m");
+        return;
+    }
+    if (pid == 0) {
+        signal(SIGTERM, ignterm ? SIG_IGN : SIG_DFL);
+        signal(SIGHUP, SIG_IGN); // like the wineserver, don't die when we exit and the pty is hung up
+        int fd = open("/dev/null", O_RDWR);
+        dup2(fd, 0);
+        dup2(fd, 1);
+        dup2(fd, 2);
+        uint64_t ns = sec * 1e9;
+        while (nanosleep(&(struct timespec){ .tv_sec = ns / 1000000000ULL, .tv_nsec = ns % 1000000000ULL }, NULL) == -1 && errno == EINTR);
+        _exit(0);
+    }
+    event("spawned %d for %.3fs", pid, sec);
+}
+
+static void cmd_crash(const char *name) {
+    int sig = 0;
+    for (int i = 1; i < NSIG; i++) {
+        const char *abbrev = sigabbrev_np(i);
+        if (abbrev && !strcmp(abbrev, name)) {
+            sig = i;
+            break;
+        }
+    }
+    if (!sig && !(sig = atoi(name))) {
+        event("unknown signal %s", name);
+        exit(2);
+    }
+    event("crashing with SIG%s", sigabbrev_np(sig) ?: "?");
+    setrlimit(RLIMIT_CORE, &(struct rlimit){0, 0});
+    signal(sig, SIG_DFL);
+    sigprocmask(SIG_SETMASK, &(sigset_t){0}, NULL);
+    raise(sig);
+    exit(128 + sig);
+}
+
+static char *read_scenario(int argc, char **argv) {
+    const char *prefix = getenv("WINEPREFIX");
+    char path[4096] = "";
+    for (int i = 1; i < argc - 1; i++) {
+        if (!strcmp(argv[i], "-fakewine")) {
+            snprintf(path, sizeof(path), "%s", argv[i + 1]);
+        }
+    }
+    if (!*path && prefix) {
+        snprintf(path, sizeof(path), "%s/fakewine.txt", prefix);
+        if (access(path, F_OK)) {
+            *path = '\0';
+        }
+    }
+    if (!*path && !access("fakewine.txt", F_OK)) {
+        snprintf(path, sizeof(path), "fakewine.txt");
+    }
+    if (!*path) {
+        return strdup(DEFAULT_SCENARIO);
+    }
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        fprintf(stderr, "fakewine: error: open scenario '%s': %m\n", path);
+        exit(2);
+    }
+    char *buf = NULL;
+    size_t sz = 0;
+    if (getdelim(&buf, &sz, '\0', f) == -1) {
+        buf = strdup("");
+    }
+    fclose(f);
+    return buf;
+}
+
+static int xvfb(int argc, char **argv) {
+    for (int i = 1; i < argc - 1; i++) {
+        if (!strcmp(argv[i], "-displayfd")) {
+            dprintf(atoi(argv[i + 1]), "99\n");
+            close(atoi(argv[i + 1]));
+        }
+    }
+    while (!got_term) {
+        pause();
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    sigaction(SIGTERM, &(struct sigaction){ .sa_handler = on_term }, NULL);
+
+    if (!strcmp(basename(argv[0]), "Xvfb")) {
+        return xvfb(argc, argv);
+    }
+
+    char *scenario = read_scenario(argc, argv);
+    event("started as pid %d", getpid());
+
+    for (char *next = scenario;;) {
+        if (!*next) {
+            break;
+        }
+        char *cur = next, *end = strchrnul(cur, '\n');
+        next = *end ? end + 1 : end;
+        *end = '\0';
+
+        char *comment = strchr(cur, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+
+        char c[16], a[64] = "", b[64] = "", d[64] = "";
+        int n = sscanf(cur, "%15s %63s %63s %63s", c, a, b, d);
+        if (n <= 0) {
+            continue;
+        }
+        if (!strcmp(c, "map") && n == 4) {
+            snprintf(st.map, sizeof(st.map), "%s", a);
+            snprintf(st.playlist, sizeof(st.playlist), "%s", b);
+            st.max = atoi(d);
+        } else if (!strcmp(c, "players") && n == 2) {
+            st.players = atoi(a);
+        } else if (!strcmp(c, "tick") && n >= 2) {
+            cmd_tick(atof(a), n >= 3 ? atof(b) : 10);
+        } else if (!strcmp(c, "spam") && n >= 3) {
+            cmd_spam(atof(a), atof(b), n >= 4 ? (size_t) atoi(d) : 100);
+        } else if (!strcmp(c, "sleep") && n == 2) {
+            event("sleeping for %ss", a);
+            sleep_until(now_ns() + (uint64_t)(atof(a) * 1e9));
+        } else if (!strcmp(c, "spawn") && n >= 2) {
+            cmd_spawn(atof(a), n >= 3 && !strcmp(b, "ignterm"));
+        } else if (!strcmp(c, "onterm") && n >= 2 && !strcmp(a, "ignore")) {
+            st.ignore_term = true;
+        } else if (!strcmp(c, "onterm") && n >= 3 && !strcmp(a, "exit")) {
+            st.ignore_term = false;
+            st.term_code = atoi(b);
+            st.term_delay = n >= 4 ? atof(d) : 0;
+        } else if (!strcmp(c, "crash") && n == 2) {
+            cmd_crash(a);
+        } else if (!strcmp(c, "exit") && n == 2) {
+            event("exiting with status %d", atoi(a));
+            return atoi(a);
+        } else if (!strcmp(c, "loop") && n == 1) {
+            // the commands were modified in-place, so re-read the scenario
+            free(scenario);
+            next = scenario = read_scenario(argc, argv);
+        } else {
+            event("invalid command '%s'", cur);
+            return 2;
+        }
+    }
+    event("end of scenario");
+    return 0;
+}
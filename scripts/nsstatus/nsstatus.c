@@ -0,0 +1,135 @@
+/**
+ * Reads the status pages written by nswrap (see NSWRAP_STATUS_FILE), as an
+ * example of a host agent monitoring many servers. The layout comes directly
+ * from nswrap.c.
+ *
+ *     gcc -Wall -Wextra -Wno-trampolines -std=gnu11 -O2 -pthread -o nsstatus nsstatus.c -lm
+ *
+ * usage: nsstatus [-i sec] [-n reads] file...
+ *
+ * With -i, the status is printed every sec seconds until interrupted. With -n,
+ * instead of printing the status, every file is read that many times, and the
+ * average time per read and the number of retries (i.e., reads which raced with
+ * an update) are printed.
+ */
+
+#define main nswrap_main
+#include "../../src/nswrap/nswrap.c"
+#undef main
+
+/** Copies a consistent snapshot of the page, returning the number of retries. */
+static uint64_t nss_read(const struct ns_statuspage_data *d, struct ns_statuspage_data *out) {
+    for (uint64_t retries = 0;; retries++) {
+        uint32_t seq = atomic_load_explicit(&d->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        memcpy(out, (const void *) d, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&d->seq, memory_order_relaxed) == seq) {
+            return retries;
+        }
+    }
+}
+
+static uint64_t nss_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void nss_print(const char *name, const struct ns_statuspage_data *d) {
+    uint64_t now = nss_now_ns();
+    printf("%s: nswrap %d, wine %d, up %.0fs", name, d->nswrap_pid, d->wine_pid, (now - d->start_ns) / 1e9);
+    if (d->player_count >= 0) {
+        printf(", [%d/%d %s %s]", d->player_count, d->max_players, d->map_name, d->playlist_name);
+    }
+    if (d->titles) {
+        printf(", %llu titles (last %.1fs ago)", (unsigned long long) (d->titles), (now - d->title_ns) / 1e9);
+    }
+    printf(", %llu output bytes, watchdog %.1fs (peak %.0fms, %llu loads, longest %.1fs)",
+        (unsigned long long) (d->output_bytes), d->watchdog_timeout_ms / 1e3, d->watchdog_peak_us / 1e3,
+        (unsigned long long) (d->watchdog_loads), d->watchdog_load_max_ms / 1e3);
+    static const char *const flags[] = { "initialized", "loading", "paused", "draining", "exiting" };
+    for (size_t i = 0; i < sizeof(flags) / sizeof(*flags); i++) {
+        if (d->flags & (1 << i)) {
+            printf(", %s", flags[i]);
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    double interval = 0;
+    unsigned long reads = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+        switch (opt) {
+        case 'i': interval = atof(optarg); break;
+        case 'n': reads = strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-i sec] [-n reads] file...\n", argv[0]);
+            return 2;
+        }
+    }
+    int n = argc - optind;
+    if (!n) {
+        fprintf(stderr, "usage: %s [-i sec] [-n reads] file...\n", argv[0]);
+        return 2;
+    }
+
+    const struct ns_statuspage_data **pages = calloc(n, sizeof(*pages));
+    for (int i = 0; i < n; i++) {
+        const char *name = argv[optind + i];
+        int fd = open(name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "error: open '%s': %m\n", name);
+            return 1;
+        }
+        struct stat st;
+        if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(**pages)) {
+            fprintf(stderr, "error: '%s' is not a status page\n", name);
+            return 1;
+        }
+        void *m = mmap(NULL, sizeof(**pages), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (m == MAP_FAILED) {
+            fprintf(stderr, "error: mmap '%s': %m\n", name);
+            return 1;
+        }
+        pages[i] = m;
+        if (pages[i]->magic != NS_STATUSPAGE_MAGIC || pages[i]->version != NS_STATUSPAGE_VERSION) {
+            fprintf(stderr, "error: '%s' is not a version %d status page\n", name, NS_STATUSPAGE_VERSION);
+            return 1;
+        }
+    }
+
+    if (reads) {
+        struct ns_statuspage_data d;
+        uint64_t retries = 0, sum = 0, t = nss_now_ns();
+        for (unsigned long r = 0; r < reads; r++) {
+            for (int i = 0; i < n; i++) {
+                retries += nss_read(pages[i], &d);
+                sum += d.titles;
+            }
+        }
+        t = nss_now_ns() - t;
+        printf("%lu reads of %d pages: %.1fns/read, %llu retries (checksum %llu)\n",
+            reads, n, (double) t / reads / n, (unsigned long long) (retries), (unsigned long long) (sum));
+        return 0;
+    }
+
+    for (;;) {
+        for (int i = 0; i < n; i++) {
+            struct ns_statuspage_data d;
+            nss_read(pages[i], &d);
+            nss_print(argv[optind + i], &d);
+        }
+        if (interval <= 0) {
+            break;
+        }
+        fflush(stdout);
+        usleep(interval * 1e6);
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+/**
+ * A local aggregator for the telemetry frames sent by nswrap (see NSWRAP_TELEMETRY), as a stand-in for a real one and
+ * for testing the format. The format comes directly from nswrap.c.
+ *
+ *     gcc -Wall -Wextra -Wno-trampolines -std=gnu11 -O2 -pthread -o nstelemetry nstelemetry.c -lm
+ *
+ * usage: nstelemetry [-i sec] [-n frames] address
+ *
+ * The address is the same as NSWRAP_TELEMETRY (unix:/path or udp:ip:port). Every sec seconds (default 1), the sums of
+ * the frames received during the interval are printed, followed by the servers which were seen during the last few
+ * intervals. With -n, it exits after that many frames.
+ */
+
+#define main nswrap_main
+#include "../../src/nswrap/nswrap.c"
+#undef main
+
+/** The last frame of a session, for the per-server lines and for detecting lost frames. */
+struct nst_server {
+    struct ns_telemetry_frame f;
+    uint64_t seen_ns;
+    uint64_t frames;
+    uint64_t lost;
+};
+
+/** The sums of the frames received during an interval. */
+struct nst_sum {
+    uint64_t frames;
+    uint64_t invalid;
+    uint64_t lost;
+    uint64_t output_bytes;
+    uint64_t titles;
+    uint64_t watchdog_loads;
+    uint64_t cadence[NS_TELEMETRY_CADENCE];
+};
+
+static struct nst_server *nst_servers;
+static size_t nst_servers_n;
+
+static struct nst_server *nst_server(uint64_t session) {
+    for (size_t i = 0; i < nst_servers_n; i++) {
+        if (nst_servers[i].f.session == session) {
+            return &nst_servers[i];
+        }
+    }
+    nst_servers = realloc(nst_servers, ++nst_servers_n * sizeof(*nst_servers));
+    struct nst_server *s = &nst_servers[nst_servers_n - 1];
+    *s = (struct nst_server) {};
+    return s;
+}
+
+static void nst_add(struct nst_sum *sum, const uint8_t *buf, size_t n, uint64_t now) {
+    struct ns_telemetry_frame f;
+    if (ns_telemetry_decode(&f, buf, n)) {
+        sum->invalid++;
+        return;
+    }
+    struct nst_server *s = nst_server(f.session);
+    if (s->frames && f.seq > s->f.seq + 1) {
+        s->lost += f.seq - s->f.seq - 1;
+        sum->lost += f.seq - s->f.seq - 1;
+    }
+    s->f = f;
+    s->seen_ns = now;
+    s->frames++;
+
+    sum->frames++;
+    sum->output_bytes += f.output_bytes;
+    sum->titles += f.titles;
+    sum->watchdog_loads += f.watchdog_loads;
+    for (size_t b = 0; b < NS_TELEMETRY_CADENCE; b++) {
+        sum->cadence[b] += f.cadence[b];
+    }
+}
+
+static void nst_print(const struct nst_sum *sum, double dt, uint64_t now) {
+    int servers = 0, players = 0, slots = 0;
+    uint64_t memory = 0, restarts = 0;
+    for (size_t i = 0; i < nst_servers_n; i++) {
+        const struct nst_server *s = &nst_servers[i];
+        if (s->f.flags & NS_TELEMETRY_FINAL || now - s->seen_ns > 5 * dt * 1e9) {
+            continue;
+        }
+        servers++;
+        players += s->f.player_count > 0 ? s->f.player_count : 0;
+        slots += s->f.max_players > 0 ? s->f.max_players : 0;
+        memory += s->f.memory_kib;
+        restarts += s->f.restarts;
+    }
+    printf("%d servers, %d/%d players, %.1f MiB, %llu restarts | %llu frames (%llu lost, %llu invalid), %.0f titles/s, %.0f output B/s, %llu map loads\n",
+        servers, players, slots, memory / 1024.0, (unsigned long long) (restarts),
+        (unsigned long long) (sum->frames), (unsigned long long) (sum->lost), (unsigned long long) (sum->invalid),
+        sum->titles / dt, sum->output_bytes / dt, (unsigned long long) (sum->watchdog_loads));
+    printf("  title cadence:");
+    for (size_t b = 0; b < NS_TELEMETRY_CADENCE; b++) {
+        if (b < NS_TELEMETRY_CADENCE - 1) {
+            printf(" <=%gms %llu", ns_telemetry_cadence_us[b] / 1e3, (unsigned long long) (sum->cadence[b]));
+        } else {
+            printf(" >%gms %llu", ns_telemetry_cadence_us[b - 1] / 1e3, (unsigned long long) (sum->cadence[b]));
+        }
+    }
+    printf("\n");
+    for (size_t i = 0; i < nst_servers_n; i++) {
+        const struct nst_server *s = &nst_servers[i];
+        if (now - s->seen_ns > 5 * dt * 1e9) {
+            continue;
+        }
+        printf("  %s (session %016llx, pid %u): up %us, [%d/%d %s %s], %.1f MiB, watchdog %.1fs, %llu frames, %llu lost%s\n",
+            *s->f.id ? s->f.id : "?", (unsigned long long) (s->f.session), s->f.nswrap_pid, s->f.uptime_sec,
+            s->f.player_count, s->f.max_players, *s->f.map_name ? s->f.map_name : "???", *s->f.playlist_name ? s->f.playlist_name : "???",
+            s->f.memory_kib / 1024.0, s->f.watchdog_timeout_ms / 1e3,
+            (unsigned long long) (s->frames), (unsigned long long) (s->lost),
+            s->f.flags & NS_TELEMETRY_FINAL ? ", exited" : "");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    double interval = 1;
+    unsigned long frames = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "i:n:")) != -1) {
+        switch (opt) {
+        case 'i': interval = atof(optarg); break;
+        case 'n': frames = strtoul(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [-i sec] [-n frames] address\n", argv[0]);
+            return 2;
+        }
+    }
+    if (argc - optind != 1 || interval <= 0) {
+        fprintf(stderr, "usage: %s [-i sec] [-n frames] address\n", argv[0]);
+        return 2;
+    }
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    if (ns_telemetry_addr(argv[optind], &addr, &addr_len)) {
+        fprintf(stderr, "error: invalid address '%s' (must be unix:/path or udp:ip:port)\n", argv[optind]);
+        return 2;
+    }
+    int fd = socket(addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        fprintf(stderr, "error: create socket: %m\n");
+        return 1;
+    }
+    if (addr.ss_family == AF_UNIX) {
+        unlink(((struct sockaddr_un*) &addr)->sun_path);
+    }
+    if (bind(fd, (struct sockaddr*) &addr, addr_len) == -1) {
+        fprintf(stderr, "error: bind '%s': %m\n", argv[optind]);
+        return 1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &(int){4 * 1024 * 1024}, sizeof(int));
+
+    struct nst_sum sum = {};
+    unsigned long total = 0;
+    uint64_t last = ns_telemetry_now();
+    for (;;) {
+        uint64_t now = ns_telemetry_now();
+        int timeout = (last + interval * 1e9 - now) / 1e6;
+        if (timeout < 0) {
+            timeout = 0;
+        }
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        if (poll(&pfd, 1, timeout) == -1 && errno != EINTR) {
+            fprintf(stderr, "error: poll: %m\n");
+            return 1;
+        }
+        now = ns_telemetry_now();
+        if (pfd.revents & POLLIN) {
+            uint8_t buf[4096];
+            ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+            if (n >= 0) {
+                nst_add(&sum, buf, n, now);
+                total++;
+            }
+        }
+        bool done = frames && total >= frames;
+        if (done || now - last >= interval * 1e9) {
+            nst_print(&sum, (now - last) / 1e9, now);
+            sum = (struct nst_sum) {};
+            last = now;
+        }
+        if (done) {
+            break;
+        }
+    }
+    if (addr.ss_family == AF_UNIX) {
+        unlink(((struct sockaddr_un*) &addr)->sun_path);
+    }
+    return 0;
+}
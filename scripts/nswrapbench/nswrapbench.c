@@ -0,0 +1,367 @@
+/**
+ * Benchmark for the nswrap console forwarding path (ns_ioproc, ns_status_parse,
+ * and ns_watchdog), built directly from nswrap.c.
+ *
+ * A forked child writes a trace to the pty slave in chunks at a controlled rate,
+ * and the parent runs the same epoll loop as nswrap: the processed output is
+ * written to /dev/null, and every title update is parsed and sent to the
+ * watchdog (nswrap only parses them every 0.2s, so this is the worst case). At
+ * the end, it prints the throughput, the syscalls made by the parent per MiB of
+ * input, and the CPU time used by the parent per MiB of input.
+ *
+ *     gcc -Wall -Wextra -Wno-trampolines -std=gnu11 -O3 -pthread -o nswrapbench nswrapbench.c -lm
+ *
+ * usage: nswrapbench [-m plain|ansi|title|mixed] [-f trace] [-n MiB] [-c bytes] [-r KiB/s] [-o trace]
+ *
+ * The synthetic traces are:
+ *
+ * - plain: uncolored log lines (the fast path with no escape sequences)
+ * - ansi:  log lines with color codes and cursor movements
+ * - title: a title update before every line (an OSC title storm)
+ * - mixed: colored log lines with a title update every few lines (the default)
+ *
+ * With -f, a raw recording of the game's terminal output is replayed instead.
+ * To record one (nswrap strips the escapes, so it can't be used for this), run
+ * the server under script(1) with the same command line nswrap uses, e.g.,
+ * `script -q -O trace.raw -c 'wine64 NorthstarLauncher.exe -dedicated ...'`.
+ * The synthetic traces can be saved with -o.
+ *
+ * The trace is repeated until -n MiB have been written (default 64). With -c 0,
+ * the chunks have random sizes up to twice NS_IOPROC_OUTPUT_CHUNK_SIZE so escape
+ * sequences and titles get split across reads; otherwise every write is -c bytes
+ * (default 4096). With -r, the writes are paced to that rate.
+ *
+ * Run it before and after a change to the forwarding path with the same
+ * arguments and compare the syscalls/MiB and CPU ms/MiB.
+ */
+
+#define main nswrap_main
+#include "../../src/nswrap/nswrap.c"
+#undef main
+
+#include <sys/resource.h>
+
+#define NSB_TRACE_SIZE (1024 * 1024)
+
+static uint64_t nsb_rand_state = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t nsb_rand(void) {
+    nsb_rand_state ^= nsb_rand_state << 13;
+    nsb_rand_state ^= nsb_rand_state >> 7;
+    nsb_rand_state ^= nsb_rand_state << 17;
+    return (uint32_t)(nsb_rand_state >> 32);
+}
+
+static uint64_t nsb_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t nsb_cpu_ns(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ULL + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ULL;
+}
+
+/** Gets the number of read and write syscalls made by this process from /proc/self/io, or -1. */
+static long long nsb_io_syscalls(void) {
+    FILE *f = fopen("/proc/self/io", "r");
+    if (!f) {
+        return -1;
+    }
+    long long r = -1, w = -1, v;
+    char k[32];
+    while (fscanf(f, "%31[^:]: %lld\n", k, &v) == 2) {
+        if (!strcmp(k, "syscr")) {
+            r = v;
+        } else if (!strcmp(k, "syscw")) {
+            w = v;
+        }
+    }
+    fclose(f);
+    return r == -1 || w == -1 ? -1 : r + w;
+}
+
+/** Generates a synthetic trace into buf, returning the size. */
+static size_t nsb_generate(const char *mode, char *buf, size_t buf_sz) {
+    static const char *const maps[] = {"mp_forwardbase_kodai", "mp_glitch", "mp_homestead", "mp_thaw", "mp_black_water_canal"};
+    static const char *const modes[] = {"aitdm", "tdm", "ctf", "ps", "lts"};
+    static const char *const msgs[] = {
+        "[SERVER SCRIPT] player %u connected from 10.0.%u.%u",
+        "[NORTHSTAR] [info] Loading mod Northstar.CustomServers %u.%u.%u",
+        "[SERVER SCRIPT] [Northstar.Custom] ClientCommand: player %u (%u) sent %u",
+        "[NORTHSTAR] [info] Received %u bytes of persistent data from the masterserver (%u.%u)",
+    };
+    bool ansi = strcmp(mode, "plain");
+    size_t n = 0;
+    for (unsigned i = 0; n + 512 < buf_sz; i++) {
+        unsigned m = nsb_rand() % 5;
+        if (!strcmp(mode, "title") || (!strcmp(mode, "mixed") && i % 8 == 0)) {
+            unsigned max = 8 + nsb_rand() % 9;
+            n += snprintf(buf + n, buf_sz - n, "\x1B]0;Titanfall 2 - %s %u/%u players (%s)\x07", maps[m], nsb_rand() % (max + 1), max, modes[m]);
+        }
+        unsigned t = i / 10;
+        if (ansi) {
+            n += snprintf(buf + n, buf_sz - n, "\x1B[0m[%02u:%02u:%02u] [\x1B[32m\x1B[1minfo\x1B[0m] \x1B[38;2;192;192;192m", t / 3600 % 24, t / 60 % 60, t % 60);
+        } else {
+            n += snprintf(buf + n, buf_sz - n, "[%02u:%02u:%02u] [info] ", t / 3600 % 24, t / 60 % 60, t % 60);
+        }
+        n += snprintf(buf + n, buf_sz - n, msgs[nsb_rand() % 4], nsb_rand() % 1000, nsb_rand() % 256, nsb_rand() % 256);
+        if (ansi && i % 4 == 0) {
+            n += snprintf(buf + n, buf_sz - n, "\x1B[0m\x1B[1C\x1B[K\x1B[?25h");
+        }
+        n += snprintf(buf + n, buf_sz - n, "\n");
+    }
+    return n;
+}
+
+/** Counts the title updates in a trace. */
+static uint64_t nsb_count_titles(const char *buf, size_t n) {
+    uint64_t c = 0;
+    for (const char *x = buf; (x = memmem(x, n - (x - buf), "\x1B]0;", 4)); x += 4) {
+        c++;
+    }
+    return c;
+}
+
+/** Writes the trace to fd until total bytes are written. */
+static int nsb_child(int fd, const char *trace, size_t trace_sz, uint64_t total, size_t chunk, uint64_t rate) {
+    uint64_t written = 0, start = nsb_now_ns();
+    size_t off = 0;
+    while (written < total) {
+        size_t n = chunk ? chunk : 1 + nsb_rand() % (NS_IOPROC_OUTPUT_CHUNK_SIZE * 2);
+        if (n > trace_sz - off) {
+            n = trace_sz - off;
+        }
+        if (n > total - written) {
+            n = total - written;
+        }
+        if (rate) {
+            uint64_t due = start + written * 1000000000ULL / rate, t = nsb_now_ns();
+            if (due > t) {
+                nanosleep(&(struct timespec){ .tv_sec = (due - t) / 1000000000ULL, .tv_nsec = (due - t) % 1000000000ULL }, NULL);
+            }
+        }
+        ssize_t r = write(fd, trace + off, n);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("error: write pty slave");
+            return 1;
+        }
+        written += r;
+        if ((off += r) == trace_sz) {
+            off = 0;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *mode = "mixed", *in = NULL, *out = NULL;
+    uint64_t total = 64, rate = 0;
+    size_t chunk = 4096;
+    for (int c; (c = getopt(argc, argv, "m:f:n:c:r:o:")) != -1;) {
+        switch (c) {
+        case 'm': mode = optarg; break;
+        case 'f': in = optarg; break;
+        case 'n': total = strtoull(optarg, NULL, 10); break;
+        case 'c': chunk = strtoul(optarg, NULL, 10); break;
+        case 'r': rate = strtoull(optarg, NULL, 10) * 1024; break;
+        case 'o': out = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-m plain|ansi|title|mixed] [-f trace] [-n MiB] [-c bytes] [-r KiB/s] [-o trace]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (!total) {
+        fprintf(stderr, "error: -n must be positive\n");
+        return 2;
+    }
+    total *= 1024 * 1024;
+
+    char *trace;
+    size_t trace_sz;
+    if (in) {
+        FILE *f = fopen(in, "rb");
+        if (!f) {
+            perror("error: open trace");
+            return 1;
+        }
+        if (!(trace = malloc(NSB_TRACE_SIZE * 64))) {
+            perror("error: allocate trace");
+            return 1;
+        }
+        trace_sz = fread(trace, 1, NSB_TRACE_SIZE * 64, f);
+        fclose(f);
+        if (!trace_sz) {
+            fprintf(stderr, "error: trace is empty\n");
+            return 1;
+        }
+        mode = in;
+    } else {
+        if (strcmp(mode, "plain") && strcmp(mode, "ansi") && strcmp(mode, "title") && strcmp(mode, "mixed")) {
+            fprintf(stderr, "error: unknown trace mode %s\n", mode);
+            return 2;
+        }
+        if (!(trace = malloc(NSB_TRACE_SIZE))) {
+            perror("error: allocate trace");
+            return 1;
+        }
+        trace_sz = nsb_generate(mode, trace, NSB_TRACE_SIZE);
+    }
+    if (out) {
+        FILE *f = fopen(out, "wb");
+        if (!f || fwrite(trace, 1, trace_sz, f) != trace_sz || fclose(f)) {
+            perror("error: write trace");
+            return 1;
+        }
+    }
+
+    // the expected number of titles, including partial repetitions of the trace
+    uint64_t titles_exp = nsb_count_titles(trace, trace_sz) * (total / trace_sz) + nsb_count_titles(trace, total % trace_sz);
+
+    static struct ns_ioproc st_ioproc;
+    if (ns_ioproc_init(&st_ioproc)) {
+        perror("error: initialize ioproc");
+        return 1;
+    }
+
+    static struct ns_watchdog st_watchdog;
+    if (ns_watchdog_init(&st_watchdog, 2, 60, 10, 10, 60, 10)) {
+        perror("error: initialize watchdog");
+        return 1;
+    }
+
+    int fd_null = open("/dev/null", O_WRONLY | O_CLOEXEC);
+    if (fd_null == -1) {
+        perror("error: open /dev/null");
+        return 1;
+    }
+
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) {
+        perror("error: create epoll");
+        return 1;
+    }
+    if (ns_ioproc_output_epoll_add(&st_ioproc, epfd) || ns_ioproc_title_epoll_add(&st_ioproc, epfd) || ns_watchdog_epoll_add(&st_watchdog, epfd)) {
+        perror("error: add to epoll");
+        return 1;
+    }
+
+    uint64_t t0 = nsb_now_ns(), cpu0 = nsb_cpu_ns();
+    long long io0 = nsb_io_syscalls();
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("error: fork");
+        return 1;
+    }
+    if (pid == 0) {
+        _exit(nsb_child(ns_ioproc_output_pty(&st_ioproc), trace, trace_sz, total, chunk, rate));
+    }
+
+    // the child has the only reference to the slave now, so we'll get a hangup when it exits
+    close(st_ioproc.output.fd_pty_slave);
+    st_ioproc.output.fd_pty_slave = -1;
+
+    uint64_t n_epoll = 0, n_timer = 0, out_bytes = 0, titles = 0, titles_bad = 0, watchdog = 0;
+    for (bool done = false; !done;) {
+        struct epoll_event evt;
+        n_epoll++;
+        int n = epoll_wait(epfd, &evt, 1, -1);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("error: epoll_wait");
+            return 1;
+        }
+        if (ns_ioproc_output_epoll_check(&st_ioproc, evt)) {
+            if (evt.events & EPOLLHUP) {
+                int avail;
+                if (ioctl(st_ioproc.output.fd_pty_master, FIONREAD, &avail) == -1 || !avail) {
+                    done = true;
+                    continue;
+                }
+            }
+            size_t output_sz;
+            const char *output = ns_ioproc_output_epoll_process(&st_ioproc, &output_sz);
+            if (!output) {
+                perror("error: process output");
+                return 1;
+            }
+            if (output_sz && write(fd_null, output, output_sz) == -1) {
+                perror("error: write output");
+                return 1;
+            }
+            out_bytes += output_sz;
+            continue;
+        }
+        if (ns_ioproc_title_epoll_check(&st_ioproc, evt)) {
+            const char *title = ns_ioproc_title_epoll_process(&st_ioproc);
+            if (!title) {
+                perror("error: process title");
+                return 1;
+            }
+            if (*title) {
+                struct ns_status st;
+                titles++;
+                if (ns_status_parse(&st, title)) {
+                    titles_bad++;
+                }
+                n_timer++;
+                if (ns_watchdog_update(&st_watchdog, title)) {
+                    perror("error: update watchdog");
+                    return 1;
+                }
+            }
+            continue;
+        }
+        if (ns_watchdog_epoll_check(&st_watchdog, evt)) {
+            bool hang;
+            const char *err = ns_watchdog_epoll_process(&st_watchdog, &hang);
+            if (!err || hang) {
+                watchdog++;
+            }
+            continue;
+        }
+    }
+
+    // the remaining titles
+    for (const char *title; (title = ns_ioproc_title_epoll_process(&st_ioproc));) {
+        struct ns_status st;
+        if (!*title) {
+            continue;
+        }
+        titles++;
+        if (ns_status_parse(&st, title)) {
+            titles_bad++;
+        }
+    }
+
+    uint64_t t1 = nsb_now_ns(), cpu1 = nsb_cpu_ns();
+    long long io1 = nsb_io_syscalls();
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "error: writer failed\n");
+        return 1;
+    }
+
+    double mib = total / 1048576.0, sec = (t1 - t0) / 1e9;
+    printf("%s: %.1f MiB in %.2fs (%.1f MiB/s), output %.1f MiB\n", mode, mib, sec, mib / sec, out_bytes / 1048576.0);
+    if (io0 != -1 && io1 != -1) {
+        printf("syscalls: %.0f/MiB (read/write %.0f, epoll_wait %.0f, timerfd_settime %.0f)\n",
+            (io1 - io0 + n_epoll + n_timer) / mib, (io1 - io0) / mib, n_epoll / mib, n_timer / mib);
+    } else {
+        printf("syscalls: %.0f/MiB excluding read/write (epoll_wait %.0f, timerfd_settime %.0f)\n",
+            (n_epoll + n_timer) / mib, n_epoll / mib, n_timer / mib);
+    }
+    printf("cpu: %.2f ms/MiB (%.1f%% of a core)\n", (cpu1 - cpu0) / 1e6 / mib, 100.0 * (cpu1 - cpu0) / (t1 - t0));
+    printf("titles: %llu of %llu received (%.0f/s), %llu failed to parse, %llu watchdog timeouts\n",
+        (unsigned long long)(titles), (unsigned long long)(titles_exp), titles / sec, (unsigned long long)(titles_bad), (unsigned long long)(watchdog));
+    return titles == titles_exp ? 0 : 3;
+}
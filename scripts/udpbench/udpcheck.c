@@ -0,0 +1,291 @@
+/**
+ * Checks the observable semantics of nonblocking UDP socket calls, and
+ * measures their latency.
+ *
+ * This is meant for validating changes to the socket I/O path in our Wine
+ * build. Run it on the stock and patched builds (and on Windows, if possible)
+ * and diff the output of "check". It only prints behaviour, never ports or
+ * timings. Then compare the output of "bench", which measures the latency of
+ * empty and non-empty recvfrom calls, sendto, and a send/recv round trip on
+ * loopback.
+ *
+ *     x86_64-w64-mingw32-gcc -O2 -o udpcheck.exe udpcheck.c -lws2_32
+ *
+ * usage: udpcheck [check|bench] [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+static SOCKET mksock(BOOL nonblocking, DWORD flags, struct sockaddr_in *addr_out) {
+    SOCKET s = WSASocketW(AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, flags);
+    if (s == INVALID_SOCKET) {
+        fprintf(stderr, "error: socket: %d\n", WSAGetLastError());
+        exit(1);
+    }
+    struct sockaddr_in addr;
+    int len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) || getsockname(s, (struct sockaddr *)addr_out, &len)) {
+        fprintf(stderr, "error: bind: %d\n", WSAGetLastError());
+        exit(1);
+    }
+    u_long nb = nonblocking;
+    ioctlsocket(s, FIONBIO, &nb);
+    return s;
+}
+
+static void sendn(SOCKET s, const struct sockaddr_in *to, int n, char c) {
+    char buf[2048];
+    memset(buf, c, n);
+    if (sendto(s, buf, n, 0, (const struct sockaddr *)to, sizeof(*to)) != n) {
+        printf("  sendto(%d): error %d\n", n, WSAGetLastError());
+    }
+    Sleep(20); // let it arrive
+}
+
+/** Prints the result of a recvfrom call with a buffer of sz bytes. */
+static void recvn(const char *label, SOCKET s, int sz, int flags, const struct sockaddr_in *expect_from) {
+    char buf[2048];
+    struct sockaddr_in from;
+    int from_len = sizeof(from);
+    memset(buf, 0, sizeof(buf));
+    memset(&from, 0, sizeof(from));
+    int r = recvfrom(s, buf, sz, flags, (struct sockaddr *)&from, &from_len);
+    int err = r < 0 ? WSAGetLastError() : 0;
+    printf("%s: ret=%d err=%d", label, r, err);
+    if (r > 0 || err == WSAEMSGSIZE) {
+        printf(" data=%c*%d", buf[0], (int)strnlen(buf, sz));
+    }
+    if (r >= 0 || err == WSAEMSGSIZE) {
+        printf(" from_len=%d from=%s", from_len, expect_from && from.sin_port == expect_from->sin_port && from.sin_addr.s_addr == expect_from->sin_addr.s_addr ? "sender" : "other");
+    }
+    printf("\n");
+}
+
+static void check(void) {
+    struct sockaddr_in a_addr, b_addr;
+    SOCKET a = mksock(TRUE, 0, &a_addr);
+    SOCKET b = mksock(TRUE, 0, &b_addr);
+
+    recvn("empty", b, 100, 0, NULL);
+
+    sendn(a, &b_addr, 100, 'x');
+    recvn("basic", b, 2048, 0, &a_addr);
+    recvn("basic drained", b, 2048, 0, NULL);
+
+    sendn(a, &b_addr, 100, 't');
+    recvn("truncated", b, 10, 0, &a_addr);
+    recvn("truncated drained", b, 2048, 0, NULL);
+
+    sendn(a, &b_addr, 50, 'p');
+    recvn("peek", b, 2048, MSG_PEEK, &a_addr);
+    recvn("peek truncated", b, 10, MSG_PEEK, &a_addr);
+    recvn("after peek", b, 2048, 0, &a_addr);
+    recvn("after peek drained", b, 2048, 0, NULL);
+
+    sendn(a, &b_addr, 0, 'z');
+    recvn("zero length", b, 2048, 0, &a_addr);
+
+    sendn(a, &b_addr, 50, 'f');
+    sendn(a, &b_addr, 70, 'g');
+    {
+        u_long n = 0;
+        int r = ioctlsocket(b, FIONREAD, &n);
+        printf("fionread: ret=%d n=%lu\n", r, n);
+    }
+    {
+        fd_set rfds;
+        struct timeval tv = { 0, 0 };
+        FD_ZERO(&rfds);
+        FD_SET(b, &rfds);
+        printf("select with data: %d\n", select(0, &rfds, NULL, NULL, &tv));
+    }
+    recvn("fionread 1", b, 2048, 0, &a_addr);
+    recvn("fionread 2", b, 2048, 0, &a_addr);
+    {
+        fd_set rfds;
+        struct timeval tv = { 0, 0 };
+        FD_ZERO(&rfds);
+        FD_SET(b, &rfds);
+        printf("select drained: %d\n", select(0, &rfds, NULL, NULL, &tv));
+    }
+
+    // FD_READ must be re-enabled by each recv (this is what the wineserver round trip after a recv is for)
+    {
+        WSAEVENT ev = WSACreateEvent();
+        WSANETWORKEVENTS ne;
+        WSAEventSelect(b, ev, FD_READ);
+        printf("eventselect empty: wait=%lu\n", WaitForSingleObject(ev, 50));
+        sendn(a, &b_addr, 10, 'e');
+        sendn(a, &b_addr, 11, 'e');
+        printf("eventselect data: wait=%lu\n", WaitForSingleObject(ev, 50));
+        WSAEnumNetworkEvents(b, ev, &ne);
+        printf("eventselect enum: events=%lx err=%d\n", ne.lNetworkEvents, ne.iErrorCode[FD_READ_BIT]);
+        printf("eventselect after enum: wait=%lu\n", WaitForSingleObject(ev, 50));
+        recvn("eventselect 1", b, 2048, 0, &a_addr);
+        printf("eventselect reenabled: wait=%lu\n", WaitForSingleObject(ev, 50));
+        WSAEnumNetworkEvents(b, ev, &ne);
+        recvn("eventselect 2", b, 2048, 0, &a_addr);
+        printf("eventselect drained: wait=%lu\n", WaitForSingleObject(ev, 50));
+        recvn("eventselect empty recv", b, 2048, 0, NULL);
+        sendn(a, &b_addr, 12, 'e');
+        printf("eventselect new data: wait=%lu\n", WaitForSingleObject(ev, 50));
+        recvn("eventselect 3", b, 2048, 0, &a_addr);
+        WSAEventSelect(b, NULL, 0);
+        WSACloseEvent(ev);
+    }
+
+    // overlapped i/o must still go through the async path
+    {
+        struct sockaddr_in c_addr, from;
+        SOCKET c = mksock(FALSE, WSA_FLAG_OVERLAPPED, &c_addr);
+        char buf[2048];
+        WSABUF wb = { sizeof(buf), buf };
+        DWORD n = 0, flags = 0;
+        int from_len = sizeof(from);
+        WSAOVERLAPPED ov;
+        memset(&ov, 0, sizeof(ov));
+        memset(&from, 0, sizeof(from));
+        ov.hEvent = WSACreateEvent();
+        int r = WSARecvFrom(c, &wb, 1, &n, &flags, (struct sockaddr *)&from, &from_len, &ov, NULL);
+        printf("overlapped post: ret=%d err=%d\n", r, r ? WSAGetLastError() : 0);
+        sendn(a, &c_addr, 33, 'o');
+        BOOL ok = WSAGetOverlappedResult(c, &ov, &n, TRUE, &flags);
+        printf("overlapped result: ok=%d n=%lu from=%s\n", ok, n, from.sin_port == a_addr.sin_port ? "sender" : "other");
+        WSACloseEvent(ov.hEvent);
+        closesocket(c);
+    }
+
+    // connected sockets
+    {
+        connect(a, (struct sockaddr *)&b_addr, sizeof(b_addr));
+        int r = send(a, "hello", 5, 0);
+        Sleep(20);
+        printf("connected send: ret=%d\n", r);
+        recvn("connected recv", b, 2048, 0, &a_addr);
+    }
+
+    // icmp port unreachable
+    {
+        struct sockaddr_in d_addr;
+        SOCKET d = mksock(TRUE, 0, &d_addr);
+        closesocket(d);
+        SOCKET e = mksock(TRUE, 0, &d_addr);
+        struct sockaddr_in gone = d_addr;
+        gone.sin_port = htons(ntohs(d_addr.sin_port) == 65535 ? 65534 : ntohs(d_addr.sin_port) + 1);
+        sendn(e, &gone, 10, 'u');
+        recvn("port unreachable", e, 2048, 0, NULL);
+        recvn("port unreachable again", e, 2048, 0, NULL);
+        closesocket(e);
+    }
+
+    closesocket(a);
+    closesocket(b);
+}
+
+static int cmp_ll(const void *a, const void *b) {
+    long long x = *(const long long *)a, y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_report(const char *label, long long *t, int n, LARGE_INTEGER f) {
+    qsort(t, n, sizeof(*t), cmp_ll);
+    long long sum = 0;
+    for (int i = 0; i < n; i++) {
+        sum += t[i];
+    }
+    #define ns(x) ((double)(x) * 1e9 / f.QuadPart)
+    printf("%-24s avg %8.0fns  p50 %8.0fns  p99 %8.0fns  max %8.0fns\n", label, ns(sum) / n, ns(t[n / 2]), ns(t[n * 99 / 100]), ns(t[n - 1]));
+    #undef ns
+}
+
+static void bench(int n) {
+    struct sockaddr_in a_addr, b_addr;
+    SOCKET a = mksock(TRUE, 0, &a_addr);
+    SOCKET b = mksock(TRUE, 0, &b_addr);
+    LARGE_INTEGER f, t0, t1;
+    long long *t = calloc(n, sizeof(*t));
+    char buf[2048];
+    memset(buf, 'b', sizeof(buf));
+    QueryPerformanceFrequency(&f);
+
+    for (int i = 0; i < n; i++) {
+        QueryPerformanceCounter(&t0);
+        recvfrom(b, buf, sizeof(buf), 0, NULL, NULL);
+        QueryPerformanceCounter(&t1);
+        t[i] = t1.QuadPart - t0.QuadPart;
+    }
+    bench_report("recvfrom (empty)", t, n, f);
+
+    for (int i = 0; i < n; i++) {
+        QueryPerformanceCounter(&t0);
+        sendto(a, buf, 200, 0, (struct sockaddr *)&b_addr, sizeof(b_addr));
+        QueryPerformanceCounter(&t1);
+        t[i] = t1.QuadPart - t0.QuadPart;
+        if (i % 64 == 63) {
+            while (recvfrom(b, buf, sizeof(buf), 0, NULL, NULL) > 0);
+        }
+    }
+    bench_report("sendto", t, n, f);
+    while (recvfrom(b, buf, sizeof(buf), 0, NULL, NULL) > 0);
+
+    for (int i = 0; i < n; i++) {
+        sendto(a, buf, 200, 0, (struct sockaddr *)&b_addr, sizeof(b_addr));
+        for (int j = 0; j < 1000; j++) {
+            fd_set rfds;
+            struct timeval tv = { 0, 1000 };
+            FD_ZERO(&rfds);
+            FD_SET(b, &rfds);
+            if (select(0, &rfds, NULL, NULL, &tv) > 0) {
+                break;
+            }
+        }
+        QueryPerformanceCounter(&t0);
+        recvfrom(b, buf, sizeof(buf), 0, NULL, NULL);
+        QueryPerformanceCounter(&t1);
+        t[i] = t1.QuadPart - t0.QuadPart;
+    }
+    bench_report("recvfrom (ready)", t, n, f);
+
+    for (int i = 0; i < n; i++) {
+        QueryPerformanceCounter(&t0);
+        sendto(a, buf, 200, 0, (struct sockaddr *)&b_addr, sizeof(b_addr));
+        while (recvfrom(b, buf, sizeof(buf), 0, NULL, NULL) < 0 && WSAGetLastError() == WSAEWOULDBLOCK);
+        QueryPerformanceCounter(&t1);
+        t[i] = t1.QuadPart - t0.QuadPart;
+    }
+    bench_report("sendto+recvfrom (spin)", t, n, f);
+
+    free(t);
+    closesocket(a);
+    closesocket(b);
+}
+
+int main(int argc, char **argv) {
+    const char *mode = argc > 1 ? argv[1] : "check";
+    int n = argc > 2 ? atoi(argv[2]) : 100000;
+
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa)) {
+        fprintf(stderr, "error: WSAStartup failed\n");
+        return 1;
+    }
+    if (!strcmp(mode, "check")) {
+        check();
+    } else if (!strcmp(mode, "bench") && n > 0) {
+        bench(n);
+    } else {
+        fprintf(stderr, "usage: %s [check|bench] [iterations]\n", argv[0]);
+        return 2;
+    }
+    WSACleanup();
+    return 0;
+}
@@ -0,0 +1,164 @@
+/**
+ * UDP echo target for measuring per-packet socket overhead under Wine.
+ *
+ * It mimics the network loop of the game server: every tick, it drains the
+ * nonblocking socket with recvfrom until it would block, then echoes each
+ * datagram back with sendto. Every second, it prints the packet rates and the
+ * average time spent in each call. Build it for Windows to run under Wine, or
+ * natively for a baseline.
+ *
+ *     x86_64-w64-mingw32-gcc -O2 -o udpecho.exe udpecho.c -lws2_32
+ *     gcc -O2 -o udpecho udpecho.c
+ *
+ * usage: udpecho [port] [tick_us]
+ *
+ * See udpload.c for the load generator.
+ */
+
+#ifndef _WIN32
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+#define sock_err() WSAGetLastError()
+#define SOCK_EWOULDBLOCK WSAEWOULDBLOCK
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define closesocket close
+#define sock_err() errno
+#define SOCK_EWOULDBLOCK EWOULDBLOCK
+#endif
+
+static long long now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER f;
+    LARGE_INTEGER c;
+    if (!f.QuadPart) {
+        QueryPerformanceFrequency(&f);
+    }
+    QueryPerformanceCounter(&c);
+    return (long long)(c.QuadPart / f.QuadPart) * 1000000000LL + (long long)(c.QuadPart % f.QuadPart) * 1000000000LL / f.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+#endif
+}
+
+static void sleep_us(int us) {
+#ifdef _WIN32
+    Sleep(us / 1000);
+#else
+    nanosleep(&(struct timespec){ .tv_sec = us / 1000000, .tv_nsec = (us % 1000000) * 1000L }, NULL);
+#endif
+}
+
+int main(int argc, char **argv) {
+    int port = argc > 1 ? atoi(argv[1]) : 37099;
+    int tick_us = argc > 2 ? atoi(argv[2]) : 1000;
+
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa)) {
+        fprintf(stderr, "error: WSAStartup failed\n");
+        return 1;
+    }
+#endif
+
+    SOCKET s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s == INVALID_SOCKET) {
+        fprintf(stderr, "error: socket: %d\n", sock_err());
+        return 1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr))) {
+        fprintf(stderr, "error: bind: %d\n", sock_err());
+        return 1;
+    }
+
+#ifdef _WIN32
+    u_long nb = 1;
+    if (ioctlsocket(s, FIONBIO, &nb)) {
+        fprintf(stderr, "error: ioctlsocket: %d\n", sock_err());
+        return 1;
+    }
+#else
+    if (fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK)) {
+        fprintf(stderr, "error: fcntl: %d\n", sock_err());
+        return 1;
+    }
+#endif
+
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, (const char *)&rcvbuf, sizeof(rcvbuf));
+
+    printf("listening on udp port %d with a %dus tick\n", port, tick_us);
+    fflush(stdout);
+
+    long long recv_n = 0, send_n = 0, block_n = 0, recv_ns = 0, send_ns = 0, block_ns = 0, err_n = 0;
+    long long last = now_ns();
+    for (;;) {
+        for (;;) {
+            char buf[2048];
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+
+            long long t0 = now_ns();
+            int n = recvfrom(s, buf, sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+            long long t1 = now_ns();
+            if (n < 0) {
+                if (sock_err() == SOCK_EWOULDBLOCK) {
+                    block_n++;
+                    block_ns += t1 - t0;
+                } else {
+                    err_n++;
+                }
+                break;
+            }
+            recv_n++;
+            recv_ns += t1 - t0;
+
+            t0 = now_ns();
+            if (sendto(s, buf, n, 0, (struct sockaddr *)&from, from_len) == n) {
+                send_n++;
+                send_ns += now_ns() - t0;
+            } else {
+                err_n++;
+            }
+        }
+
+        long long t = now_ns();
+        if (t - last >= 1000000000LL) {
+            double sec = (t - last) / 1e9;
+            printf("recv %.0f/s, send %.0f/s, wouldblock %.0f/s, errors %lld | avg recvfrom %.0fns, sendto %.0fns, empty recvfrom %.0fns\n",
+                recv_n / sec, send_n / sec, block_n / sec, err_n,
+                recv_n ? (double)(recv_ns) / recv_n : 0, send_n ? (double)(send_ns) / send_n : 0, block_n ? (double)(block_ns) / block_n : 0);
+            fflush(stdout);
+            recv_n = send_n = block_n = recv_ns = send_ns = block_ns = err_n = 0;
+            last = t;
+        }
+        if (tick_us) {
+            sleep_us(tick_us);
+        }
+    }
+}
@@ -0,0 +1,240 @@
+/**
+ * Loopback UDP load generator for measuring the per-packet cost of a server
+ * (e.g., udpecho.exe under Wine, or the game server itself).
+ *
+ * It sends datagrams at a fixed rate with sendmmsg, collects the replies with
+ * recvmmsg, and samples the CPU time of the given processes (and their
+ * threads) from /proc. Every second and at the end, it prints the send and
+ * reply rates, loss, round-trip latency, and the CPU time used per reply.
+ *
+ *     gcc -O2 -o udpload udpload.c
+ *
+ * usage: udpload [-a addr] [-p port] [-r pps] [-s size] [-d sec] [-c pid,...]
+ *
+ * Typically, you'd run udpecho.exe with wine64, then run this with -c set to
+ * the pids of udpecho.exe and the wineserver, once with the stock Wine build
+ * and once with the patched one.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#define BATCH 64
+#define RTT_BUCKETS 2000
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Gets the total CPU time in ns of the comma-separated pids from /proc/[pid]/stat. */
+static uint64_t cpu_ns(const char *pids) {
+    uint64_t total = 0;
+    long tck = sysconf(_SC_CLK_TCK);
+    for (const char *p = pids; p && *p;) {
+        char path[64], buf[1024];
+        char *e;
+        long pid = strtol(p, &e, 10);
+        if (e == p) {
+            break;
+        }
+        p = *e == ',' ? e + 1 : e;
+        snprintf(path, sizeof(path), "/proc/%ld/stat", pid);
+        FILE *f = fopen(path, "r");
+        if (!f) {
+            continue;
+        }
+        size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+        fclose(f);
+        buf[n] = '\0';
+        char *x = strrchr(buf, ')');
+        unsigned long utime, stime;
+        if (x && sscanf(x, ") %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2) {
+            total += (uint64_t)(utime + stime) * (1000000000ULL / tck);
+        }
+    }
+    return total;
+}
+
+/** 10us buckets up to 10ms, then 1ms buckets up to ~1s. */
+static size_t rtt_bucket(uint64_t us) {
+    size_t b = us < 10000 ? us / 10 : 1000 + (us - 10000) / 1000;
+    return b < RTT_BUCKETS ? b : RTT_BUCKETS - 1;
+}
+
+static double rtt_quantile(const uint64_t *h, uint64_t n, double q) {
+    uint64_t c = 0, t = (uint64_t)(n * q);
+    for (size_t i = 0; i < RTT_BUCKETS; i++) {
+        if ((c += h[i]) > t) {
+            return i < 1000 ? (i + 1) * 10 : 10000 + (i - 1000 + 1) * 1000.0;
+        }
+    }
+    return 0;
+}
+
+struct stats {
+    uint64_t sent, recv, cpu, t;
+    uint64_t rtt_n;
+    uint64_t rtt[RTT_BUCKETS];
+};
+
+static void report(const char *label, const struct stats *a, const struct stats *b, const char *pids) {
+    double sec = (b->t - a->t) / 1e9;
+    uint64_t sent = b->sent - a->sent, recv = b->recv - a->recv, cpu = b->cpu - a->cpu;
+    printf("%s: sent %.0f/s, replies %.0f/s, lost %.2f%%, rtt p50 %.0fus p99 %.0fus",
+        label, sent / sec, recv / sec, sent ? 100.0 * (sent > recv ? sent - recv : 0) / sent : 0,
+        rtt_quantile(b->rtt, b->rtt_n, 0.50), rtt_quantile(b->rtt, b->rtt_n, 0.99));
+    if (pids) {
+        printf(", cpu %.1f%% (%.2fus/reply)", 100.0 * cpu / 1e9 / sec, recv ? cpu / 1e3 / recv : 0);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    const char *addr = "127.0.0.1", *pids = NULL;
+    int port = 37099, pps = 10000, size = 200, dur = 30;
+    for (int c; (c = getopt(argc, argv, "a:p:r:s:d:c:")) != -1;) {
+        switch (c) {
+        case 'a': addr = optarg; break;
+        case 'p': port = atoi(optarg); break;
+        case 'r': pps = atoi(optarg); break;
+        case 's': size = atoi(optarg); break;
+        case 'd': dur = atoi(optarg); break;
+        case 'c': pids = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-a addr] [-p port] [-r pps] [-s size] [-d sec] [-c pid,...]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (size < 16 || size > 1400 || pps <= 0) {
+        fprintf(stderr, "error: size must be 16-1400 and pps must be positive\n");
+        return 2;
+    }
+
+    int s = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (s == -1) {
+        perror("error: socket");
+        return 1;
+    }
+    int buf = 4 * 1024 * 1024;
+    setsockopt(s, SOL_SOCKET, SO_RCVBUF, &buf, sizeof(buf));
+    setsockopt(s, SOL_SOCKET, SO_SNDBUF, &buf, sizeof(buf));
+
+    struct sockaddr_in dst = {
+        .sin_family = AF_INET,
+        .sin_port = htons(port),
+    };
+    if (inet_pton(AF_INET, addr, &dst.sin_addr) != 1) {
+        fprintf(stderr, "error: invalid address %s\n", addr);
+        return 2;
+    }
+    if (connect(s, (struct sockaddr *)&dst, sizeof(dst))) {
+        perror("error: connect");
+        return 1;
+    }
+
+    static char sbuf[BATCH][1400], rbuf[BATCH][2048];
+    struct iovec siov[BATCH], riov[BATCH];
+    struct mmsghdr smsg[BATCH], rmsg[BATCH];
+    for (int i = 0; i < BATCH; i++) {
+        siov[i] = (struct iovec){ .iov_base = sbuf[i], .iov_len = size };
+        riov[i] = (struct iovec){ .iov_base = rbuf[i], .iov_len = sizeof(rbuf[i]) };
+        smsg[i] = (struct mmsghdr){ .msg_hdr = { .msg_iov = &siov[i], .msg_iovlen = 1 } };
+        rmsg[i] = (struct mmsghdr){ .msg_hdr = { .msg_iov = &riov[i], .msg_iovlen = 1 } };
+    }
+
+    static struct stats cur, start, last, all;
+    cur.t = start.t = last.t = now_ns();
+    cur.cpu = start.cpu = last.cpu = pids ? cpu_ns(pids) : 0;
+
+    uint64_t seq = 0, end = cur.t + dur * 1000000000ULL;
+    printf("sending %d-byte datagrams to %s:%d at %d/s for %ds\n", size, addr, port, pps, dur);
+    for (;;) {
+        uint64_t t = now_ns();
+        if (t >= end) {
+            break;
+        }
+
+        // send however many packets we're behind by, in batches
+        uint64_t due = (t - start.t) * pps / 1000000000ULL;
+        while (cur.sent < due) {
+            int n = due - cur.sent < BATCH ? due - cur.sent : BATCH;
+            for (int i = 0; i < n; i++) {
+                uint64_t hdr[2] = { seq++, t };
+                memcpy(sbuf[i], hdr, sizeof(hdr));
+            }
+            int r = sendmmsg(s, smsg, n, 0);
+            if (r <= 0) {
+                if (r == -1 && errno != EAGAIN && errno != ECONNREFUSED) {
+                    perror("error: sendmmsg");
+                    return 1;
+                }
+                cur.sent += n; // count them as lost
+                break;
+            }
+            cur.sent += r;
+        }
+
+        // drain replies
+        for (;;) {
+            int r = recvmmsg(s, rmsg, BATCH, MSG_DONTWAIT, NULL);
+            if (r <= 0) {
+                break;
+            }
+            uint64_t rt = now_ns();
+            for (int i = 0; i < r; i++) {
+                uint64_t hdr[2];
+                if (rmsg[i].msg_len < sizeof(hdr)) {
+                    continue;
+                }
+                memcpy(hdr, rbuf[i], sizeof(hdr));
+                size_t b = rtt_bucket((rt - hdr[1]) / 1000);
+                cur.rtt[b]++;
+                cur.rtt_n++;
+                all.rtt[b]++;
+                all.rtt_n++;
+                cur.recv++;
+            }
+        }
+
+        if (t - last.t >= 1000000000ULL) {
+            cur.t = t;
+            cur.cpu = pids ? cpu_ns(pids) : 0;
+            report("interval", &last, &cur, pids);
+            last = cur;
+            memset(cur.rtt, 0, sizeof(cur.rtt)); // per-interval latency
+            cur.rtt_n = 0;
+        }
+        nanosleep(&(struct timespec){ .tv_nsec = 100000 }, NULL);
+    }
+
+    // wait a bit for the remaining replies
+    for (uint64_t t = now_ns(); now_ns() - t < 200000000ULL;) {
+        int r = recvmmsg(s, rmsg, BATCH, MSG_DONTWAIT, NULL);
+        if (r > 0) {
+            cur.recv += r;
+        } else {
+            nanosleep(&(struct timespec){ .tv_nsec = 1000000 }, NULL);
+        }
+    }
+    all.sent = cur.sent;
+    all.recv = cur.recv;
+    all.t = now_ns();
+    all.cpu = pids ? cpu_ns(pids) : 0;
+    report("total", &start, &all, pids);
+    return 0;
+}
@@ -0,0 +1,86 @@
+#!/bin/bash
+set -euo pipefail
+
+# Records which Wine modules are actually used, and turns that into configure
+# flags for a trimmed Wine build (see the notes in src/wine/APKBUILD).
+#
+# trace: Creates a fresh wineprefix and boots the server in the image with the
+#        Wine loader trace (WINEDEBUG=+loaddll) enabled, then prints the PE
+#        modules loaded during each (libs_wineprefix, libs_nsdedi) and the unix
+#        libraries mapped by the running server (libs_unix).
+#
+# flags: Prints the --disable flags for every dll and program in the Wine
+#        source tree which isn't in the trace output or in the short list of
+#        modules we always keep (e.g., for debugging and scripting).
+
+usage() {
+    echo "usage: $0 trace image_name titanfall_dir [seconds] [docker_run_args...] > modules.txt"
+    echo "       $0 flags wine_source_dir modules.txt"
+    exit 2
+}
+
+trace() {
+    [[ $# -ge 2 ]] || usage
+    local img="$1"; shift
+    local tf="$(realpath "$1")"; shift
+    local sec="${1:-120}"; shift || true
+    local name="nsbench-trace-$$"
+
+    # only count modules loaded more than once while creating the prefix (the rest are just being registered)
+    echo -n "libs_wineprefix="
+    docker run --rm --entrypoint /bin/sh --env WINEDEBUG=-all,+loaddll "$img" -c 'rm -rf "$WINEPREFIX" && nswrap-wineprefix' 2>&1 |
+        grep -F ":loaddll:" | grep -F ": builtin" | grep -o 'L"[^"]*"' | sed 's/.*\\//; s/\..*//' | tr A-Z a-z |
+        sort | uniq -c | awk '$1 > 1 { print $2 }' | xargs echo
+
+    docker run --detach --name "$name" \
+        --mount "type=bind,source=$tf,target=/mnt/titanfall,readonly" \
+        --env NS_SERVER_NAME="module trace" \
+        --env NS_MASTERSERVER_REGISTER=0 \
+        --env NS_INSECURE=1 \
+        --env WINEDEBUG=fixme-all,err-wldap32,+loaddll \
+        "$@" "$img" > /dev/null
+    sleep "$sec"
+
+    echo -n "libs_unix="
+    docker exec "$name" sh -c 'cat /proc/[0-9]*/maps 2>/dev/null' |
+        grep -o '/usr/lib/wine/x86_64-unix/[^ ]*\.so' | sed 's|.*/||; s/\.so$//' | sort -u | xargs echo
+
+    docker stop --time 10 "$name" > /dev/null
+    echo -n "libs_nsdedi="
+    docker logs "$name" 2>&1 |
+        grep -F ":loaddll:" | grep -F ": builtin" | grep -o 'L"[^"]*"' | sed 's/.*\\//; s/\..*//' | tr A-Z a-z |
+        sort -u | xargs echo
+    docker rm "$name" > /dev/null
+}
+
+flags() {
+    [[ $# -eq 2 ]] || usage
+    local src="$1" libs
+    libs="$(sed -n 's/^libs_[a-z]*=//p' "$2" | xargs echo)"
+    for x in libs_wineprefix libs_unix libs_nsdedi; do
+        # an empty list (e.g., if the server didn't start) would disable modules it needs
+        grep -q "^$x=." "$2" || { echo "error: no modules for $x in $2" >&2; exit 1; }
+    done
+
+    pushd "$src" > /dev/null
+    for x in programs/* dlls/*; do
+        needed=no
+        for lib in winecrt0 $libs winedbg cmd winecfg winepath taskkill tasklist api-ms-win-core-; do
+            if [[ $x == *"/$lib"* ]]; then
+                needed=yes
+            fi
+        done
+        if [[ $needed == "no" ]]; then
+            echo $x
+        fi
+    done |
+    xargs -i@ grep -F "wine_fn_config_makefile @ enable_" configure | grep -Fv enable_win16 | sed 's/^.*enable_/--disable-/' |
+    xargs echo | fold -sw150 | sed 's/$/\\/g'
+    popd > /dev/null
+}
+
+case "${1:-}" in
+    trace) shift; trace "$@" ;;
+    flags) shift; flags "$@" ;;
+    *) usage ;;
+esac
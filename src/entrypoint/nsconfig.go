@@ -4,7 +4,6 @@ import (
 	"fmt"
 	"io"
 	"net/url"
-	"os"
 	"sort"
 	"strconv"
 	"strings"
@@ -17,10 +16,10 @@ type NSConfig struct {
 	ax []string
 }
 
-func MergeConfig(defaults, env map[string]string, args ...string) *NSConfig {
+func MergeConfig(defaults, env map[string]string, getenv func(string) (string, bool), args ...string) *NSConfig {
 	var n NSConfig
 	n.ApplyValues(defaults)
-	n.ApplyEnv(env, os.LookupEnv)
+	n.ApplyEnv(env, getenv)
 	n.ApplyArgs(args...)
 	return &n
 }
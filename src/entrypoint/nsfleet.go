@@ -0,0 +1,681 @@
+package main
+
+import (
+	"bufio"
+	"bytes"
+	"errors"
+	"fmt"
+	"io"
+	"io/fs"
+	"os"
+	"os/exec"
+	"os/signal"
+	"path/filepath"
+	"regexp"
+	"strconv"
+	"strings"
+	"sync"
+	"syscall"
+	"time"
+
+	"github.com/kballard/go-shellquote"
+)
+
+// fleetStatusRe matches the status nswrap appends to its process title once the
+// server loop is running (see ns_status_str).
+var fleetStatusRe = regexp.MustCompile(`\[[0-9?]+/[0-9?]+ \S+ \S+\]$`)
+
+// ReadFleetFile reads a fleet file, which has one instance per line, each being
+// a list of shell-quoted KEY=VALUE environment variables (e.g., NS_PORT=37016
+// NS_SERVER_NAME="Server 2"), with blank lines and lines starting with #
+// ignored.
+func ReadFleetFile(name string) ([]map[string]string, error) {
+	buf, err := os.ReadFile(name)
+	if err != nil {
+		return nil, err
+	}
+	var r []map[string]string
+	s := bufio.NewScanner(bytes.NewReader(buf))
+	for i := 1; s.Scan(); i++ {
+		l := strings.TrimSpace(s.Text())
+		if l == "" || l[0] == '#' {
+			continue
+		}
+		ws, err := shellquote.Split(l)
+		if err != nil {
+			return nil, fmt.Errorf("line %d: %w", i, err)
+		}
+		m := map[string]string{}
+		for _, w := range ws {
+			spl := strings.SplitN(w, "=", 2)
+			if len(spl) != 2 || spl[0] == "" {
+				return nil, fmt.Errorf("line %d: expected KEY=VALUE, got %q", i, w)
+			}
+			m[spl[0]] = spl[1]
+		}
+		r = append(r, m)
+	}
+	return r, s.Err()
+}
+
+// HostPressure is a snapshot of the memory and I/O pressure on the host.
+type HostPressure struct {
+	MemAvailable uint64  // bytes, limited by the cgroup memory limit if any
+	PSIMemory    float64 // /proc/pressure/memory some avg10, or -1
+	PSIIO        float64 // /proc/pressure/io some avg10, or -1
+}
+
+// ReadHostPressure reads the current HostPressure. PSI requires Linux 4.20+
+// built with CONFIG_PSI.
+func ReadHostPressure() (HostPressure, error) {
+	var p HostPressure
+	buf, err := os.ReadFile("/proc/meminfo")
+	if err != nil {
+		return p, err
+	}
+	for _, l := range strings.Split(string(buf), "\n") {
+		if f := strings.Fields(l); len(f) >= 2 && f[0] == "MemAvailable:" {
+			if v, err := strconv.ParseUint(f[1], 10, 64); err == nil {
+				p.MemAvailable = v * 1024
+			}
+		}
+	}
+	if mx, err := os.ReadFile("/sys/fs/cgroup/memory.max"); err == nil {
+		if cu, err := os.ReadFile("/sys/fs/cgroup/memory.current"); err == nil {
+			m, err1 := strconv.ParseUint(strings.TrimSpace(string(mx)), 10, 64)
+			c, err2 := strconv.ParseUint(strings.TrimSpace(string(cu)), 10, 64)
+			if err1 == nil && err2 == nil {
+				if c > m {
+					c = m
+				}
+				if m-c < p.MemAvailable {
+					p.MemAvailable = m - c
+				}
+			}
+		}
+	}
+	p.PSIMemory = readPSI("/proc/pressure/memory")
+	p.PSIIO = readPSI("/proc/pressure/io")
+	return p, nil
+}
+
+// readPSI reads the some avg10 value from a PSI file, returning -1 if it isn't
+// available.
+func readPSI(name string) float64 {
+	buf, err := os.ReadFile(name)
+	if err != nil {
+		return -1
+	}
+	for _, l := range strings.Split(string(buf), "\n") {
+		if f := strings.Fields(l); len(f) >= 2 && f[0] == "some" && strings.HasPrefix(f[1], "avg10=") {
+			if v, err := strconv.ParseFloat(strings.TrimPrefix(f[1], "avg10="), 64); err == nil {
+				return v
+			}
+		}
+	}
+	return -1
+}
+
+type fleetInstance struct {
+	ID     string
+	Port   string
+	Lookup func(string) (string, bool)
+	Env    map[string]string
+	NSO    *NSOverlay
+	Prefix string
+	Config *NSConfig
+	Args   []string
+
+	startup *startupTimer
+
+	mu      sync.Mutex
+	proc    *os.Process
+	booting bool
+	code    int
+}
+
+type fleet struct {
+	inst     []*fleetInstance
+	out      sync.Mutex
+	stop     chan struct{}
+	stopOnce sync.Once
+
+	memory  uint64
+	psiMem  float64
+	psiIO   float64
+	maxWait time.Duration
+
+	admit     sync.Mutex
+	lastStart time.Time
+}
+
+// runFleet runs the instances in the fleet file, returning the exit code.
+func runFleet(name, hostname string) int {
+	lookup, _, err := configLookup(hostname)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "Error: %v.\n", err)
+		return 1
+	}
+	if os.Getenv("NS_CONFIG_FILE") != "" {
+		fmt.Fprintf(os.Stderr, "Warning: NS_CONFIG_FILE will not be reloaded in fleet mode.\n")
+	}
+	specs, err := ReadFleetFile(name)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "Error: Failed to read fleet file %q: %v.\n", name, err)
+		return 1
+	}
+	if len(specs) == 0 {
+		fmt.Fprintf(os.Stderr, "Error: Fleet file %q has no instances.\n", name)
+		return 1
+	}
+	wineprefix := os.Getenv("WINEPREFIX")
+	if wineprefix == "" {
+		fmt.Fprintf(os.Stderr, "Error: WINEPREFIX not set.\n")
+		return 1
+	}
+
+	f := &fleet{
+		stop:    make(chan struct{}),
+		memory:  2048,
+		psiMem:  10,
+		psiIO:   40,
+		maxWait: 120,
+	}
+	for _, x := range []struct {
+		env string
+		out interface{}
+	}{
+		{"NS_FLEET_MEMORY", &f.memory},
+		{"NS_FLEET_PSI_MEMORY", &f.psiMem},
+		{"NS_FLEET_PSI_IO", &f.psiIO},
+		{"NS_FLEET_MAX_WAIT", &f.maxWait},
+	} {
+		v, ok := lookup(x.env)
+		if !ok {
+			continue
+		}
+		switch o := x.out.(type) {
+		case *uint64:
+			*o, err = strconv.ParseUint(v, 10, 64)
+		case *float64:
+			*o, err = strconv.ParseFloat(v, 64)
+		case *time.Duration:
+			var n uint64
+			n, err = strconv.ParseUint(v, 10, 64)
+			*o = time.Duration(n)
+		}
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "Error: Invalid %s %q.\n", x.env, v)
+			return 1
+		}
+	}
+	f.memory *= 1024 * 1024
+	f.maxWait *= time.Second
+
+	// assign ports first since ranges need to exclude the ones already chosen
+	used := map[int]bool{}
+	for i, spec := range specs {
+		id := strconv.Itoa(i + 1)
+		il := fleetLookup(spec, lookup, id)
+		port := 37015 + i
+		if v, ok := il("NS_PORT"); ok {
+			if port, err = parsePort(v, used); err != nil {
+				fmt.Fprintf(os.Stderr, "Error: Instance %s: %v.\n", id, err)
+				return 1
+			}
+		}
+		if used[port] {
+			fmt.Fprintf(os.Stderr, "Error: Instance %s: port %d is already used by another instance.\n", id, port)
+			return 1
+		}
+		used[port] = true
+		f.inst = append(f.inst, &fleetInstance{
+			ID:     id,
+			Port:   strconv.Itoa(port),
+			Lookup: il,
+			Env:    spec,
+		})
+	}
+
+	fmt.Printf("Preparing %d instances...\n", len(f.inst))
+	var wg sync.WaitGroup
+	errs := make([]error, len(f.inst))
+	for i, inst := range f.inst {
+		wg.Add(1)
+		go func(i int, inst *fleetInstance) {
+			defer wg.Done()
+			errs[i] = inst.prepare(wineprefix)
+		}(i, inst)
+	}
+	wg.Wait()
+	defer func() {
+		for _, inst := range f.inst {
+			if inst.NSO != nil {
+				inst.NSO.Delete()
+			}
+			if inst.Prefix != "" {
+				os.RemoveAll(inst.Prefix)
+			}
+		}
+	}()
+	var failed bool
+	for i, inst := range f.inst {
+		fmt.Println()
+		fmt.Printf("    Instance %s (port %s):\n", inst.ID, inst.Port)
+		if errs[i] != nil {
+			fmt.Fprintf(os.Stderr, "        Error: %v\n", errs[i])
+			failed = true
+			continue
+		}
+		if i == 0 || f.inst[0].Config == nil {
+			inst.Config.Display(os.Stdout, "        ")
+			continue
+		}
+		// only show the differences from the first one
+		live, restart := f.inst[0].Config.Diff(inst.Config)
+		for _, c := range append(live, restart...) {
+			if v, ok := inst.Config.Get(c); ok {
+				fmt.Printf("        +%s %q\n", c, v)
+			} else if c == "(extra arguments)" {
+				fmt.Printf("        Extra arguments: %s\n", strings.Join(inst.Args, " "))
+			}
+		}
+	}
+	fmt.Println()
+	if failed {
+		return 2
+	}
+
+	fmt.Println("Starting Northstar...")
+
+	ch := make(chan os.Signal, 1)
+	signal.Notify(ch, syscall.SIGINT, syscall.SIGTERM, syscall.SIGUSR1)
+	go func() {
+		for sig := range ch {
+			if sig != syscall.SIGUSR1 {
+				f.stopOnce.Do(func() { close(f.stop) })
+			}
+			for _, inst := range f.inst {
+				inst.mu.Lock()
+				if inst.proc != nil {
+					inst.proc.Signal(sig)
+				}
+				inst.mu.Unlock()
+			}
+		}
+	}()
+
+	// start them in order
+	for _, inst := range f.inst {
+		if !f.wait(inst) {
+			break
+		}
+		wg.Add(1)
+		go func(inst *fleetInstance) {
+			defer wg.Done()
+			f.supervise(inst)
+		}(inst)
+	}
+	wg.Wait()
+
+	for _, inst := range f.inst {
+		if inst.code != 0 {
+			return inst.code
+		}
+	}
+	return 0
+}
+
+// fleetLookup returns a lookup function for an instance, which looks up
+// variables in the instance spec first. In NS_SERVER_NAME and NS_SERVER_DESC,
+// {{instance}} is replaced with the instance number.
+func fleetLookup(spec map[string]string, lookup func(string) (string, bool), id string) func(string) (string, bool) {
+	return func(k string) (string, bool) {
+		v, ok := spec[k]
+		if !ok {
+			v, ok = lookup(k)
+		}
+		if ok && (k == "NS_SERVER_NAME" || k == "NS_SERVER_DESC") {
+			v = strings.ReplaceAll(v, "{{instance}}", id)
+		}
+		return v, ok
+	}
+}
+
+// prepare merges the game files, copies the wineprefix, and writes the config
+// for the instance.
+func (inst *fleetInstance) prepare(wineprefix string) error {
+	inst.startup = newStartupTimer()
+
+	nso, err := mergeOverlay()
+	if err != nil {
+		return fmt.Errorf("failed to merge game files: %w", err)
+	}
+	inst.NSO = nso
+	inst.startup.Mark("overlay")
+
+	// wine processes sharing a prefix share a wineserver, which would be a
+	// bottleneck (and would outlive the nswrap which started it)
+	if p, err := os.MkdirTemp("/tmp", "nsprefix*"); err != nil {
+		return fmt.Errorf("failed to create wineprefix: %w", err)
+	} else {
+		inst.Prefix = p
+	}
+	if err := copyTree(wineprefix, inst.Prefix); err != nil {
+		return fmt.Errorf("failed to copy wineprefix: %w", err)
+	}
+	inst.startup.Mark("prefix")
+
+	nsc, err := mergeConfig(inst.Lookup, inst.Port)
+	if err != nil {
+		return err
+	}
+	if cerrs := nsc.Validate(); cerrs != nil {
+		var b strings.Builder
+		b.WriteString("failed to merge config:")
+		for c, errs := range cerrs {
+			v, _ := nsc.Get(c)
+			for _, err := range errs {
+				fmt.Fprintf(&b, "\n           %s (%q) - %v", c, v, err)
+			}
+		}
+		return errors.New(b.String())
+	}
+	inst.Config = nsc
+
+	var buf bytes.Buffer
+	if inst.Args, err = nsc.Autoexec(&buf); err != nil {
+		return fmt.Errorf("generate autoexec: %w", err)
+	}
+	if err := os.WriteFile(nso.Autoexec(), buf.Bytes(), 0644); err != nil {
+		return fmt.Errorf("write autoexec: %w", err)
+	}
+	inst.startup.Mark("config")
+	return nil
+}
+
+// fleetInstanceEnv contains the nswrap options which must be different for
+// each instance, and what to append to them if they're set for all instances
+// without {{instance}}.
+var fleetInstanceEnv = map[string]string{
+	"NSWRAP_STATUS_FILE":     ".{{instance}}",
+	"NSWRAP_STDOUT_SPILL":    ".{{instance}}",
+	"NSWRAP_CONSOLE_LOG_DIR": "/{{instance}}",
+	"NSWRAP_PROF_DIR":        "/{{instance}}",
+	"NSWRAP_TELEMETRY_ID":    "/{{instance}}", // defaults to the hostname
+}
+
+// supervise starts the already-admitted instance, and restarts it with a
+// backoff (after being admitted again) if it exits before the fleet is stopped.
+func (f *fleet) supervise(inst *fleetInstance) {
+	backoff := time.Second
+	for restarts := 0; ; restarts++ {
+		if restarts != 0 {
+			inst.startup = newStartupTimer()
+			if !f.wait(inst) {
+				return
+			}
+		}
+
+		sn, _ := inst.Config.Get("ns_server_name")
+		override := []string{
+			"NSWRAP_TITLE", sn,
+			"DISPLAY", "xvfb",
+			"WINEPREFIX", inst.Prefix,
+			"NSWRAP_STARTUP", inst.startup.String(),
+			"NSWRAP_RESTARTS", strconv.Itoa(restarts),
+		}
+		for k, v := range inst.Env {
+			if strings.HasPrefix(k, "NSWRAP_") && fleetInstanceEnv[k] == "" {
+				override = append(override, k, v)
+			}
+		}
+		for k, suffix := range fleetInstanceEnv {
+			v, ok := inst.Env[k]
+			if !ok {
+				// every instance needs its own
+				if v = os.Getenv(k); v == "" && k == "NSWRAP_TELEMETRY_ID" {
+					v, _ = os.Hostname()
+				}
+				if v == "" {
+					continue
+				}
+				if !strings.Contains(v, "{{instance}}") {
+					v += suffix
+				}
+			}
+			v = strings.ReplaceAll(v, "{{instance}}", inst.ID)
+			if strings.HasPrefix(suffix, "/") && k != "NSWRAP_TELEMETRY_ID" {
+				os.MkdirAll(filepath.Dir(v), 0755) // nswrap only creates the last one
+			}
+			override = append(override, k, v)
+		}
+		w := &prefixWriter{mu: &f.out, prefix: "[" + inst.ID + "] ", w: os.Stdout}
+		cmd := &exec.Cmd{
+			Path:   "/usr/bin/nswrap",
+			Args:   append([]string{"nswrap", inst.NSO.Path}, inst.Args...),
+			Env:    env([]string{"PATH", "HOSTNAME", "HOME", "USER", "WINESERVER", "WINEDEBUG", "NSWRAP_*"}, override...),
+			Stdout: w,
+			Stderr: w,
+		}
+
+		start := time.Now()
+		inst.mu.Lock()
+		err := cmd.Start()
+		if err == nil {
+			inst.proc = cmd.Process
+		} else {
+			inst.booting = false
+		}
+		inst.mu.Unlock()
+		if err == nil {
+			go f.watchBoot(inst, cmd.Process.Pid, start)
+			err = cmd.Wait()
+			inst.mu.Lock()
+			inst.proc = nil
+			inst.booting = false
+			inst.mu.Unlock()
+		}
+		w.Flush()
+
+		var ex *exec.ExitError
+		inst.code = 0
+		if errors.As(err, &ex) {
+			inst.code = ex.ExitCode()
+		} else if err != nil {
+			inst.code = 1
+		}
+
+		select {
+		case <-f.stop:
+			return
+		default:
+		}
+
+		if time.Since(start) > time.Minute*5 {
+			backoff = time.Second
+		}
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "Instance %s exited (%v); restarting in %v.\n", inst.ID, err, backoff)
+		} else {
+			fmt.Fprintf(os.Stderr, "Instance %s exited; restarting in %v.\n", inst.ID, backoff)
+		}
+		select {
+		case <-f.stop:
+			return
+		case <-time.After(backoff):
+		}
+		if backoff *= 2; backoff > time.Minute {
+			backoff = time.Minute
+		}
+	}
+}
+
+// wait blocks until the instance can be started without pushing the host into
+// swap or I/O contention, i.e., when there is enough available memory for it
+// and the other instances still booting, and the memory and I/O pressure are
+// below the thresholds. If that doesn't happen within the maximum wait, it's
+// started anyway. The instance is marked as booting, and false is returned if
+// the fleet is stopped first.
+func (f *fleet) wait(inst *fleetInstance) bool {
+	f.admit.Lock()
+	defer f.admit.Unlock()
+
+	var last string
+	start := time.Now()
+	for {
+		select {
+		case <-f.stop:
+			return false
+		default:
+		}
+		// give the last instance a moment to show up in the pressure
+		if time.Since(f.lastStart) >= time.Second {
+			var booting int
+			for _, x := range f.inst {
+				x.mu.Lock()
+				if x.booting {
+					booting++
+				}
+				x.mu.Unlock()
+			}
+			var reason string
+			if p, err := ReadHostPressure(); err != nil {
+				reason = fmt.Sprintf("failed to read memory info: %v", err)
+			} else if need := f.memory * uint64(booting+1); p.MemAvailable < need {
+				reason = fmt.Sprintf("%d booting, %d MiB available, %d MiB needed", booting, p.MemAvailable/1024/1024, need/1024/1024)
+			} else if p.PSIMemory > f.psiMem {
+				reason = fmt.Sprintf("%d booting, memory pressure %.1f%% > %.1f%%", booting, p.PSIMemory, f.psiMem)
+			} else if p.PSIIO > f.psiIO {
+				reason = fmt.Sprintf("%d booting, I/O pressure %.1f%% > %.1f%%", booting, p.PSIIO, f.psiIO)
+			}
+			if reason == "" {
+				break
+			}
+			if time.Since(start) >= f.maxWait {
+				fmt.Fprintf(os.Stderr, "Warning: Starting instance %s anyway after waiting %v (%s).\n", inst.ID, f.maxWait, reason)
+				break
+			}
+			if reason != last {
+				fmt.Printf("Waiting to start instance %s (%s).\n", inst.ID, reason)
+				last = reason
+			}
+		}
+		select {
+		case <-f.stop:
+			return false
+		case <-time.After(time.Millisecond * 500):
+		}
+	}
+	f.lastStart = time.Now()
+	inst.startup.Mark("admit")
+
+	inst.mu.Lock()
+	inst.booting = true
+	inst.mu.Unlock()
+	return true
+}
+
+// watchBoot marks the instance as booted when nswrap shows the server status in
+// its process title, i.e., the server loop is running. If it doesn't within the
+// maximum wait, it's assumed to be booted (or hung, in which case the nswrap
+// watchdog will kill it) so it doesn't block the other instances.
+func (f *fleet) watchBoot(inst *fleetInstance, pid int, start time.Time) {
+	for {
+		inst.mu.Lock()
+		done := inst.proc == nil || inst.proc.Pid != pid || !inst.booting
+		inst.mu.Unlock()
+		if done {
+			return
+		}
+		if buf, err := os.ReadFile("/proc/" + strconv.Itoa(pid) + "/cmdline"); err == nil {
+			if fleetStatusRe.Match(bytes.TrimRight(buf, "\x00")) {
+				fmt.Printf("Instance %s booted in %v.\n", inst.ID, time.Since(start).Truncate(time.Millisecond*100))
+				break
+			}
+		}
+		if time.Since(start) >= f.maxWait {
+			fmt.Fprintf(os.Stderr, "Warning: Instance %s did not boot within %v.\n", inst.ID, f.maxWait)
+			break
+		}
+		time.Sleep(time.Millisecond * 500)
+	}
+	inst.mu.Lock()
+	inst.booting = false
+	inst.mu.Unlock()
+}
+
+// prefixWriter writes complete lines to w with a prefix, so the output of
+// multiple instances isn't interleaved mid-line.
+type prefixWriter struct {
+	mu     *sync.Mutex
+	prefix string
+	w      io.Writer
+	buf    []byte
+}
+
+func (p *prefixWriter) Write(b []byte) (int, error) {
+	p.buf = append(p.buf, b...)
+	if i := bytes.LastIndexByte(p.buf, '\n'); i != -1 {
+		p.write(p.buf[:i+1])
+		p.buf = append(p.buf[:0], p.buf[i+1:]...)
+	}
+	return len(b), nil
+}
+
+// Flush writes the remaining partial line, if any.
+func (p *prefixWriter) Flush() {
+	if len(p.buf) != 0 {
+		p.write(append(p.buf, '\n'))
+		p.buf = p.buf[:0]
+	}
+}
+
+func (p *prefixWriter) write(b []byte) {
+	var o bytes.Buffer
+	for len(b) != 0 {
+		i := bytes.IndexByte(b, '\n')
+		o.WriteString(p.prefix)
+		o.Write(b[:i+1])
+		b = b[i+1:]
+	}
+	p.mu.Lock()
+	p.w.Write(o.Bytes())
+	p.mu.Unlock()
+}
+
+// copyTree copies the contents of src into the existing dir dst, preserving
+// symlinks and permissions.
+func copyTree(src, dst string) error {
+	return filepath.WalkDir(src, func(p string, d fs.DirEntry, err error) error {
+		if err != nil {
+			return err
+		}
+		rel, err := filepath.Rel(src, p)
+		if err != nil {
+			return err
+		}
+		if rel == "." {
+			return nil
+		}
+		t := filepath.Join(dst, rel)
+		fi, err := d.Info()
+		if err != nil {
+			return err
+		}
+		switch {
+		case fi.Mode()&fs.ModeSymlink != 0:
+			l, err := os.Readlink(p)
+			if err != nil {
+				return err
+			}
+			return os.Symlink(l, t)
+		case fi.IsDir():
+			return os.Mkdir(t, fi.Mode().Perm())
+		case fi.Mode().IsRegular():
+			return copyFile(p, t)
+		default:
+			return nil // skip sockets and such
+		}
+	})
+}
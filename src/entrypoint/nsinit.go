@@ -5,6 +5,8 @@ import (
 	"bytes"
 	"errors"
 	"fmt"
+	"io"
+	"net"
 	"os"
 	"os/exec"
 	"os/signal"
@@ -12,11 +14,14 @@ import (
 	"strconv"
 	"strings"
 	"syscall"
+	"time"
 
 	"github.com/kballard/go-shellquote"
 )
 
 func main() {
+	startup := newStartupTimer()
+
 	if runtime.GOOS != "linux" || runtime.GOARCH != "amd64" {
 		fmt.Fprintf(os.Stderr, "Unsupported platform %s/%s.\n", runtime.GOOS, runtime.GOARCH)
 		os.Exit(1)
@@ -62,81 +67,47 @@ func main() {
 			fmt.Println("    Warning: You have overridden internal files. This may break without warning in future versions.")
 		}
 	}
-	nso, err := MergeOverlay(
-		"/tmp",
-		"/mnt/titanfall",
-		"/usr/lib/northstar",
-		"/mnt/mods",
-		"/mnt/navs",
-		"/mnt/plugins",
-		"/mnt/save_data",
-	)
+	if fleetFile := os.Getenv("NS_FLEET_FILE"); fleetFile != "" {
+		os.Exit(runFleet(fleetFile, hostname))
+		return
+	}
+	nso, err := mergeOverlay()
 	if err != nil {
 		fmt.Fprintf(os.Stderr, "Error: Failed to merge game files: %v.\n", err)
 		os.Exit(1)
 		return
 	}
 	defer nso.Delete()
+	startup.Mark("overlay")
 	fmt.Println()
 
 	fmt.Println("Merging configuration...")
+	lookup, cfgFile, err := configLookup(hostname)
+	if err != nil {
+		fmt.Fprintf(os.Stderr, "Error: %v.\n", err)
+		os.Exit(1)
+		return
+	}
 	port := "37015"
-	if v, ok := os.LookupEnv("NS_PORT"); ok {
-		if n, err := strconv.ParseInt(v, 10, 64); err != nil {
-			fmt.Fprintf(os.Stderr, "Error: Invalid port %q.\n", v)
+	portSpec, ok := lookup("NS_PORT")
+	if ok {
+		n, err := parsePort(portSpec, nil)
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "Error: %v.\n", err)
 			os.Exit(1)
 			return
-		} else if n < 1 || n > 65535 {
-			fmt.Fprintf(os.Stderr, "Error: Invalid port %q: out of range.\n", v)
-			os.Exit(1)
-			return
-		} else {
-			port = v
+		}
+		port = strconv.Itoa(n)
+		if strings.IndexByte(portSpec, '-') != -1 {
+			fmt.Printf("Using UDP port %s.\n", port)
 		}
 	}
-	as, err := shellquote.Split(os.Getenv("NS_EXTRA_ARGUMENTS"))
+	nsc, err := mergeConfig(lookup, port)
 	if err != nil {
-		fmt.Fprintf(os.Stderr, "Error: Failed to split extra arguments %#q: %v.\n", os.Getenv("NS_EXTRA_ARGUMENTS"), err)
+		fmt.Fprintf(os.Stderr, "Error: %v.\n", err)
 		os.Exit(1)
 		return
 	}
-	nsc := MergeConfig(
-		map[string]string{
-			// from R2Northstar/mods/Northstar.CustomServers/mod/cfg/autoexec_ns_server.cfg @ v1.3.0
-			"ns_server_name":                      "",
-			"ns_server_desc":                      "",
-			"ns_server_password":                  "",
-			"ns_report_server_to_masterserver":    "1",
-			"ns_report_sp_server_to_masterserver": "0",
-			"ns_auth_allow_insecure":              "0",
-			"ns_erase_auth_info":                  "1",
-			"ns_masterserver_hostname":            "https://northstar.tf",
-			"everything_unlocked":                 "1",
-			"ns_should_return_to_lobby":           "1",
-			"net_chan_limit_mode":                 "2",
-			"net_chan_limit_msec_per_sec":         "100",
-			"sv_querylimit_per_sec":               "15",
-			"base_tickinterval_mp":                "0.016666667",
-			"sv_updaterate_mp":                    "20",
-			"sv_minupdaterate":                    "20",
-			"sv_max_snapshots_multiplayer":        "300",
-			"net_data_block_enabled":              "0",
-			"host_skip_client_dll_crc":            "1",
-		},
-		map[string]string{
-			// only include commonly-used ones here
-			"ns_server_name":                      "NS_SERVER_NAME",
-			"ns_server_desc":                      "NS_SERVER_DESC",
-			"ns_server_password":                  "NS_SERVER_PASSWORD",
-			"ns_masterserver_hostname":            "NS_MASTERSERVER_URL",
-			"ns_report_server_to_masterserver":    "NS_MASTERSERVER_REGISTER",
-			"ns_report_sp_server_to_masterserver": "NS_MASTERSERVER_REGISTER",
-			"ns_auth_allow_insecure":              "NS_INSECURE",
-		},
-		append([]string{
-			"-port", port,
-		}, as...)...,
-	)
 	if cerrs := nsc.Validate(); cerrs != nil {
 		fmt.Fprintf(os.Stderr, "Error: Failed to merge config:\n")
 		for c, errs := range cerrs {
@@ -167,25 +138,47 @@ func main() {
 		os.Exit(1)
 		return
 	}
+	startup.Mark("config")
 
 	fmt.Println("Starting Northstar...")
 
 	sn, _ := nsc.Get("ns_server_name")
 
+	override := []string{
+		"NSWRAP_TITLE", sn,
+		"DISPLAY", "xvfb",
+		"NSWRAP_STARTUP", startup.String(),
+	}
+	var console *os.File
+	if cfgFile != "" {
+		r, w, err := os.Pipe()
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "Error: Failed to create console pipe: %v.\n", err)
+			os.Exit(1)
+			return
+		}
+		defer r.Close()
+		console = r
+		override = append(override, "NSWRAP_CONSOLE_FD", "3")
+		go watchConfig(cfgFile, hostname, port, portSpec, nsc, nso.Autoexec(), w)
+	}
+
 	cmd := &exec.Cmd{
 		Path: "/usr/bin/nswrap",
 		Args: append([]string{"nswrap", nso.Path}, args...),
-		Env: env([]string{"PATH", "HOSTNAME", "HOME", "USER", "WINEPREFIX", "WINESERVER"},
-			"NSWRAP_TITLE", sn,
-			"DISPLAY", "xvfb",
+		Env: env([]string{"PATH", "HOSTNAME", "HOME", "USER", "WINEPREFIX", "WINESERVER", "WINEDEBUG", "NSWRAP_*"},
+			override...,
 		),
 		Stdin:  os.Stdin,
 		Stdout: os.Stdout,
 		Stderr: os.Stderr,
 	}
+	if console != nil {
+		cmd.ExtraFiles = []*os.File{console}
+	}
 
 	ch := make(chan os.Signal, 1)
-	signal.Notify(ch, syscall.SIGINT, syscall.SIGTERM)
+	signal.Notify(ch, syscall.SIGINT, syscall.SIGTERM, syscall.SIGUSR1)
 
 	go func() {
 		for sig := range ch {
@@ -208,20 +201,152 @@ func main() {
 	}
 }
 
+// watchConfig watches the config file for changes, writing console commands to
+// w for the convars which can be updated while the server is running. The
+// autoexec is also updated so it matches. The port is the one the server is
+// using, and portSpec is the NS_PORT it was chosen from (e.g., a range).
+func watchConfig(name, hostname, port, portSpec string, cur *NSConfig, autoexec string, w io.WriteCloser) {
+	defer w.Close()
+	err := WatchFile(name, time.Millisecond*250, func() {
+		m, err := ReadEnvFile(name)
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "Warning: Failed to reload config file %q: %v.\n", name, err)
+			return
+		}
+		lookup := EnvFileLookup(m, hostname)
+		nsc, err := mergeConfig(lookup, port)
+		if err != nil {
+			fmt.Fprintf(os.Stderr, "Warning: Failed to reload config file %q: %v.\n", name, err)
+			return
+		}
+		if cerrs := nsc.Validate(); cerrs != nil {
+			fmt.Fprintf(os.Stderr, "Warning: Failed to reload config file %q:\n", name)
+			for c, errs := range cerrs {
+				v, _ := nsc.Get(c)
+				for _, err := range errs {
+					fmt.Fprintf(os.Stderr, "           %s (%q) - %v\n", c, v, err)
+				}
+			}
+			return
+		}
+		if v, _ := lookup("NS_PORT"); v != portSpec {
+			fmt.Fprintf(os.Stderr, "Warning: Reloaded config file %q: NS_PORT can only be changed by restarting the server.\n", name)
+		}
+		live, restart := cur.Diff(nsc)
+		if len(live) == 0 && len(restart) == 0 {
+			return
+		}
+		if len(live) != 0 {
+			fmt.Fprintf(os.Stderr, "Reloaded config file %q: updating %s.\n", name, strings.Join(live, ", "))
+		}
+		if len(restart) != 0 {
+			fmt.Fprintf(os.Stderr, "Warning: Reloaded config file %q: %s can only be changed by restarting the server.\n", name, strings.Join(restart, ", "))
+		}
+		if err := nsc.Commands(w, live...); err != nil {
+			fmt.Fprintf(os.Stderr, "Warning: Failed to send convars to server: %v.\n", err)
+			return
+		}
+		var buf bytes.Buffer
+		if _, err := nsc.Autoexec(&buf); err != nil {
+			fmt.Fprintf(os.Stderr, "Warning: Failed to reload config file %q: generate autoexec: %v.\n", name, err)
+		} else if err := os.WriteFile(autoexec, buf.Bytes(), 0644); err != nil {
+			fmt.Fprintf(os.Stderr, "Warning: Failed to reload config file %q: write autoexec: %v (the old config will be used if the server restarts).\n", name, err)
+		}
+		cur = nsc
+	})
+	fmt.Fprintf(os.Stderr, "Warning: Config file %q will not be reloaded: %v.\n", name, err)
+}
+
+// mergeOverlay merges the game files into a new overlay in /tmp.
+func mergeOverlay() (*NSOverlay, error) {
+	return MergeOverlay(
+		"/tmp",
+		"/mnt/titanfall",
+		"/usr/lib/northstar",
+		"/mnt/mods",
+		"/mnt/navs",
+		"/mnt/plugins",
+		"/mnt/save_data",
+	)
+}
+
+// configLookup returns the function to look up config environment variables
+// with, which reads NS_CONFIG_FILE if it's set.
+func configLookup(hostname string) (func(string) (string, bool), string, error) {
+	cfgFile := os.Getenv("NS_CONFIG_FILE")
+	if cfgFile == "" {
+		return os.LookupEnv, "", nil
+	}
+	m, err := ReadEnvFile(cfgFile)
+	if err != nil {
+		return nil, "", fmt.Errorf("failed to read config file %q: %w", cfgFile, err)
+	}
+	return EnvFileLookup(m, hostname), cfgFile, nil
+}
+
+// mergeConfig merges the default config with the environment variables from
+// lookup and the provided port.
+func mergeConfig(lookup func(string) (string, bool), port string) (*NSConfig, error) {
+	ea, _ := lookup("NS_EXTRA_ARGUMENTS")
+	as, err := shellquote.Split(ea)
+	if err != nil {
+		return nil, fmt.Errorf("failed to split extra arguments %#q: %w", ea, err)
+	}
+	return MergeConfig(
+		map[string]string{
+			// from R2Northstar/mods/Northstar.CustomServers/mod/cfg/autoexec_ns_server.cfg @ v1.3.0
+			"ns_server_name":                      "",
+			"ns_server_desc":                      "",
+			"ns_server_password":                  "",
+			"ns_report_server_to_masterserver":    "1",
+			"ns_report_sp_server_to_masterserver": "0",
+			"ns_auth_allow_insecure":              "0",
+			"ns_erase_auth_info":                  "1",
+			"ns_masterserver_hostname":            "https://northstar.tf",
+			"everything_unlocked":                 "1",
+			"ns_should_return_to_lobby":           "1",
+			"net_chan_limit_mode":                 "2",
+			"net_chan_limit_msec_per_sec":         "100",
+			"sv_querylimit_per_sec":               "15",
+			"base_tickinterval_mp":                "0.016666667",
+			"sv_updaterate_mp":                    "20",
+			"sv_minupdaterate":                    "20",
+			"sv_max_snapshots_multiplayer":        "300",
+			"net_data_block_enabled":              "0",
+			"host_skip_client_dll_crc":            "1",
+		},
+		map[string]string{
+			// only include commonly-used ones here
+			"ns_server_name":                      "NS_SERVER_NAME",
+			"ns_server_desc":                      "NS_SERVER_DESC",
+			"ns_server_password":                  "NS_SERVER_PASSWORD",
+			"ns_masterserver_hostname":            "NS_MASTERSERVER_URL",
+			"ns_report_server_to_masterserver":    "NS_MASTERSERVER_REGISTER",
+			"ns_report_sp_server_to_masterserver": "NS_MASTERSERVER_REGISTER",
+			"ns_auth_allow_insecure":              "NS_INSECURE",
+		},
+		lookup,
+		append([]string{
+			"-port", port,
+		}, as...)...,
+	), nil
+}
+
 func env(preserve []string, override ...string) []string {
 	var r []string
 	if len(override)%2 != 0 {
 		panic("invalid env override")
 	}
+env:
 	for _, x := range os.Environ() {
 		spl := strings.SplitN(x, "=", 2)
 		for i := 0; i < len(override); i += 2 {
 			if override[i] == spl[0] {
-				continue
+				continue env
 			}
 		}
 		for _, p := range preserve {
-			if spl[0] == p {
+			if spl[0] == p || (strings.HasSuffix(p, "*") && strings.HasPrefix(spl[0], p[:len(p)-1])) {
 				r = append(r, x)
 				break
 			}
@@ -257,3 +382,46 @@ func mounts(base ...string) ([]string, error) {
 	}
 	return r, s.Err()
 }
+
+// parsePort parses NS_PORT, which is either a single port or a range, in
+// which case the first free port not in used is chosen.
+func parsePort(v string, used map[int]bool) (int, error) {
+	if i := strings.IndexByte(v, '-'); i != -1 {
+		if n1, err := strconv.ParseInt(v[:i], 10, 64); err != nil {
+			return 0, fmt.Errorf("invalid port range %q", v)
+		} else if n2, err := strconv.ParseInt(v[i+1:], 10, 64); err != nil {
+			return 0, fmt.Errorf("invalid port range %q", v)
+		} else if n1 < 1 || n2 > 65535 || n1 > n2 {
+			return 0, fmt.Errorf("invalid port range %q: out of range", v)
+		} else if n, ok := freeUDPPort(int(n1), int(n2), used); !ok {
+			return 0, fmt.Errorf("no free UDP port in range %q", v)
+		} else {
+			return n, nil
+		}
+	}
+	if n, err := strconv.ParseInt(v, 10, 64); err != nil {
+		return 0, fmt.Errorf("invalid port %q", v)
+	} else if n < 1 || n > 65535 {
+		return 0, fmt.Errorf("invalid port %q: out of range", v)
+	} else {
+		return int(n), nil
+	}
+}
+
+// freeUDPPort finds the first port from start to end (inclusive) which isn't
+// bound by any UDP socket or in used. Since the port is released before the
+// server binds it, two instances started at the same moment may still pick the
+// same one, in which case the later one will fail to start and should be
+// restarted.
+func freeUDPPort(start, end int, used map[int]bool) (int, bool) {
+	for n := start; n <= end; n++ {
+		if used[n] {
+			continue
+		}
+		if c, err := net.ListenUDP("udp4", &net.UDPAddr{Port: n}); err == nil {
+			c.Close()
+			return n, true
+		}
+	}
+	return 0, false
+}
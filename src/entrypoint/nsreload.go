@@ -0,0 +1,152 @@
+package main
+
+import (
+	"bufio"
+	"bytes"
+	"fmt"
+	"io"
+	"os"
+	"path/filepath"
+	"sort"
+	"strings"
+	"syscall"
+	"time"
+	"unsafe"
+)
+
+// restartConvars are convars which are only read when the server starts (or
+// registers with the master server), so changing them requires a restart. Note
+// that ns_report_server_to_masterserver isn't one of them, since it's checked
+// every frame before sending a heartbeat (which is also how NSWRAP_DRAIN_CMD
+// stops the server from being listed).
+var restartConvars = map[string]bool{
+	"ns_masterserver_hostname": true,
+	"ns_player_auth_port":      true,
+	"base_tickinterval_mp":     true,
+}
+
+// ReadEnvFile reads a Docker-style env file (KEY=VALUE per line, with blank
+// lines and lines starting with # ignored, and no quoting).
+func ReadEnvFile(name string) (map[string]string, error) {
+	buf, err := os.ReadFile(name)
+	if err != nil {
+		return nil, err
+	}
+	m := map[string]string{}
+	s := bufio.NewScanner(bytes.NewReader(buf))
+	for i := 1; s.Scan(); i++ {
+		l := strings.TrimSpace(s.Text())
+		if l == "" || l[0] == '#' {
+			continue
+		}
+		spl := strings.SplitN(l, "=", 2)
+		if len(spl) != 2 || spl[0] == "" {
+			return nil, fmt.Errorf("line %d: expected KEY=VALUE", i)
+		}
+		m[spl[0]] = spl[1]
+	}
+	return m, s.Err()
+}
+
+// EnvFileLookup returns a function which looks up environment variables in m
+// before the process environment. Like the process environment, {{hostname}}
+// is replaced in NS_SERVER_NAME and NS_SERVER_DESC.
+func EnvFileLookup(m map[string]string, hostname string) func(string) (string, bool) {
+	return func(k string) (string, bool) {
+		if v, ok := m[k]; ok {
+			if k == "NS_SERVER_NAME" || k == "NS_SERVER_DESC" {
+				v = strings.ReplaceAll(v, "{{hostname}}", hostname)
+			}
+			return v, true
+		}
+		return os.LookupEnv(k)
+	}
+}
+
+// Diff compares the config to a newer one, returning the convars which can be
+// changed in the running server, and the convars and arguments which require a
+// restart to take effect.
+func (n *NSConfig) Diff(o *NSConfig) (live, restart []string) {
+	for c, v := range o.cv {
+		if ov, ok := n.cv[c]; !ok || ov != v {
+			if restartConvars[c] {
+				restart = append(restart, c)
+			} else {
+				live = append(live, c)
+			}
+		}
+	}
+	for c := range n.cv {
+		if _, ok := o.cv[c]; !ok {
+			restart = append(restart, c) // can't unset a convar
+		}
+	}
+	if strings.Join(n.ax, "\x00") != strings.Join(o.ax, "\x00") {
+		restart = append(restart, "(extra arguments)")
+	}
+	sort.Strings(live)
+	sort.Strings(restart)
+	return
+}
+
+// Commands writes the console commands to set the provided convars to their
+// values in the config.
+func (n *NSConfig) Commands(w io.Writer, convars ...string) error {
+	for _, c := range convars {
+		if _, err := fmt.Fprintf(w, "%s \"%s\"\n", c, n.cv[c]); err != nil {
+			return err
+		}
+	}
+	return nil
+}
+
+// WatchFile calls fn whenever the file is created, written, or replaced
+// (including by renaming over it or swapping a symlinked parent directory like
+// Kubernetes ConfigMaps do), with events debounced by the provided duration.
+// It only returns if the watch can't be set up or fails.
+func WatchFile(name string, debounce time.Duration, fn func()) error {
+	fd, err := syscall.InotifyInit1(syscall.IN_CLOEXEC)
+	if err != nil {
+		return fmt.Errorf("inotify init: %w", err)
+	}
+	defer syscall.Close(fd)
+
+	if _, err := syscall.InotifyAddWatch(fd, filepath.Dir(name), syscall.IN_CLOSE_WRITE|syscall.IN_MOVED_TO|syscall.IN_CREATE|syscall.IN_DELETE); err != nil {
+		return fmt.Errorf("inotify watch %q: %w", filepath.Dir(name), err)
+	}
+
+	ch := make(chan struct{}, 1)
+	go func() {
+		for range ch {
+			time.Sleep(debounce)
+			for len(ch) != 0 {
+				<-ch
+			}
+			fn()
+		}
+	}()
+	defer close(ch)
+
+	buf := make([]byte, 64*(syscall.SizeofInotifyEvent+syscall.NAME_MAX+1))
+	base := filepath.Base(name)
+	for {
+		n, err := syscall.Read(fd, buf)
+		if err != nil {
+			if err == syscall.EINTR {
+				continue
+			}
+			return fmt.Errorf("inotify read: %w", err)
+		}
+		for off := 0; off+syscall.SizeofInotifyEvent <= n; {
+			ev := (*syscall.InotifyEvent)(unsafe.Pointer(&buf[off]))
+			nb := buf[off+syscall.SizeofInotifyEvent : off+syscall.SizeofInotifyEvent+int(ev.Len)]
+			off += syscall.SizeofInotifyEvent + int(ev.Len)
+			if evn := string(bytes.TrimRight(nb, "\x00")); evn == base || strings.HasPrefix(evn, "..") {
+				select {
+				case ch <- struct{}{}:
+				default:
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,68 @@
+package main
+
+import (
+	"bufio"
+	"fmt"
+	"os"
+	"strconv"
+	"strings"
+	"syscall"
+	"unsafe"
+)
+
+// startupTimer records when each phase of the startup ends and the bytes read
+// from storage during it, so nswrap can include them in the startup summary it
+// logs once the server is ready (see NSWRAP_STARTUP).
+//
+// The byte counts are for the entire process, so in fleet mode, where the
+// instances are prepared concurrently, they overlap.
+type startupTimer struct {
+	phases []string
+	rb     uint64
+}
+
+func newStartupTimer() *startupTimer {
+	t := &startupTimer{rb: readBytes()}
+	t.phases = append(t.phases, fmt.Sprintf("start:%d:0", monotime()))
+	return t
+}
+
+// Mark ends the current phase.
+func (t *startupTimer) Mark(name string) {
+	rb := readBytes()
+	t.phases = append(t.phases, fmt.Sprintf("%s:%d:%d", name, monotime(), rb-t.rb))
+	t.rb = rb
+}
+
+// String formats the phases for NSWRAP_STARTUP as space-separated
+// name:end:bytes, where end is the CLOCK_MONOTONIC time in nanoseconds.
+func (t *startupTimer) String() string {
+	return strings.Join(t.phases, " ")
+}
+
+// monotime gets the CLOCK_MONOTONIC time, which (unlike the monotonic reading
+// in time.Time) can be compared with the one in other processes.
+func monotime() int64 {
+	var ts syscall.Timespec
+	syscall.Syscall(syscall.SYS_CLOCK_GETTIME, 1 /* CLOCK_MONOTONIC */, uintptr(unsafe.Pointer(&ts)), 0)
+	return ts.Nano()
+}
+
+// readBytes gets the number of bytes this process caused to be read from
+// storage, or zero if I/O accounting isn't available.
+func readBytes() uint64 {
+	f, err := os.Open("/proc/self/io")
+	if err != nil {
+		return 0
+	}
+	defer f.Close()
+
+	sc := bufio.NewScanner(f)
+	for sc.Scan() {
+		if v := strings.TrimPrefix(sc.Text(), "read_bytes: "); v != sc.Text() {
+			n, _ := strconv.ParseUint(v, 10, 64)
+			return n
+		}
+	}
+	return 0
+}
@@ -17,10 +17,15 @@
 #endif
 
 #include <ctype.h>
+#include <dirent.h>
+#include <dlfcn.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <math.h>
 #include <regex.h>
 #include <poll.h>
+#include <pthread.h>
 #include <sched.h>
 #include <signal.h>
 #include <stdatomic.h>
@@ -31,17 +36,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <termios.h>
 #include <unistd.h>
 
+#include <arpa/inet.h>
 #include <sys/epoll.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/prctl.h>
+#include <sys/random.h>
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/statfs.h>
 #include <sys/sysinfo.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <sys/utsname.h>
 #include <sys/wait.h>
 
@@ -54,14 +68,39 @@
 /** The chunk size for console i/o (also the maximum length of a parsed title). */
 #define NS_IOPROC_OUTPUT_CHUNK_SIZE 256
 
+/** The default size of the stdout buffer used while the log consumer isn't keeping up. */
+#define NS_OUTBUF_DEFAULT_SIZE (1024 * 1024)
+
+/** The default size of the console ring which is saved after a crash or hang. */
+#define NS_CONLOG_DEFAULT_RING_SIZE (8 * 1024 * 1024)
+
+/** The default number of rotated console logs to keep. */
+#define NS_CONLOG_DEFAULT_KEEP 5
+
+/** The number of buckets for the title update interval histogram. */
+#define NS_CADENCE_BUCKETS 2000
+
+/** The maximum number of threads tracked by the profiler. */
+#define NS_PROF_MAX_THREADS 1024
+
+/** The approximate window for the rolling profiler statistics. */
+#define NS_PROF_ROLLING_SEC 10
+
+/** The maximum number of distinct wineserver request types (per process role) tracked by the profiler. */
+#define NS_PROF_MAX_REQS 1024
+
+/** The wineserver request statistics report format from serverstats.patch. */
+#define NS_PROF_REQ_MAGIC 0x54535357
+#define NS_PROF_REQ_BUCKETS 24
+
 /** The regexp for matching the console title against to extract the server status. */
 #define NS_STATUS_RE(_x, _int, _str) _x( \
     " - ([A-Za-z0-9_]+) ([0-9]+)/([0-9]+) players \\(([A-Za-z0-9_]+)\\)", \
     _str(map_name) _int(player_count) _int(max_players) _str(playlist_name) \
 )
 
-/** Log functions. All output is prefixed and written to stderr. */
-#define ns_log(fmt, ...) fprintf(stderr, "nswrap: " fmt "\n", ##__VA_ARGS__)
+/** Log functions. All output is prefixed and written to stderr (through ns_log_outbuf once it's set). */
+#define ns_log(fmt, ...) ns_logf("nswrap: " fmt "\n", ##__VA_ARGS__)
 #define ns_perror(fmt, ...) ns_log(fmt ": %m", ##__VA_ARGS__)
 #define ns_perror_dbg(fmt, ...) ns_perror("debug: error: " fmt " (in %s) (%s:%d)", ##__VA_ARGS__, __FUNCTION__, __FILE__, __LINE__)
 
@@ -80,6 +119,8 @@ void __defer_cb(void (**fn)(void)) { (*fn)(); }
 
 extern char **environ;
 
+static __attribute__ ((__format__ (__printf__, 1, 2))) void ns_logf(const char *fmt, ...);
+
 /** Like getenv, but gets the entire variable. */
 static char *getenve(const char *name) {
     int i;
@@ -96,6 +137,26 @@ static char *getenve(const char *name) {
     return NULL;
 }
 
+/**
+ * Parses an unsigned integer from an environment variable, leaving out unchanged if it isn't set. If it's invalid or
+ * out of range, an error is logged and -1 is returned.
+ */
+static int getenvul(const char *name, unsigned long min, unsigned long max, unsigned long *out) {
+    const char *v = getenv(name);
+    if (!v) {
+        return 0;
+    }
+    char *e;
+    errno = 0;
+    unsigned long x = strtoul(v, &e, 10);
+    if (!*v || *e || errno || x < min || x > max) {
+        ns_log("error: invalid %s '%s': must be an integer from %lu to %lu", name, v, min, max);
+        return -1;
+    }
+    *out = x;
+    return 0;
+}
+
 /** Get the number of available logical cores. */
 static int nprocs(void) {
     int c = get_nprocs_conf();
@@ -183,6 +244,9 @@ static int xvfb(struct timespec timeout, int output_fd, pid_t *pid_out, char *er
     pid_t pid = fork();
     if (!pid) {
         setsid();
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
         dup2(open("/dev/null", O_RDONLY), 0);
         dup2(output_fd, 1);
         dup2(output_fd, 2);
@@ -383,6 +447,78 @@ static void ns_status_str(struct ns_status *st, char *buf, size_t buf_sz) {
     #undef putf
 }
 
+/** Tracks the distribution of the interval between title updates, which are written by the server loop. */
+struct ns_cadence {
+    bool started;
+    struct timespec last;
+    uint64_t n;
+    uint64_t sum_us;
+    uint64_t max_us;
+    double sumsq_us;
+    uint32_t buckets[NS_CADENCE_BUCKETS];
+};
+
+/** Gets the bucket for an interval: 100us up to 100ms, then 10ms up to 10s. */
+static size_t ns_cadence_bucket(uint64_t us) {
+    if (us < 100000) {
+        return us / 100;
+    }
+    if (us < 10000000) {
+        return 1000 + (us - 100000) / 10000;
+    }
+    return NS_CADENCE_BUCKETS - 1;
+}
+
+/** Gets the upper bound of a bucket in microseconds. */
+static uint64_t ns_cadence_bucket_us(size_t b) {
+    return b < 1000 ? (b + 1) * 100 : 100000 + (b - 1000 + 1) * 10000;
+}
+
+/** Records a title update. Returns 0 on success, or -1 with errno set. */
+static int ns_cadence_update(struct ns_cadence *c) {
+    struct timespec ts;
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1) {
+        return -1;
+    }
+    if (c->started) {
+        uint64_t us = (ts.tv_sec - c->last.tv_sec) * 1000000 + (ts.tv_nsec - c->last.tv_nsec) / 1000;
+        c->n++;
+        c->sum_us += us;
+        c->sumsq_us += (double)(us) * us;
+        if (us > c->max_us) {
+            c->max_us = us;
+        }
+        c->buckets[ns_cadence_bucket(us)]++;
+    }
+    c->started = true;
+    c->last = ts;
+    return 0;
+}
+
+/** Estimates the q-th quantile of the interval in microseconds. */
+static uint64_t ns_cadence_quantile(const struct ns_cadence *c, double q) {
+    uint64_t n = 0, t = (uint64_t)(c->n * q);
+    for (size_t i = 0; i < NS_CADENCE_BUCKETS; i++) {
+        if ((n += c->buckets[i]) > t) {
+            uint64_t us = ns_cadence_bucket_us(i);
+            return us < c->max_us ? us : c->max_us;
+        }
+    }
+    return c->max_us;
+}
+
+/** Formats the interval statistics. */
+static void ns_cadence_str(const struct ns_cadence *c, char *buf, size_t buf_sz) {
+    if (!c->n) {
+        snprintf(buf, buf_sz, "no updates");
+        return;
+    }
+    double mean = (double)(c->sum_us) / c->n, var = c->sumsq_us / c->n - mean * mean;
+    snprintf(buf, buf_sz, "%llu updates, mean %.2fms, stddev %.2fms, p50 %.1fms, p99 %.1fms, max %.1fms",
+        (unsigned long long)(c->n), mean / 1e3, (var > 0 ? sqrt(var) : 0) / 1e3,
+        ns_cadence_quantile(c, 0.50) / 1e3, ns_cadence_quantile(c, 0.99) / 1e3, c->max_us / 1e3);
+}
+
 /** Captures console output, filters junk ANSI escapes from Wine, and catches title updates. */
 struct ns_ioproc {
     struct {
@@ -394,6 +530,12 @@ struct ns_ioproc {
         char b_tit[NS_IOPROC_OUTPUT_CHUNK_SIZE + 1]; // +1 for the null terminator
         char b_out[NS_IOPROC_OUTPUT_CHUNK_SIZE * 2 + 32]; // b_inp + b_tit + room for unprocessed escapes
     } output;
+    struct {
+        int fd_epoll; // -1 until the pty is added to the epoll set
+        bool armed; // EPOLLOUT is set
+        size_t n;
+        char buf[NS_IOPROC_OUTPUT_CHUNK_SIZE * 4]; // queued console input
+    } input;
     struct {
         int fd_pipe_title_r;
         int fd_pipe_title_w;
@@ -402,7 +544,7 @@ struct ns_ioproc {
 };
 
 static int ns_ioproc_init(struct ns_ioproc *p) {
-    int fd_pty_master = open("/dev/ptmx", O_RDWR | O_NOCTTY | O_CLOEXEC);
+    int fd_pty_master = open("/dev/ptmx", O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
     if (fd_pty_master == -1) {
         preserve_errno({
             ns_perror_dbg("open pty master");
@@ -492,6 +634,7 @@ static int ns_ioproc_init(struct ns_ioproc *p) {
     *p = (struct ns_ioproc){
         .output.fd_pty_master = fd_pty_master,
         .output.fd_pty_slave = fd_pty_slave,
+        .input.fd_epoll = -1,
         .title.fd_pipe_title_r = fd_pipe_title[0],
         .title.fd_pipe_title_w = fd_pipe_title[1],
     };
@@ -509,7 +652,67 @@ static int ns_ioproc_output_pty(struct ns_ioproc *p) {
     return p->output.fd_pty_slave;
 }
 
+/**
+ * Writes as much of the queued console input to the pty as possible, and watches for the pty to become writable while
+ * there's still some left. If the write fails, the queue is discarded, and -1 is returned with errno set.
+ */
+static int ns_ioproc_input_flush(struct ns_ioproc *p) {
+    int ret = 0;
+    size_t i = 0;
+    while (i < p->input.n) {
+        ssize_t w = write(p->output.fd_pty_master, p->input.buf + i, p->input.n - i);
+        if (w == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                i = p->input.n;
+                ret = -1;
+            }
+            break;
+        }
+        i += w;
+    }
+    p->input.n -= i;
+    memmove(p->input.buf, p->input.buf + i, p->input.n);
+    if (p->input.fd_epoll != -1 && p->input.armed != !!p->input.n) {
+        preserve_errno({
+            if (epoll_ctl(p->input.fd_epoll, EPOLL_CTL_MOD, p->output.fd_pty_master, &(struct epoll_event) {
+                .events = EPOLLIN | (p->input.n ? EPOLLOUT : 0),
+                .data.fd = p->output.fd_pty_master,
+            }) == 0) {
+                p->input.armed = !!p->input.n;
+            }
+        });
+    }
+    return ret;
+}
+
+/**
+ * Queues console input to be written to the pty, writing as much of it as possible immediately. The rest is written
+ * once the server reads its input, so lines are never cut off. If there isn't room in the queue for all of buf, none of
+ * it is queued, and -1 is returned with errno set to EAGAIN.
+ */
+static int ns_ioproc_input(struct ns_ioproc *p, const char *buf, size_t n) {
+    if (n > sizeof(p->input.buf) - p->input.n) {
+        errno = EAGAIN;
+        return -1;
+    }
+    memcpy(p->input.buf + p->input.n, buf, n);
+    p->input.n += n;
+    return ns_ioproc_input_flush(p);
+}
+
+static int ns_ioproc_input_epoll_check(struct ns_ioproc *p, struct epoll_event ev) {
+    return ev.data.fd == p->output.fd_pty_master && (ev.events & EPOLLOUT);
+}
+
+static int ns_ioproc_input_epoll_process(struct ns_ioproc *p) {
+    return ns_ioproc_input_flush(p);
+}
+
 static int ns_ioproc_output_epoll_add(struct ns_ioproc *p, int fd) {
+    p->input.fd_epoll = fd;
     return epoll_ctl(fd, EPOLL_CTL_ADD, p->output.fd_pty_master, &(struct epoll_event) {
         .events = EPOLLIN,
         .data.fd = p->output.fd_pty_master,
@@ -785,155 +988,3630 @@ static const char *ns_ioproc_title_epoll_process(struct ns_ioproc *p) {
     return p->title.buf;
 }
 
-/** Watches for server hangs by taking advantage of the title updates in the server loop. */
-struct ns_watchdog {
-    int timerfd;
-    atomic_int init_ctr;
-    atomic_long last_sec;
-    int init_target;
-    int init_timeout_sec;
-    int interval_sec;
-    char err[150];
+/** What to do with console output when the stdout buffer is full. */
+enum ns_outbuf_policy {
+    NS_OUTBUF_POLICY_DROP,  // discard the oldest buffered lines
+    NS_OUTBUF_POLICY_SPILL, // move the oldest buffered output to a file
+    NS_OUTBUF_POLICY_BLOCK, // wait for the consumer (i.e., the old behaviour)
+};
+
+/** Writes to stdout without blocking the event loop, buffering up to a fixed size if the consumer stalls. */
+struct ns_outbuf {
+    int fd;
+    int fd_epoll; // -1 if fd can't be polled (e.g., regular files)
+    int fd_spill;
+    bool shared; // fd is a shared blocking file description, so only write up to PIPE_BUF when it's writable
+    bool send; // fd is a shared socket, so use MSG_DONTWAIT instead of O_NONBLOCK
+    bool armed; // fd is in the epoll set
+    enum ns_outbuf_policy policy;
+    char *buf;
+    size_t cap, off, len;
+    uint64_t n_dropped, n_spilled; // bytes
+    uint64_t n_dropped_reported, n_spilled_reported;
+    pthread_mutex_t mu; // recursive, since it may be the log output, which helper threads also write to
 };
 
 /**
- * Initializes a ns_watchdog. The watchdog must receive init_target events within init_timeout_sec to start, then it
- * must receive at least one title update every interval_sec. If the timerfd can't be created, -1 is returned and errno
- * is set. Otherwise, 0 is returned.
+ * Initializes a ns_outbuf writing to fd with a buffer of cap bytes. The fd is re-opened if possible so O_NONBLOCK
+ * doesn't affect other processes sharing it (or our own stderr). Otherwise, the flags are left alone, and pipes are
+ * only written to when poll says they're writable, and no more than PIPE_BUF at a time (which doesn't block as long
+ * as nothing else is writing to it). If the policy is NS_OUTBUF_POLICY_SPILL, spill_path must be set. If an error
+ * occurs, -1 is returned and errno is set. Otherwise, 0 is returned.
  */
-static int ns_watchdog_init(struct ns_watchdog *wd, int init_target, int init_timeout_sec, int interval_sec) {
-    int timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
-    if (timerfd == -1) {
+static int ns_outbuf_init(struct ns_outbuf *o, int fd, size_t cap, enum ns_outbuf_policy policy, const char *spill_path) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
         preserve_errno({
-            ns_perror_dbg("create timerfd");
+            ns_perror_dbg("stat output fd");
         });
         return -1;
     }
-    if (timerfd_settime(timerfd, 0, &(struct itimerspec) {
-        .it_value.tv_sec = init_timeout_sec,
-    }, NULL) == -1) {
+
+    int nfd = -1;
+    bool send = false, shared = false;
+    if (S_ISFIFO(st.st_mode) || S_ISCHR(st.st_mode)) {
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+        nfd = open(path, O_WRONLY | O_NONBLOCK | O_NOCTTY | O_CLOEXEC); // this will fail if the pipe is owned by another user
+    } else if (S_ISSOCK(st.st_mode)) {
+        send = true;
+    }
+    if (nfd == -1) {
+        if ((nfd = fcntl(fd, F_DUPFD_CLOEXEC, 3)) == -1) {
+            preserve_errno({
+                ns_perror_dbg("dup output fd");
+            });
+            return -1;
+        }
+        shared = !send && !S_ISREG(st.st_mode) && !(fcntl(nfd, F_GETFL) & O_NONBLOCK);
+    }
+
+    int fd_spill = -1;
+    if (policy == NS_OUTBUF_POLICY_SPILL) {
+        if (!spill_path || !*spill_path) {
+            preserve_errno({
+                close(nfd);
+            });
+            errno = EINVAL;
+            return -1;
+        }
+        if ((fd_spill = open(spill_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1) {
+            preserve_errno({
+                ns_perror_dbg("open spill file '%s'", spill_path);
+                close(nfd);
+            });
+            return -1;
+        }
+    }
+
+    char *buf = malloc(cap);
+    if (!buf) {
         preserve_errno({
-            ns_perror_dbg("set timerfd");
-            close(wd->timerfd);
+            if (fd_spill != -1) close(fd_spill);
+            close(nfd);
         });
         return -1;
     }
-    *wd = (struct ns_watchdog) {
-        .timerfd = timerfd,
-        .init_target = init_target,
-        .init_timeout_sec = init_timeout_sec,
-        .interval_sec = interval_sec,
+
+    *o = (struct ns_outbuf) {
+        .fd = nfd,
+        .fd_epoll = -1,
+        .fd_spill = fd_spill,
+        .shared = shared,
+        .send = send,
+        .policy = policy,
+        .buf = buf,
+        .cap = cap,
     };
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&o->mu, &attr);
+    pthread_mutexattr_destroy(&attr);
     return 0;
 }
 
-/**
- * Stops a ns_watchdog and frees the timerfd.
- */
-static void ns_watchdog_stop(struct ns_watchdog *wd) {
-    close(wd->timerfd);
-}
+static void ns_outbuf_flush(struct ns_outbuf *o, int timeout_ms);
 
-/** Checks if the watchdog has received the initial ticks. */
-static bool ns_watchdog_initialized(struct ns_watchdog *wd) {
-    return atomic_load(&wd->init_ctr) >= wd->init_target;
-}
+static struct ns_outbuf *ns_log_outbuf; // protected by ns_log_mu
+static pthread_mutex_t ns_log_mu = PTHREAD_MUTEX_INITIALIZER;
 
-/** Sends an update to the watchdog. Returns 0 on success or -1 with errno set. */
-static int ns_watchdog_update(struct ns_watchdog *wd) {
-    struct timespec ts;
-    if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == -1) {
-        return -1;
+static void ns_outbuf_close(struct ns_outbuf *o) {
+    pthread_mutex_lock(&ns_log_mu);
+    if (ns_log_outbuf == o) {
+        ns_outbuf_flush(o, 1000); // for anything logged after the cleanup
+        ns_log_outbuf = NULL;
     }
-    if (!ns_watchdog_initialized(wd)) {
-        long last = atomic_exchange(&wd->last_sec, (long)(ts.tv_sec));
-        if (ts.tv_sec - last > wd->interval_sec) {
-            atomic_store(&wd->init_ctr, 0);
-            return 0;
-        } else if (atomic_fetch_add(&wd->init_ctr, 1) < wd->init_target) {
+    pthread_mutex_unlock(&ns_log_mu);
+    pthread_mutex_destroy(&o->mu);
+    if (o->fd_spill != -1) {
+        close(o->fd_spill);
+    }
+    close(o->fd);
+    free(o->buf);
+}
+
+/** Writes up to n bytes directly to the output fd, returning the number written or -1 with errno set. */
+static ssize_t ns_outbuf_write_fd(struct ns_outbuf *o, const struct iovec *iov, int iovcnt) {
+    struct iovec tmp[2];
+    if (o->shared) {
+        if (poll(&(struct pollfd) { .fd = o->fd, .events = POLLOUT }, 1, 0) != 1) {
             return 0;
         }
+        size_t n = 0;
+        for (int i = 0; i < iovcnt && i < 2; i++) {
+            tmp[i] = iov[i];
+            if (tmp[i].iov_len > PIPE_BUF - n) {
+                tmp[i].iov_len = PIPE_BUF - n;
+            }
+            n += tmp[i].iov_len;
+        }
+        iov = tmp;
     }
-    atomic_store(&wd->last_sec, ts.tv_sec);
-    return timerfd_settime(wd->timerfd, 0, &(struct itimerspec) {
-        .it_value.tv_sec = wd->interval_sec,
-    }, NULL);
+    ssize_t r;
+    do {
+        if (o->send) {
+            r = sendmsg(o->fd, &(struct msghdr) {
+                .msg_iov = (struct iovec *) (iov),
+                .msg_iovlen = iovcnt,
+            }, MSG_DONTWAIT | MSG_NOSIGNAL);
+        } else {
+            r = writev(o->fd, iov, iovcnt);
+        }
+    } while (r == -1 && errno == EINTR);
+    if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return 0;
+    }
+    return r;
 }
 
-/** Adds the watchdog to the epoll file descriptor. */
-static int ns_watchdog_epoll_add(struct ns_watchdog *wd, int fd) {
-    return epoll_ctl(fd, EPOLL_CTL_ADD, wd->timerfd, &(struct epoll_event) {
-        .events = EPOLLIN,
-        .data.fd = wd->timerfd,
-    });
+/** Writes as much of the buffer as possible without blocking. Returns -1 with errno set on error. */
+static int ns_outbuf_drain(struct ns_outbuf *o) {
+    while (o->len) {
+        size_t n1 = o->cap - o->off < o->len ? o->cap - o->off : o->len;
+        ssize_t r = ns_outbuf_write_fd(o, (struct iovec[]) {
+            { .iov_base = o->buf + o->off, .iov_len = n1 },
+            { .iov_base = o->buf, .iov_len = o->len - n1 },
+        }, 2);
+        if (r == -1) {
+            return -1;
+        }
+        if (r == 0) {
+            break;
+        }
+        o->off = (o->off + r) % o->cap;
+        o->len -= r;
+    }
+    if (!o->len) {
+        o->off = 0;
+    }
+    return 0;
 }
 
-/** Checks if an epoll event matches the watchdog. */
-static bool ns_watchdog_epoll_check(struct ns_watchdog *wd, struct epoll_event ev) {
-    return ev.data.fd == wd->timerfd;
+/** Adds or removes the output fd from the epoll set depending on whether there is buffered output. */
+static int ns_outbuf_rearm(struct ns_outbuf *o) {
+    if (o->fd_epoll == -1 || o->armed == !!o->len) {
+        return 0;
+    }
+    if (o->len) {
+        if (epoll_ctl(o->fd_epoll, EPOLL_CTL_ADD, o->fd, &(struct epoll_event) {
+            .events = EPOLLOUT,
+            .data.fd = o->fd,
+        })) {
+            if (errno != EPERM) {
+                return -1;
+            }
+            o->fd_epoll = -1; // not pollable, so it'll only be drained on the next write
+            return 0;
+        }
+    } else if (epoll_ctl(o->fd_epoll, EPOLL_CTL_DEL, o->fd, NULL)) {
+        return -1;
+    }
+    o->armed = !!o->len;
+    return 0;
 }
 
-/** Processes an epoll event and returns the error message, or NULL with errno set. */
-static const char *ns_watchdog_epoll_process(struct ns_watchdog *wd) {
-    uint64_t v;
-    if (read(wd->timerfd, &v, sizeof(v)) == -1) {
-        return NULL;
+/** Makes room for at least n more bytes in the buffer according to the overflow policy. */
+static int ns_outbuf_reserve(struct ns_outbuf *o, size_t n) {
+    if (o->cap - o->len >= n) {
+        return 0;
     }
-    struct timespec ts;
-    if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == -1) {
-        return NULL;
+    if (o->policy == NS_OUTBUF_POLICY_BLOCK) {
+        while (o->cap - o->len < n) {
+            if (poll(&(struct pollfd) { .fd = o->fd, .events = POLLOUT }, 1, -1) == -1 && errno != EINTR) {
+                return -1;
+            }
+            if (ns_outbuf_drain(o)) {
+                return -1;
+            }
+        }
+        return 0;
     }
-    if (ns_watchdog_initialized(wd)) {
-        snprintf(wd->err, sizeof(wd->err), "watchdog did not receive a title update in time: last tick was %lds ago", (long)(ts.tv_sec) - atomic_load(&wd->last_sec));
-        return wd->err;
+
+    // discard whole lines where possible so the output isn't garbled
+    size_t x = n - (o->cap - o->len);
+    while (x < o->len && o->buf[(o->off + x - 1) % o->cap] != '\n') {
+        x++;
+    }
+
+    if (o->policy == NS_OUTBUF_POLICY_SPILL) {
+        size_t n1 = o->cap - o->off < x ? o->cap - o->off : x;
+        ssize_t r;
+        do {
+            r = writev(o->fd_spill, (struct iovec[]) {
+                { .iov_base = o->buf + o->off, .iov_len = n1 },
+                { .iov_base = o->buf, .iov_len = x - n1 },
+            }, 2);
+        } while (r == -1 && errno == EINTR);
+        if (r == (ssize_t)(x)) {
+            o->n_spilled += x;
+        } else {
+            o->n_dropped += x;
+        }
     } else {
-        snprintf(wd->err, sizeof(wd->err), "watchdog did not receive enough title updates for initialization: only received %d/%d initial ticks less than %ds apart within %ds", atomic_load(&wd->init_ctr), wd->init_target, wd->interval_sec, wd->init_timeout_sec);
-        return wd->err;
+        o->n_dropped += x;
     }
+    o->off = (o->off + x) % o->cap;
+    o->len -= x;
+    return 0;
 }
 
-int main(int argc, char **argv) {
-    if (argc <= 1) {
-        fprintf(stderr, "usage: %s game_dir [args...]\n", argc ? argv[0] : "nswrap");
-        return 2;
+/** Queues output to be written, writing it immediately if possible. Returns -1 with errno set on error. */
+static int ns_outbuf_write_locked(struct ns_outbuf *o, const char *buf, size_t n) {
+    if (!o->len) {
+        ssize_t r = ns_outbuf_write_fd(o, &(struct iovec) {
+            .iov_base = (void *) (buf),
+            .iov_len = n,
+        }, 1);
+        if (r == -1) {
+            return -1;
+        }
+        buf += r;
+        n -= r;
+    } else if (o->fd_epoll == -1 && ns_outbuf_drain(o)) {
+        return -1;
+    }
+    if (n) {
+        if (n > o->cap) {
+            o->n_dropped += n - o->cap;
+            buf += n - o->cap;
+            n = o->cap;
+        }
+        if (ns_outbuf_reserve(o, n)) {
+            return -1;
+        }
+        size_t p = (o->off + o->len) % o->cap;
+        size_t n1 = o->cap - p < n ? o->cap - p : n;
+        memcpy(o->buf + p, buf, n1);
+        memcpy(o->buf, buf + n1, n - n1);
+        o->len += n;
     }
+    return ns_outbuf_rearm(o);
+}
 
-    if (geteuid() == 0) {
-        ns_log("error: this program must not be run as root");
-        return 1;
+/** Locks the ns_outbuf and calls ns_outbuf_write_locked. */
+static int ns_outbuf_write(struct ns_outbuf *o, const char *buf, size_t n) {
+    pthread_mutex_lock(&o->mu);
+    int r = ns_outbuf_write_locked(o, buf, n);
+    preserve_errno({
+        pthread_mutex_unlock(&o->mu);
+    });
+    return r;
+}
+
+/** Adds the output fd to the epoll set while there is buffered output. */
+static int ns_outbuf_epoll_add(struct ns_outbuf *o, int fd) {
+    pthread_mutex_lock(&o->mu);
+    o->fd_epoll = fd;
+    int r = ns_outbuf_rearm(o);
+    preserve_errno({
+        pthread_mutex_unlock(&o->mu);
+    });
+    return r;
+}
+
+static bool ns_outbuf_epoll_check(struct ns_outbuf *o, struct epoll_event ev) {
+    pthread_mutex_lock(&o->mu);
+    bool r = o->armed && ev.data.fd == o->fd;
+    pthread_mutex_unlock(&o->mu);
+    return r;
+}
+
+/** Gets a warning message if output was discarded since the last one, or an empty string if not. */
+static const char *ns_outbuf_report(struct ns_outbuf *o, char *buf, size_t buf_sz) {
+    *buf = '\0';
+    pthread_mutex_lock(&o->mu);
+    if (o->n_dropped != o->n_dropped_reported || o->n_spilled != o->n_spilled_reported) {
+        snprintf(buf, buf_sz, "stdout consumer stalled: dropped %lu bytes (%lu total), spilled %lu bytes (%lu total)",
+            (unsigned long) (o->n_dropped - o->n_dropped_reported), (unsigned long) (o->n_dropped),
+            (unsigned long) (o->n_spilled - o->n_spilled_reported), (unsigned long) (o->n_spilled));
+        o->n_dropped_reported = o->n_dropped;
+        o->n_spilled_reported = o->n_spilled;
     }
+    pthread_mutex_unlock(&o->mu);
+    return buf;
+}
 
-    // init setproctitle and attempt to ensure there is a placeholder arg consisting of spaces
-    for (const char *x = argv[argc - 1]; *x; x++) {
-        if (*x != ' ') {
-            char **nargv = alloca(argc + 2*sizeof(char*));
-            for (int i = 0; i < argc; i++) {
-                nargv[i] = argv[i];
+/** Writes buffered output, returning ns_outbuf_report once it has caught up, or NULL with errno set. */
+static const char *ns_outbuf_epoll_process(struct ns_outbuf *o, char *buf, size_t buf_sz) {
+    pthread_mutex_lock(&o->mu);
+    const char *r = buf;
+    if (ns_outbuf_drain(o) || ns_outbuf_rearm(o)) {
+        r = NULL;
+    } else if (o->len) {
+        *buf = '\0';
+    } else {
+        ns_outbuf_report(o, buf, buf_sz);
+    }
+    preserve_errno({
+        pthread_mutex_unlock(&o->mu);
+    });
+    return r;
+}
+
+/** Attempts to write the remaining buffered output within timeout_ms. */
+static void ns_outbuf_flush(struct ns_outbuf *o, int timeout_ms) {
+    pthread_mutex_lock(&o->mu);
+    struct timespec ts, tc;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    while (o->len && !ns_outbuf_drain(o) && o->len) {
+        clock_gettime(CLOCK_MONOTONIC, &tc);
+        int rem = timeout_ms - (int)((tc.tv_sec - ts.tv_sec) * 1000 + (tc.tv_nsec - ts.tv_nsec) / 1000000);
+        if (rem <= 0 || poll(&(struct pollfd) { .fd = o->fd, .events = POLLOUT }, 1, rem) == 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&o->mu);
+}
+
+/** Implements ns_log, formatting the line and writing it to ns_log_outbuf if set, or directly to stderr otherwise. */
+static void ns_logf(const char *fmt, ...) {
+    preserve_errno({
+        char buf[8192];
+        va_list a;
+        va_start(a, fmt);
+        int n = vsnprintf(buf, sizeof(buf), fmt, a);
+        va_end(a);
+        if (n >= 0) {
+            if ((size_t) n >= sizeof(buf)) {
+                memcpy(buf + sizeof(buf) - 5, "...\n", 5);
+                n = sizeof(buf) - 1;
             }
-            nargv[argc] = "                                                                                                                                ";
-            nargv[argc+1] = NULL;
-            if (execve("/proc/self/exe", nargv, environ) == -1) {
-                ns_perror("warning: self-exec with additional space in argv for process title failed: execve");
-                argc++;
+            pthread_mutex_lock(&ns_log_mu);
+            if (ns_log_outbuf) {
+                ns_outbuf_write(ns_log_outbuf, buf, n);
+            } else {
+                fputs(buf, stderr);
             }
+            pthread_mutex_unlock(&ns_log_mu);
+        }
+    });
+}
+
+/** Compression for rotated console logs. The libraries are loaded at runtime so they're optional. */
+enum ns_conlog_compress {
+    NS_CONLOG_COMPRESS_NONE,
+    NS_CONLOG_COMPRESS_ZSTD,
+    NS_CONLOG_COMPRESS_LZ4,
+};
+
+/** The header of the memory-mapped console ring, which is left in place if nswrap dies unexpectedly. */
+struct ns_conlog_ring {
+    char magic[8]; // NSCONLOG
+    uint64_t size;
+    uint64_t pos; // total bytes written
+    char pad[40];
+    char data[];
+};
+
+/**
+ * Keeps the last few MB of console output in a memory-mapped ring file so it can be dumped after a crash or hang, and
+ * optionally writes all output to a log file which is rotated by size and compressed on a helper thread.
+ */
+struct ns_conlog {
+    char dir[256];
+    struct ns_conlog_ring *ring;
+    size_t ring_sz;
+    int fd_log;
+    size_t log_sz, rotate_sz;
+    int keep;
+    enum ns_conlog_compress compress;
+    pthread_t thread;
+    pthread_mutex_t mu;
+    pthread_cond_t cv;
+    char queue[4][320]; // rotated logs waiting to be compressed
+    int queue_n;
+    bool thread_stop;
+    bool thread_started;
+};
+
+/** Compression functions loaded by ns_conlog_compress_load, with the lz4 frame api signatures. */
+static struct {
+    void *lib;
+    const char *ext;
+    size_t (*bound)(size_t, const void *);
+    size_t (*compress)(void *, size_t, const void *, size_t, const void *);
+    unsigned (*iserr)(size_t);
+    size_t (*zstd_bound)(size_t);
+    size_t (*zstd_compress)(void *, size_t, const void *, size_t, int);
+} ns_conlog_lib;
+
+static size_t ns_conlog_zstd_bound(size_t n, const void *prefs) {
+    (void) prefs;
+    return ns_conlog_lib.zstd_bound(n);
+}
+
+static size_t ns_conlog_zstd_compress(void *dst, size_t dst_sz, const void *src, size_t src_sz, const void *prefs) {
+    (void) prefs;
+    return ns_conlog_lib.zstd_compress(dst, dst_sz, src, src_sz, 3);
+}
+
+/** Loads the compression library, returning -1 with errno set if it isn't available. */
+static int ns_conlog_compress_load(enum ns_conlog_compress compress) {
+    if (ns_conlog_lib.lib) {
+        return 0;
+    }
+    switch (compress) {
+    case NS_CONLOG_COMPRESS_ZSTD:
+        if (!(ns_conlog_lib.lib = dlopen("libzstd.so.1", RTLD_NOW | RTLD_LOCAL))) {
+            break;
+        }
+        ns_conlog_lib.ext = ".zst";
+        ns_conlog_lib.zstd_bound = dlsym(ns_conlog_lib.lib, "ZSTD_compressBound");
+        ns_conlog_lib.zstd_compress = dlsym(ns_conlog_lib.lib, "ZSTD_compress");
+        ns_conlog_lib.iserr = dlsym(ns_conlog_lib.lib, "ZSTD_isError");
+        if (ns_conlog_lib.zstd_bound && ns_conlog_lib.zstd_compress) {
+            ns_conlog_lib.bound = ns_conlog_zstd_bound;
+            ns_conlog_lib.compress = ns_conlog_zstd_compress;
+        }
+        break;
+    case NS_CONLOG_COMPRESS_LZ4:
+        if (!(ns_conlog_lib.lib = dlopen("liblz4.so.1", RTLD_NOW | RTLD_LOCAL))) {
             break;
         }
+        ns_conlog_lib.ext = ".lz4";
+        ns_conlog_lib.bound = dlsym(ns_conlog_lib.lib, "LZ4F_compressFrameBound");
+        ns_conlog_lib.compress = dlsym(ns_conlog_lib.lib, "LZ4F_compressFrame");
+        ns_conlog_lib.iserr = dlsym(ns_conlog_lib.lib, "LZ4F_isError");
+        break;
+    default:
+        errno = EINVAL;
+        return -1;
     }
-    argc--;
-    setproctitle(argv, NULL);
-    argv[argc] = NULL;
-
-    if (chdir(argv[1])) {
-        ns_perror("error: chdir '%s'", argv[1]);
-        return 1;
+    if (!ns_conlog_lib.lib || !ns_conlog_lib.bound || !ns_conlog_lib.compress || !ns_conlog_lib.iserr) {
+        ns_log("warning: console log: failed to load compression library: %s", dlerror() ?: "missing symbols");
+        if (ns_conlog_lib.lib) {
+            dlclose(ns_conlog_lib.lib);
+        }
+        ns_conlog_lib.lib = NULL;
+        errno = ENOSYS;
+        return -1;
     }
+    return 0;
+}
 
-    if (access("NorthstarLauncher.exe", F_OK)) {
-        ns_log("error: NorthstarLauncher.exe missing");
-        return 1;
+/** Compresses a file with the loaded library, replacing it. Returns -1 with errno set on error. */
+static int ns_conlog_compress_file(const char *path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
     }
+    defer(close(fd));
 
-    int np = nprocs();
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        return -1;
+    }
+    if (!st.st_size) {
+        return unlink(path);
+    }
+
+    void *src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (src == MAP_FAILED) {
+        return -1;
+    }
+    defer(munmap(src, st.st_size));
+
+    size_t dst_sz = ns_conlog_lib.bound(st.st_size, NULL);
+    void *dst = malloc(dst_sz);
+    if (!dst) {
+        return -1;
+    }
+    defer(free(dst));
+
+    size_t n = ns_conlog_lib.compress(dst, dst_sz, src, st.st_size, NULL);
+    if (ns_conlog_lib.iserr(n)) {
+        errno = EIO;
+        return -1;
+    }
+
+    char out[352];
+    snprintf(out, sizeof(out), "%s%s", path, ns_conlog_lib.ext);
+
+    int fd_out = open(out, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_out == -1) {
+        return -1;
+    }
+    for (size_t i = 0; i < n;) {
+        ssize_t r = write(fd_out, (char *) (dst) + i, n - i);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            preserve_errno({
+                close(fd_out);
+                unlink(out);
+            });
+            return -1;
+        }
+        i += r;
+    }
+    if (close(fd_out) == -1) {
+        preserve_errno({
+            unlink(out);
+        });
+        return -1;
+    }
+    return unlink(path);
+}
+
+static int ns_conlog_prune_filter(const struct dirent *d) {
+    return !strncmp(d->d_name, "console-", 8);
+}
+
+/** Removes all but the newest keep rotated logs. */
+static void ns_conlog_prune(struct ns_conlog *c) {
+    struct dirent **ds;
+    int n = scandir(c->dir, &ds, ns_conlog_prune_filter, alphasort);
+    if (n == -1) {
+        ns_perror("warning: console log: failed to list '%s'", c->dir);
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        if (i < n - c->keep) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", c->dir, ds[i]->d_name);
+            if (unlink(path) && errno != ENOENT) {
+                ns_perror("warning: console log: failed to remove old log '%s'", path);
+            }
+        }
+        free(ds[i]);
+    }
+    free(ds);
+}
+
+static void *ns_conlog_thread(void *arg) {
+    struct ns_conlog *c = arg;
+    char path[sizeof(*c->queue)];
+    pthread_mutex_lock(&c->mu);
+    for (;;) {
+        while (!c->queue_n && !c->thread_stop) {
+            pthread_cond_wait(&c->cv, &c->mu);
+        }
+        if (!c->queue_n) {
+            break;
+        }
+        memcpy(path, c->queue[0], sizeof(path));
+        memmove(c->queue[0], c->queue[1], sizeof(*c->queue) * --c->queue_n);
+        pthread_mutex_unlock(&c->mu);
+
+        if (c->compress != NS_CONLOG_COMPRESS_NONE && ns_conlog_compress_file(path)) {
+            ns_perror("warning: console log: failed to compress '%s'", path);
+        }
+        ns_conlog_prune(c);
+
+        pthread_mutex_lock(&c->mu);
+    }
+    pthread_mutex_unlock(&c->mu);
+    return NULL;
+}
+
+/** Formats the current UTC time for use in file names. */
+static void ns_conlog_timestamp(char *buf, size_t buf_sz) {
+    struct timespec ts;
+    struct tm tm;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    gmtime_r(&ts.tv_sec, &tm);
+    size_t n = strftime(buf, buf_sz, "%Y%m%d-%H%M%S", &tm);
+    snprintf(buf + n, buf_sz - n, ".%03d", (int)(ts.tv_nsec / 1000000));
+}
+
+/**
+ * Writes the contents of the console ring to a new file in the log directory, returning 0 and setting path_out on
+ * success, or -1 with errno set.
+ */
+static int ns_conlog_snapshot(struct ns_conlog *c, const char *reason, char *path_out, size_t path_out_sz) {
+    if (!c->ring) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    char ts[32], path[384];
+    ns_conlog_timestamp(ts, sizeof(ts));
+    snprintf(path, sizeof(path), "%s/snapshot-%s-%s.log", c->dir, ts, reason);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return -1;
+    }
+
+    uint64_t pos = c->ring->pos;
+    size_t n = pos < c->ring_sz ? pos : c->ring_sz;
+    size_t off = (pos - n) % c->ring_sz;
+    size_t n1 = c->ring_sz - off < n ? c->ring_sz - off : n;
+
+    char hdr[128];
+    int hdr_n = snprintf(hdr, sizeof(hdr), "nswrap: console snapshot (%s): last %zu of %lu bytes\n", reason, n, (unsigned long) (pos));
+
+    struct iovec iov[] = {
+        { .iov_base = hdr, .iov_len = hdr_n },
+        { .iov_base = c->ring->data + off, .iov_len = n1 },
+        { .iov_base = c->ring->data, .iov_len = n - n1 },
+    };
+    for (int i = 0; i < 3;) {
+        ssize_t r = writev(fd, iov + i, 3 - i);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            preserve_errno({
+                close(fd);
+            });
+            return -1;
+        }
+        for (; i < 3 && (size_t)(r) >= iov[i].iov_len; i++) {
+            r -= iov[i].iov_len;
+        }
+        if (i < 3) {
+            iov[i].iov_base = (char *) (iov[i].iov_base) + r;
+            iov[i].iov_len -= r;
+        }
+    }
+    if (close(fd) == -1) {
+        return -1;
+    }
+    if (path_out && path_out_sz) {
+        snprintf(path_out, path_out_sz, "%s", path);
+    }
+    return 0;
+}
+
+/** Opens a new console log file. */
+static int ns_conlog_open_log(struct ns_conlog *c) {
+    char path[320];
+    snprintf(path, sizeof(path), "%s/console.log", c->dir);
+    if ((c->fd_log = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        return -1;
+    }
+    c->log_sz = 0;
+    return 0;
+}
+
+/** Moves the current log aside, queues it for compression, and opens a new one. */
+static int ns_conlog_rotate(struct ns_conlog *c) {
+    char ts[32], src[320], dst[sizeof(*c->queue)];
+    ns_conlog_timestamp(ts, sizeof(ts));
+    snprintf(src, sizeof(src), "%s/console.log", c->dir);
+    snprintf(dst, sizeof(dst), "%s/console-%s.log", c->dir, ts);
+
+    close(c->fd_log);
+    c->fd_log = -1;
+    if (rename(src, dst) == -1) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&c->mu);
+    if (c->queue_n < (int)(sizeof(c->queue)/sizeof(*c->queue))) {
+        memcpy(c->queue[c->queue_n++], dst, sizeof(dst));
+        pthread_cond_signal(&c->cv);
+    } else {
+        ns_log("warning: console log: compression is falling behind; leaving '%s' uncompressed", dst);
+    }
+    pthread_mutex_unlock(&c->mu);
+
+    return ns_conlog_open_log(c);
+}
+
+/**
+ * Initializes a ns_conlog in dir with a ring_sz byte ring. If rotate_sz is nonzero, all output is also written to
+ * console.log, which is rotated after rotate_sz bytes, keeping the newest keep logs. If the ring from a previous run
+ * wasn't cleanly closed, it is snapshotted first. Returns -1 with errno set on error.
+ */
+static int ns_conlog_init(struct ns_conlog *c, const char *dir, size_t ring_sz, size_t rotate_sz, int keep, enum ns_conlog_compress compress) {
+    *c = (struct ns_conlog) {
+        .ring_sz = ring_sz,
+        .fd_log = -1,
+        .rotate_sz = rotate_sz,
+        .keep = keep,
+        .compress = compress,
+        .mu = PTHREAD_MUTEX_INITIALIZER,
+        .cv = PTHREAD_COND_INITIALIZER,
+    };
+    if (snprintf(c->dir, sizeof(c->dir), "%s", dir) >= (int)(sizeof(c->dir))) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        preserve_errno({
+            ns_perror_dbg("create log dir '%s'", dir);
+        });
+        return -1;
+    }
+
+    char path[320];
+    snprintf(path, sizeof(path), "%s/console.ring", dir);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        preserve_errno({
+            ns_perror_dbg("open console ring '%s'", path);
+        });
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        preserve_errno({
+            ns_perror_dbg("stat console ring");
+            close(fd);
+        });
+        return -1;
+    }
+
+    struct ns_conlog_ring *ring = MAP_FAILED;
+    size_t map_sz = sizeof(*ring) + ring_sz;
+    if ((size_t)(st.st_size) > sizeof(*ring)) {
+        // check for a leftover ring from an unclean exit
+        ring = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (ring != MAP_FAILED) {
+            if (!memcmp(ring->magic, "NSCONLOG", 8) && ring->size == st.st_size - sizeof(*ring) && ring->pos) {
+                c->ring = ring;
+                c->ring_sz = ring->size;
+                char snap[384];
+                if (ns_conlog_snapshot(c, "unclean", snap, sizeof(snap))) {
+                    ns_perror("warning: console log: failed to save ring from previous run");
+                } else {
+                    ns_log("console log: saved ring from previous run to '%s'", snap);
+                }
+                c->ring = NULL;
+                c->ring_sz = ring_sz;
+            }
+            munmap(ring, st.st_size);
+        }
+    }
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, map_sz) == -1) {
+        preserve_errno({
+            ns_perror_dbg("resize console ring");
+            close(fd);
+        });
+        return -1;
+    }
+    ring = mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ring == MAP_FAILED) {
+        preserve_errno({
+            ns_perror_dbg("map console ring");
+            close(fd);
+        });
+        return -1;
+    }
+    close(fd);
+    memcpy(ring->magic, "NSCONLOG", 8);
+    ring->size = ring_sz;
+    ring->pos = 0;
+    c->ring = ring;
+
+    if (rotate_sz) {
+        if (compress != NS_CONLOG_COMPRESS_NONE && ns_conlog_compress_load(compress)) {
+            c->compress = NS_CONLOG_COMPRESS_NONE;
+        }
+        if (ns_conlog_open_log(c)) {
+            preserve_errno({
+                ns_perror_dbg("open console log");
+                munmap(c->ring, map_sz);
+            });
+            return -1;
+        }
+
+        // don't let the helper thread steal signals meant for the signalfd
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        int err = pthread_create(&c->thread, NULL, ns_conlog_thread, c);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (err) {
+            ns_log("warning: console log: failed to start compression thread: %s", strerror(err));
+        } else {
+            c->thread_started = true;
+        }
+    }
+    return 0;
+}
+
+/** Appends console output to the ring and log. Returns -1 with errno set if the log couldn't be written. */
+static int ns_conlog_write(struct ns_conlog *c, const char *buf, size_t n) {
+    if (!c->ring) {
+        return 0;
+    }
+    size_t x = n > c->ring_sz ? n - c->ring_sz : 0;
+    size_t off = (c->ring->pos + x) % c->ring_sz;
+    size_t n1 = c->ring_sz - off < n - x ? c->ring_sz - off : n - x;
+    memcpy(c->ring->data + off, buf + x, n1);
+    memcpy(c->ring->data, buf + x + n1, n - x - n1);
+    c->ring->pos += n;
+
+    if (c->fd_log != -1) {
+        for (size_t i = 0; i < n;) {
+            ssize_t r = write(c->fd_log, buf + i, n - i);
+            if (r == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            i += r;
+        }
+        if ((c->log_sz += n) >= c->rotate_sz && ns_conlog_rotate(c)) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/** Stops the helper thread and unmaps the ring. If clean, the ring is marked as empty so it isn't saved next time. */
+static void ns_conlog_close(struct ns_conlog *c, bool clean) {
+    if (c->thread_started) {
+        pthread_mutex_lock(&c->mu);
+        c->thread_stop = true;
+        pthread_cond_signal(&c->cv);
+        pthread_mutex_unlock(&c->mu);
+        pthread_join(c->thread, NULL);
+    }
+    if (c->fd_log != -1) {
+        close(c->fd_log);
+    }
+    if (c->ring) {
+        if (clean) {
+            c->ring->pos = 0;
+        }
+        munmap(c->ring, sizeof(*c->ring) + c->ring_sz);
+    }
+}
+
+/** Reads a small file into buf, null-terminated. Returns the number of bytes read or -1 with errno set. */
+static ssize_t ns_read_file(const char *path, char *buf, size_t buf_sz) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    size_t n = 0;
+    while (n < buf_sz - 1) {
+        ssize_t r = read(fd, buf + n, buf_sz - 1 - n);
+        if (r == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            preserve_errno({
+                close(fd);
+            });
+            return -1;
+        }
+        if (r == 0) {
+            break;
+        }
+        n += r;
+    }
+    buf[n] = '\0';
+    close(fd);
+    return n;
+}
+
+/** Gets the parent pid from /proc/[pid]/stat, or -1 with errno set. */
+static pid_t ns_proc_ppid(pid_t pid) {
+    char path[32], buf[512];
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    if (ns_read_file(path, buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    char *p = strrchr(buf, ')'); // comm can contain anything
+    int ppid;
+    if (!p || sscanf(p, ") %*c %d", &ppid) != 1) {
+        errno = EPROTO;
+        return -1;
+    }
+    return ppid;
+}
+
+/**
+ * Finds the descendants of root (including root) and writes up to max of their pids to out, returning the number of
+ * pids found (which may be larger than max), or -1 with errno set.
+ */
+static ssize_t ns_proc_tree(pid_t root, pid_t *out, size_t max) {
+    DIR *d = opendir("/proc");
+    if (!d) {
+        return -1;
+    }
+
+    // note: since we're the subreaper, all orphaned processes end up as our children, so one level of parents is
+    // usually enough, but we'll follow the chain anyways in case something is nested deeper
+    pid_t pids[1024], ppids[1024];
+    size_t n = 0;
+    for (struct dirent *e; (e = readdir(d)) && n < sizeof(pids)/sizeof(*pids);) {
+        char *x;
+        long pid = strtol(e->d_name, &x, 10);
+        if (*x || pid <= 0) {
+            continue;
+        }
+        pid_t ppid = ns_proc_ppid(pid);
+        if (ppid == -1) {
+            continue; // probably exited
+        }
+        pids[n] = pid;
+        ppids[n] = ppid;
+        n++;
+    }
+    closedir(d);
+
+    size_t r = 0;
+    for (size_t i = 0; i < n; i++) {
+        pid_t p = pids[i];
+        for (int depth = 0; p > 1 && p != root && depth < 64; depth++) {
+            size_t j;
+            for (j = 0; j < n && pids[j] != p; j++) {
+                continue;
+            }
+            p = j < n ? ppids[j] : -1;
+        }
+        if (p == root) {
+            if (r < max) {
+                out[r] = pids[i];
+            }
+            r++;
+        }
+    }
+    return r;
+}
+
+/** Appends a /proc file to an output file, prefixed with a label. */
+static void ns_diag_dump_file(FILE *f, const char *label, const char *path) {
+    static char buf[65536];
+    if (ns_read_file(path, buf, sizeof(buf)) == -1) {
+        fprintf(f, "%s: (error: %m)\n", label);
+    } else if (strchr(buf, '\n') && strchr(buf, '\n')[1]) {
+        fprintf(f, "%s:\n%s%s", label, buf, buf[strlen(buf)-1] == '\n' ? "" : "\n");
+    } else {
+        fprintf(f, "%s: %s%s", label, buf, *buf && buf[strlen(buf)-1] == '\n' ? "" : "\n");
+    }
+}
+
+/** Checks if a CLOCK_MONOTONIC deadline has passed. */
+static bool ns_diag_expired(const struct timespec *deadline) {
+    struct timespec tc;
+    clock_gettime(CLOCK_MONOTONIC, &tc);
+    return tc.tv_sec > deadline->tv_sec || (tc.tv_sec == deadline->tv_sec && tc.tv_nsec >= deadline->tv_nsec);
+}
+
+/**
+ * Writes the state of every thread of every process in the tree starting at root (excluding nswrap itself), stopping
+ * early if the deadline passes (reading the kernel stack of a stuck thread can be slow).
+ */
+static int ns_diag_dump_proc(const char *path, pid_t root, const struct timespec *deadline) {
+    pid_t pids[256];
+    ssize_t n = ns_proc_tree(root, pids, sizeof(pids)/sizeof(*pids));
+    if (n == -1) {
+        return -1;
+    }
+    if ((size_t)(n) > sizeof(pids)/sizeof(*pids)) {
+        n = sizeof(pids)/sizeof(*pids);
+    }
+
+    FILE *f = fopen(path, "we");
+    if (!f) {
+        return -1;
+    }
+    for (ssize_t i = 0; i < n; i++) {
+        if (pids[i] == getpid()) {
+            continue;
+        }
+        if (ns_diag_expired(deadline)) {
+            fprintf(f, "==== (out of time)\n");
+            break;
+        }
+        char p[64];
+        fprintf(f, "==== process %d\n", pids[i]);
+        snprintf(p, sizeof(p), "/proc/%d/cmdline", pids[i]);
+        {
+            char buf[1024];
+            ssize_t m = ns_read_file(p, buf, sizeof(buf));
+            for (ssize_t j = 0; j < m; j++) {
+                if (!buf[j]) buf[j] = ' ';
+            }
+            fprintf(f, "cmdline: %s\n", m == -1 ? "(error)" : buf);
+        }
+        snprintf(p, sizeof(p), "/proc/%d/status", pids[i]);
+        ns_diag_dump_file(f, "status", p);
+
+        snprintf(p, sizeof(p), "/proc/%d/task", pids[i]);
+        DIR *d = opendir(p);
+        if (!d) {
+            fprintf(f, "tasks: (error: %m)\n\n");
+            continue;
+        }
+        for (struct dirent *e; (e = readdir(d));) {
+            if (*e->d_name == '.') {
+                continue;
+            }
+            if (ns_diag_expired(deadline)) {
+                fprintf(f, "---- (out of time)\n");
+                break;
+            }
+            fprintf(f, "---- task %s\n", e->d_name);
+            static const char *const files[] = {"comm", "stat", "schedstat", "wchan", "syscall", "stack"};
+            for (size_t j = 0; j < sizeof(files)/sizeof(*files); j++) {
+                snprintf(p, sizeof(p), "/proc/%d/task/%.16s/%s", pids[i], e->d_name, files[j]);
+                ns_diag_dump_file(f, files[j], p);
+            }
+        }
+        closedir(d);
+        fprintf(f, "\n");
+    }
+    if (fclose(f)) {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Waits up to timeout_ms for a signal on fd_signalfd (which must be non-blocking). SIGCHLD is discarded (children are
+ * reaped separately), but any other signal is returned so the caller can act on it instead of it being lost. Returns
+ * the signal number, 0 on SIGCHLD or timeout, or -1 with errno set.
+ */
+static int ns_signalfd_wait(int fd_signalfd, int timeout_ms) {
+    if (poll(&(struct pollfd) { .fd = fd_signalfd, .events = POLLIN }, 1, timeout_ms) == -1) {
+        return errno == EINTR ? 0 : -1;
+    }
+    struct signalfd_siginfo siginfo;
+    while (read(fd_signalfd, &siginfo, sizeof(siginfo)) > 0) {
+        if (siginfo.ssi_signo != SIGCHLD) {
+            return siginfo.ssi_signo;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Captures diagnostics about pid into dir within timeout_sec: the state of each thread of each child process (which
+ * includes the wineserver since we're the subreaper) from /proc, and the output of cmd (run with sh in dir with
+ * NSWRAP_DIAG_PID and NSWRAP_DIAG_DIR added to envp), if provided. The command is killed if it doesn't finish in time,
+ * or if SIGTERM or SIGINT is received (since we're about to exit anyway). SIGCHLD must be blocked and readable on
+ * fd_signalfd.
+ */
+static int ns_diag_capture(const char *dir, pid_t pid, const char *cmd, char *const *envp, int timeout_sec, int fd_signalfd) {
+    struct timespec ts, tc, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    deadline = (struct timespec) {
+        .tv_sec = ts.tv_sec + timeout_sec,
+        .tv_nsec = ts.tv_nsec,
+    };
+
+    if (mkdir(dir, 0755) == -1) {
+        return -1;
+    }
+
+    char path[512];
+    snprintf(path, sizeof(path), "%s/proc.txt", dir);
+    if (ns_diag_dump_proc(path, getpid(), &deadline)) {
+        ns_perror("warning: diagnostics: failed to dump process state");
+    }
+
+    if (!cmd || !*cmd) {
+        return 0;
+    }
+
+    size_t envp_n = 0;
+    while (envp[envp_n]) {
+        envp_n++;
+    }
+    char **cmd_envp = alloca(sizeof(char*) * (envp_n + 3));
+    char env_pid[32], env_dir[sizeof(path)];
+    snprintf(env_pid, sizeof(env_pid), "NSWRAP_DIAG_PID=%d", pid);
+    snprintf(env_dir, sizeof(env_dir), "NSWRAP_DIAG_DIR=%s", dir);
+    memcpy(cmd_envp, envp, sizeof(char*) * envp_n);
+    cmd_envp[envp_n] = env_pid;
+    cmd_envp[envp_n+1] = env_dir;
+    cmd_envp[envp_n+2] = NULL;
+
+    snprintf(path, sizeof(path), "%s/cmd.txt", dir);
+    int fd_out = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_out == -1) {
+        return -1;
+    }
+
+    pid_t cmd_pid = fork();
+    if (!cmd_pid) {
+        setpgid(0, 0);
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        dup2(open("/dev/null", O_RDONLY), 0);
+        dup2(fd_out, 1);
+        dup2(fd_out, 2);
+        if (chdir(dir) == 0) {
+            execve("/bin/sh", (char *[]) {"sh", "-c", (char *) (cmd), NULL}, cmd_envp);
+        }
+        _exit(127);
+    }
+    close(fd_out);
+    if (cmd_pid == -1) {
+        return -1;
+    }
+    setpgid(cmd_pid, cmd_pid);
+
+    for (;;) {
+        int st;
+        pid_t r = waitpid(cmd_pid, &st, WNOHANG);
+        if (r == cmd_pid) {
+            if (WIFEXITED(st) && WEXITSTATUS(st)) {
+                ns_log("warning: diagnostics: command exited with status %d", WEXITSTATUS(st));
+            } else if (WIFSIGNALED(st)) {
+                ns_log("warning: diagnostics: command killed by signal %d", WTERMSIG(st));
+            }
+            kill(-cmd_pid, SIGKILL); // in case it left anything behind
+            return 0;
+        }
+        if (r == -1 && errno != EINTR) {
+            return -1;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &tc);
+        int rem = timeout_sec * 1000 - (int)((tc.tv_sec - ts.tv_sec) * 1000 + (tc.tv_nsec - ts.tv_nsec) / 1000000);
+        if (rem <= 0) {
+            ns_log("warning: diagnostics: command did not finish within %ds; killing it", timeout_sec);
+            kill(-cmd_pid, SIGKILL);
+            waitpid(cmd_pid, NULL, 0);
+            return 0;
+        }
+        int sig = ns_signalfd_wait(fd_signalfd, rem);
+        if (sig == -1) {
+            preserve_errno({
+                kill(-cmd_pid, SIGKILL);
+                waitpid(cmd_pid, NULL, 0);
+            });
+            return -1;
+        }
+        if (sig == SIGTERM || sig == SIGINT) {
+            ns_log("received %s; killing diagnostics command", sig == SIGTERM ? "SIGTERM" : "SIGINT");
+            kill(-cmd_pid, SIGKILL);
+            waitpid(cmd_pid, NULL, 0);
+            return 0;
+        }
+        if (sig) {
+            ns_log("warning: unexpected signal %d; ignoring", sig);
+        }
+    }
+}
+
+/** A sampled thread in the profiled process tree. */
+struct ns_prof_thread {
+    pid_t pid;
+    pid_t tid;
+    char role[32];
+    char comm[17];
+    uint64_t gen;
+    uint64_t run_ns;
+    uint64_t wait_ns;
+    uint64_t nvcsw;
+    uint64_t vcsw;
+    double util_last;
+    double util;
+    double wait;
+    double nvcsw_rate;
+    double vcsw_rate;
+};
+
+/** Wineserver request statistics as sent by serverstats.patch. */
+struct ns_prof_req_header {
+    uint32_t magic;
+    uint32_t pid;
+    uint32_t count;
+    uint32_t reserved;
+};
+struct ns_prof_req_entry {
+    uint32_t req;
+    uint32_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint32_t buckets[NS_PROF_REQ_BUCKETS];
+};
+
+/** Aggregated wineserver request statistics for a request type in a process role. */
+struct ns_prof_req {
+    char role[32];
+    uint32_t req;
+    uint64_t count;
+    uint64_t count_interval;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t buckets[NS_PROF_REQ_BUCKETS];
+};
+
+/**
+ * Periodically samples the scheduler statistics of every thread of every process we're the parent of (i.e., wine,
+ * the wineserver, and xvfb, since we're the subreaper), and writes the rolling per-thread CPU usage, runqueue delay,
+ * and context switch rates to a file. It can also run perf for a short window on demand. If Wine has serverstats.patch,
+ * it also receives and aggregates the wineserver request counts and latencies reported by each process.
+ */
+struct ns_prof {
+    int timerfd;
+    char dir[256];
+    int perf_sec;
+    pid_t perf_pid;
+    char perf_path[320];
+    uint64_t gen;
+    struct timespec last;
+    struct ns_prof_thread *threads;
+    size_t threads_n;
+    const struct ns_cadence *cadence;
+    int sockfd;
+    char sock_env[300];
+    struct ns_prof_req *reqs;
+    size_t reqs_n;
+};
+
+/** Gets a short name for the role of a process based on its executable name. */
+static void ns_prof_role(pid_t pid, char *buf, size_t buf_sz) {
+    char path[32], cmdline[512];
+    snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+    if (ns_read_file(path, cmdline, sizeof(cmdline)) == -1) {
+        snprintf(buf, buf_sz, "?");
+        return;
+    }
+    const char *exe = cmdline;
+    for (const char *x = cmdline; *x; x++) {
+        if (*x == '/' || *x == '\\') {
+            exe = x + 1;
+        }
+    }
+    if (!strcmp(exe, "NorthstarLauncher.exe")) {
+        snprintf(buf, buf_sz, "server");
+    } else if (!strcmp(exe, "wineserver") || !strcmp(exe, "wineserver64")) {
+        snprintf(buf, buf_sz, "wineserver");
+    } else if (!strcmp(exe, "Xvfb")) {
+        snprintf(buf, buf_sz, "xvfb");
+    } else if (strlen(exe) > 4 && !strcasecmp(exe + strlen(exe) - 4, ".exe")) {
+        snprintf(buf, buf_sz, "wine:%.*s", (int)(strlen(exe) - 4), exe);
+    } else {
+        snprintf(buf, buf_sz, "%s", *exe ? exe : "?");
+    }
+}
+
+/** Reads the counters for a single thread. Returns 0 on success, or -1 if it couldn't be read (e.g., it exited). */
+static int ns_prof_read_thread(pid_t pid, pid_t tid, struct ns_prof_thread *t) {
+    static char buf[4096];
+    char path[64];
+
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/stat", pid, tid);
+    if (ns_read_file(path, buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    char *a = strchr(buf, '('), *b = strrchr(buf, ')'); // comm can contain anything
+    unsigned long utime, stime;
+    if (!a || !b || sscanf(b, ") %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) != 2) {
+        return -1;
+    }
+    snprintf(t->comm, sizeof(t->comm), "%.*s", (int)(b - a - 1), a + 1);
+
+    // schedstat is only available with CONFIG_SCHED_INFO, but it has ns precision and the runqueue delay
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/schedstat", pid, tid);
+    unsigned long long run_ns, wait_ns;
+    if (ns_read_file(path, buf, sizeof(buf)) != -1 && sscanf(buf, "%llu %llu", &run_ns, &wait_ns) == 2) {
+        t->run_ns = run_ns;
+        t->wait_ns = wait_ns;
+    } else {
+        t->run_ns = (uint64_t)(utime + stime) * (1000000000 / sysconf(_SC_CLK_TCK));
+        t->wait_ns = 0;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/status", pid, tid);
+    if (ns_read_file(path, buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    char *x;
+    if ((x = strstr(buf, "\nvoluntary_ctxt_switches:"))) {
+        t->vcsw = strtoull(x + strlen("\nvoluntary_ctxt_switches:"), NULL, 10);
+    }
+    if ((x = strstr(buf, "\nnonvoluntary_ctxt_switches:"))) {
+        t->nvcsw = strtoull(x + strlen("\nnonvoluntary_ctxt_switches:"), NULL, 10);
+    }
+    return 0;
+}
+
+/** Sorts threads by descending rolling CPU usage. */
+static int ns_prof_cmp(const void *a, const void *b) {
+    const struct ns_prof_thread *x = a, *y = b;
+    return (x->util < y->util) - (x->util > y->util);
+}
+
+/** Writes the current statistics to threads.txt in the profile dir, replacing it atomically. */
+static int ns_prof_write(struct ns_prof *p, double interval) {
+    char path[320], tmp[328];
+    snprintf(path, sizeof(path), "%s/threads.txt", p->dir);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *f = fopen(tmp, "we");
+    if (!f) {
+        return -1;
+    }
+    fprintf(f, "# interval %.3fs, rolling over %ds\n", interval, NS_PROF_ROLLING_SEC);
+    if (p->cadence) {
+        char buf[256];
+        ns_cadence_str(p->cadence, buf, sizeof(buf));
+        fprintf(f, "# title cadence: %s\n", buf);
+    }
+    fprintf(f, "# cpu%% is the last interval, ~ is rolling, runq is ms of runqueue delay per s, csw/s is nonvoluntary/voluntary\n");
+    fprintf(f, "\n%-16s %8s %8s %8s %8s %17s\n", "role", "threads", "cpu%", "cpu%~", "runq~", "csw/s~");
+    for (size_t i = 0; i < p->threads_n; i++) {
+        size_t j;
+        for (j = 0; j < i && strcmp(p->threads[j].role, p->threads[i].role); j++) {
+            continue;
+        }
+        if (j != i) {
+            continue; // already shown
+        }
+        int n = 0;
+        double util_last = 0, util = 0, wait = 0, nvcsw = 0, vcsw = 0;
+        for (j = i; j < p->threads_n; j++) {
+            struct ns_prof_thread *t = &p->threads[j];
+            if (!strcmp(t->role, p->threads[i].role)) {
+                n++;
+                util_last += t->util_last;
+                util += t->util;
+                wait += t->wait;
+                nvcsw += t->nvcsw_rate;
+                vcsw += t->vcsw_rate;
+            }
+        }
+        fprintf(f, "%-16s %8d %8.1f %8.1f %8.1f %8.0f/%-8.0f\n", p->threads[i].role, n, util_last * 100, util * 100, wait * 1000, nvcsw, vcsw);
+    }
+    fprintf(f, "\n%-16s %8s %-16s %8s %8s %8s %17s\n", "role", "tid", "comm", "cpu%", "cpu%~", "runq~", "csw/s~");
+    for (size_t i = 0; i < p->threads_n; i++) {
+        struct ns_prof_thread *t = &p->threads[i];
+        fprintf(f, "%-16s %8d %-16s %8.1f %8.1f %8.1f %8.0f/%-8.0f\n", t->role, t->tid, t->comm, t->util_last * 100, t->util * 100, t->wait * 1000, t->nvcsw_rate, t->vcsw_rate);
+    }
+    if (fclose(f)) {
+        preserve_errno({
+            unlink(tmp);
+        });
+        return -1;
+    }
+    return rename(tmp, path);
+}
+
+/** Receives pending wineserver request statistics. Returns 0 on success, or -1 with errno set. */
+static int ns_prof_recv(struct ns_prof *p) {
+    static char buf[sizeof(struct ns_prof_req_header) + 2048 * sizeof(struct ns_prof_req_entry)];
+    for (;;) {
+        ssize_t n = recv(p->sockfd, buf, sizeof(buf), MSG_DONTWAIT);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        }
+        struct ns_prof_req_header hdr;
+        if ((size_t)(n) < sizeof(hdr)) {
+            continue;
+        }
+        memcpy(&hdr, buf, sizeof(hdr));
+        if (hdr.magic != NS_PROF_REQ_MAGIC || (size_t)(n) < sizeof(hdr) + hdr.count * sizeof(struct ns_prof_req_entry)) {
+            continue;
+        }
+        char role[sizeof(p->reqs->role)];
+        ns_prof_role(hdr.pid, role, sizeof(role));
+
+        for (uint32_t i = 0; i < hdr.count; i++) {
+            struct ns_prof_req_entry e;
+            memcpy(&e, buf + sizeof(hdr) + i * sizeof(e), sizeof(e));
+
+            size_t j;
+            for (j = 0; j < p->reqs_n && (p->reqs[j].req != e.req || strcmp(p->reqs[j].role, role)); j++) {
+                continue;
+            }
+            if (j == p->reqs_n) {
+                if (j == NS_PROF_MAX_REQS) {
+                    continue;
+                }
+                p->reqs[p->reqs_n++] = (struct ns_prof_req) {
+                    .req = e.req,
+                };
+                snprintf(p->reqs[j].role, sizeof(p->reqs[j].role), "%s", role);
+            }
+            struct ns_prof_req *r = &p->reqs[j];
+            r->count += e.count;
+            r->count_interval += e.count;
+            r->sum_ns += e.sum_ns;
+            if (e.max_ns > r->max_ns) {
+                r->max_ns = e.max_ns;
+            }
+            for (size_t k = 0; k < NS_PROF_REQ_BUCKETS; k++) {
+                r->buckets[k] += e.buckets[k];
+            }
+        }
+    }
+}
+
+/** Estimates the q-th quantile of a request's latency in microseconds (the upper bound of the bucket it falls in). */
+static double ns_prof_req_quantile(const struct ns_prof_req *r, double q) {
+    uint64_t n = 0, t = (uint64_t)(r->count * q);
+    for (size_t i = 0; i < NS_PROF_REQ_BUCKETS - 1; i++) {
+        if ((n += r->buckets[i]) > t) {
+            double us = (double)(2ULL << i);
+            return us < r->max_ns / 1e3 ? us : r->max_ns / 1e3;
+        }
+    }
+    return r->max_ns / 1e3;
+}
+
+/** Sorts requests by descending total time. */
+static int ns_prof_req_cmp(const void *a, const void *b) {
+    const struct ns_prof_req *x = a, *y = b;
+    return (x->sum_ns < y->sum_ns) - (x->sum_ns > y->sum_ns);
+}
+
+/** Writes the wineserver request statistics to server-calls.txt in the profile dir, replacing it atomically. */
+static int ns_prof_write_reqs(struct ns_prof *p, double interval) {
+    char path[320], tmp[328];
+    snprintf(path, sizeof(path), "%s/server-calls.txt", p->dir);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    qsort(p->reqs, p->reqs_n, sizeof(*p->reqs), ns_prof_req_cmp);
+
+    FILE *f = fopen(tmp, "we");
+    if (!f) {
+        return -1;
+    }
+    fprintf(f, "# wineserver requests since startup by total time; req is the index in enum request in Wine's include/wine/server_protocol.h\n");
+    fprintf(f, "# calls/s is the last interval, latencies are in us, and percentiles are bucket upper bounds\n");
+    fprintf(f, "\n%-16s %6s %12s %10s %12s %8s %8s %8s %10s\n", "role", "req", "calls", "calls/s", "total-ms", "avg", "p50", "p99", "max");
+    for (size_t i = 0; i < p->reqs_n; i++) {
+        struct ns_prof_req *r = &p->reqs[i];
+        fprintf(f, "%-16s %6u %12llu %10.0f %12.1f %8.1f %8.0f %8.0f %10.1f\n",
+            r->role, r->req, (unsigned long long)(r->count), interval > 0 ? r->count_interval / interval : 0,
+            r->sum_ns / 1e6, r->count ? r->sum_ns / 1e3 / r->count : 0,
+            ns_prof_req_quantile(r, 0.50), ns_prof_req_quantile(r, 0.99), r->max_ns / 1e3);
+        r->count_interval = 0;
+    }
+    if (fclose(f)) {
+        preserve_errno({
+            unlink(tmp);
+        });
+        return -1;
+    }
+    return rename(tmp, path);
+}
+
+/** Samples every thread and updates the statistics. Returns 0 on success, or -1 with errno set. */
+static int ns_prof_sample(struct ns_prof *p) {
+    struct timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == -1) {
+        return -1;
+    }
+    double dt = p->gen ? (now.tv_sec - p->last.tv_sec) + (now.tv_nsec - p->last.tv_nsec) / 1e9 : 0;
+    double a = dt / (dt + NS_PROF_ROLLING_SEC); // approximately an exponential moving average
+    p->last = now;
+    p->gen++;
+
+    pid_t pids[256];
+    ssize_t pids_n = ns_proc_tree(getpid(), pids, sizeof(pids)/sizeof(*pids));
+    if (pids_n == -1) {
+        return -1;
+    }
+    if ((size_t)(pids_n) > sizeof(pids)/sizeof(*pids)) {
+        pids_n = sizeof(pids)/sizeof(*pids);
+    }
+    for (ssize_t i = 0; i < pids_n; i++) {
+        if (pids[i] == getpid()) {
+            continue;
+        }
+        char role[sizeof(p->threads->role)];
+        ns_prof_role(pids[i], role, sizeof(role));
+
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/%d/task", pids[i]);
+        DIR *d = opendir(path);
+        if (!d) {
+            continue; // probably exited
+        }
+        for (struct dirent *e; (e = readdir(d));) {
+            char *x;
+            long tid = strtol(e->d_name, &x, 10);
+            if (*x || tid <= 0) {
+                continue;
+            }
+            size_t j;
+            for (j = 0; j < p->threads_n && p->threads[j].tid != tid; j++) {
+                continue;
+            }
+            if (j == p->threads_n) {
+                if (j == NS_PROF_MAX_THREADS) {
+                    continue;
+                }
+                p->threads_n++;
+                p->threads[j] = (struct ns_prof_thread) {
+                    .pid = pids[i],
+                    .tid = tid,
+                };
+                if (ns_prof_read_thread(pids[i], tid, &p->threads[j])) {
+                    p->threads_n--;
+                    continue;
+                }
+            } else {
+                struct ns_prof_thread *t = &p->threads[j], c = *t;
+                if (ns_prof_read_thread(pids[i], tid, &c)) {
+                    continue;
+                }
+                if (dt > 0) {
+                    c.util_last = (c.run_ns - t->run_ns) / 1e9 / dt;
+                    c.util += a * (c.util_last - t->util);
+                    c.wait += a * ((c.wait_ns - t->wait_ns) / 1e9 / dt - t->wait);
+                    c.nvcsw_rate += a * ((c.nvcsw - t->nvcsw) / dt - t->nvcsw_rate);
+                    c.vcsw_rate += a * ((c.vcsw - t->vcsw) / dt - t->vcsw_rate);
+                }
+                *t = c;
+            }
+            snprintf(p->threads[j].role, sizeof(p->threads[j].role), "%s", role);
+            p->threads[j].gen = p->gen;
+        }
+        closedir(d);
+    }
+
+    // remove threads which have exited
+    size_t n = 0;
+    for (size_t i = 0; i < p->threads_n; i++) {
+        if (p->threads[i].gen == p->gen) {
+            p->threads[n++] = p->threads[i];
+        }
+    }
+    p->threads_n = n;
+
+    qsort(p->threads, p->threads_n, sizeof(*p->threads), ns_prof_cmp);
+    if (p->reqs_n && ns_prof_write_reqs(p, dt)) {
+        return -1;
+    }
+    return ns_prof_write(p, dt);
+}
+
+/**
+ * Initializes a ns_prof, writing statistics to dir every interval_ms. If perf_sec is nonzero, ns_prof_perf can be
+ * used to record stacks using perf for that long. Returns 0 on success, or -1 with errno set. The environment variable
+ * in sock_env (if not empty) must be passed to Wine for it to report wineserver request statistics.
+ */
+static int ns_prof_init(struct ns_prof *p, const char *dir, int interval_ms, int perf_sec) {
+    *p = (struct ns_prof) {
+        .timerfd = -1,
+        .sockfd = -1,
+        .perf_sec = perf_sec,
+        .perf_pid = -1,
+    };
+    if (strlen(dir) >= sizeof(p->dir)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(p->dir, dir);
+    if (mkdir(dir, 0755) == -1 && errno != EEXIST) {
+        preserve_errno({
+            ns_perror_dbg("create profile dir");
+        });
+        return -1;
+    }
+    if (!(p->threads = calloc(NS_PROF_MAX_THREADS, sizeof(*p->threads))) || !(p->reqs = calloc(NS_PROF_MAX_REQS, sizeof(*p->reqs)))) {
+        preserve_errno({
+            free(p->threads);
+        });
+        return -1;
+    }
+
+    struct sockaddr_un addr = {
+        .sun_family = AF_UNIX,
+    };
+    if (snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/server.sock", dir) >= (int)(sizeof(addr.sun_path))) {
+        ns_log("warning: profile: dir path is too long for the wineserver stats socket; request statistics will not be available");
+    } else if ((p->sockfd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) == -1) {
+        ns_perror("warning: profile: create wineserver stats socket");
+    } else if (unlink(addr.sun_path), bind(p->sockfd, (struct sockaddr*) &addr, sizeof(addr)) == -1) {
+        ns_perror("warning: profile: bind wineserver stats socket");
+        close(p->sockfd);
+        p->sockfd = -1;
+    } else {
+        setsockopt(p->sockfd, SOL_SOCKET, SO_RCVBUF, &(int){1024 * 1024}, sizeof(int));
+        snprintf(p->sock_env, sizeof(p->sock_env), "WINESERVERSTATS=%s", addr.sun_path);
+    }
+
+    if ((p->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK)) == -1) {
+        preserve_errno({
+            ns_perror_dbg("create timerfd");
+            if (p->sockfd != -1) close(p->sockfd);
+            free(p->threads);
+            free(p->reqs);
+        });
+        return -1;
+    }
+    struct timespec iv = {
+        .tv_sec = interval_ms / 1000,
+        .tv_nsec = (interval_ms % 1000) * 1000000L,
+    };
+    if (timerfd_settime(p->timerfd, 0, &(struct itimerspec) {
+        .it_value = iv,
+        .it_interval = iv,
+    }, NULL) == -1) {
+        preserve_errno({
+            ns_perror_dbg("set timerfd");
+            close(p->timerfd);
+            if (p->sockfd != -1) close(p->sockfd);
+            free(p->threads);
+            free(p->reqs);
+        });
+        return -1;
+    }
+    return 0;
+}
+
+/** Stops the sampling timer and interrupts perf if it is running. */
+static void ns_prof_close(struct ns_prof *p) {
+    if (p->timerfd != -1) {
+        close(p->timerfd);
+        free(p->threads);
+        free(p->reqs);
+    }
+    if (p->sockfd != -1) {
+        char path[sizeof(p->sock_env)];
+        snprintf(path, sizeof(path), "%s/server.sock", p->dir);
+        unlink(path);
+        close(p->sockfd);
+    }
+    if (p->perf_pid != -1) {
+        kill(-p->perf_pid, SIGINT); // let it finish writing the data
+    }
+}
+
+/** Adds the profiler to the epoll file descriptor. */
+static int ns_prof_epoll_add(struct ns_prof *p, int fd) {
+    if (p->sockfd != -1 && epoll_ctl(fd, EPOLL_CTL_ADD, p->sockfd, &(struct epoll_event) {
+        .events = EPOLLIN,
+        .data.fd = p->sockfd,
+    })) {
+        return -1;
+    }
+    return epoll_ctl(fd, EPOLL_CTL_ADD, p->timerfd, &(struct epoll_event) {
+        .events = EPOLLIN,
+        .data.fd = p->timerfd,
+    });
+}
+
+/** Checks if an epoll event matches the profiler. */
+static bool ns_prof_epoll_check(struct ns_prof *p, struct epoll_event ev) {
+    return p->timerfd != -1 && (ev.data.fd == p->timerfd || (p->sockfd != -1 && ev.data.fd == p->sockfd));
+}
+
+/** Processes an epoll event. Returns 0 on success, or -1 with errno set. */
+static int ns_prof_epoll_process(struct ns_prof *p, struct epoll_event ev) {
+    if (ev.data.fd == p->sockfd) {
+        return ns_prof_recv(p);
+    }
+    uint64_t v;
+    if (read(p->timerfd, &v, sizeof(v)) == -1 && errno != EAGAIN) {
+        return -1;
+    }
+    return ns_prof_sample(p);
+}
+
+/**
+ * Starts recording stacks for every process in the tree with perf in the background. Returns 0 on success, or -1 with
+ * errno set (EBUSY if it is already running, ENOTSUP if disabled). The pid must be passed to ns_prof_perf_reaped
+ * once it exits.
+ */
+static int ns_prof_perf(struct ns_prof *p) {
+    if (p->timerfd == -1 || !p->perf_sec) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (p->perf_pid != -1) {
+        errno = EBUSY;
+        return -1;
+    }
+
+    char pidlist[2048] = "";
+    pid_t pids[256];
+    ssize_t pids_n = ns_proc_tree(getpid(), pids, sizeof(pids)/sizeof(*pids));
+    if (pids_n == -1) {
+        return -1;
+    }
+    if ((size_t)(pids_n) > sizeof(pids)/sizeof(*pids)) {
+        pids_n = sizeof(pids)/sizeof(*pids);
+    }
+    for (ssize_t i = 0, n = 0; i < pids_n; i++) {
+        if (pids[i] != getpid() && n < (ssize_t)(sizeof(pidlist)) - 16) {
+            n += snprintf(pidlist + n, sizeof(pidlist) - n, "%s%d", n ? "," : "", pids[i]);
+        }
+    }
+    if (!*pidlist) {
+        errno = ESRCH;
+        return -1;
+    }
+
+    char ts[32], sec[16], log[sizeof(p->perf_path) + 4];
+    ns_conlog_timestamp(ts, sizeof(ts));
+    snprintf(p->perf_path, sizeof(p->perf_path), "%s/perf-%s.data", p->dir, ts);
+    snprintf(log, sizeof(log), "%s.log", p->perf_path);
+    snprintf(sec, sizeof(sec), "%d", p->perf_sec);
+
+    int fd_out = open(log, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd_out == -1) {
+        return -1;
+    }
+    pid_t pid = fork();
+    if (!pid) {
+        setpgid(0, 0);
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+        dup2(open("/dev/null", O_RDONLY), 0);
+        dup2(fd_out, 1);
+        dup2(fd_out, 2);
+        execvp("perf", (char *[]) {"perf", "record", "-F", "99", "-g", "-o", p->perf_path, "-p", pidlist, "--", "sleep", sec, NULL});
+        fprintf(stderr, "exec perf: %m\n");
+        _exit(127);
+    }
+    preserve_errno({
+        close(fd_out);
+    });
+    if (pid == -1) {
+        return -1;
+    }
+    setpgid(pid, pid);
+    p->perf_pid = pid;
+    return 0;
+}
+
+/** Checks if pid is the perf process, and if so, logs the result. The caller must still reap it. */
+static bool ns_prof_perf_reaped(struct ns_prof *p, pid_t pid, int code, int status) {
+    if (p->perf_pid == -1 || pid != p->perf_pid) {
+        return false;
+    }
+    if (code == CLD_EXITED && status == 0) {
+        ns_log("profile: saved perf data to '%s'", p->perf_path);
+    } else if (code == CLD_EXITED) {
+        ns_log("warning: profile: perf exited with status %d; see '%s.log'", status, p->perf_path);
+    } else {
+        ns_log("warning: profile: perf killed by signal %d", status);
+    }
+    p->perf_pid = -1;
+    return true;
+}
+
+/** Reads console commands (one per line) from an inherited fd and writes them to the server console. */
+struct ns_conin {
+    int fd;
+    int fd_epoll;
+    size_t n;
+    bool discard;
+    bool blocked; // the console input queue is full, so fd was removed from the epoll until it has room again
+    char buf[NS_IOPROC_OUTPUT_CHUNK_SIZE * 4];
+};
+
+/** Initializes a ns_conin reading from fd, which is made non-blocking and close-on-exec. */
+static int ns_conin_init(struct ns_conin *c, int fd) {
+    int fl = fcntl(fd, F_GETFL);
+    if (fl == -1 || fcntl(fd, F_SETFL, fl | O_NONBLOCK) == -1 || fcntl(fd, F_SETFD, FD_CLOEXEC) == -1) {
+        preserve_errno({
+            ns_perror_dbg("set console input fd flags");
+        });
+        return -1;
+    }
+    *c = (struct ns_conin) {
+        .fd = fd,
+        .fd_epoll = -1,
+    };
+    return 0;
+}
+
+static void ns_conin_close(struct ns_conin *c) {
+    if (c->fd != -1) {
+        close(c->fd);
+        c->fd = -1;
+    }
+}
+
+static int ns_conin_epoll_add(struct ns_conin *c, int fd) {
+    c->fd_epoll = fd;
+    return epoll_ctl(fd, EPOLL_CTL_ADD, c->fd, &(struct epoll_event) {
+        .events = EPOLLIN,
+        .data.fd = c->fd,
+    });
+}
+
+static bool ns_conin_epoll_check(struct ns_conin *c, struct epoll_event ev) {
+    return c->fd != -1 && ev.data.fd == c->fd;
+}
+
+/**
+ * Writes each complete buffered line to the console and logs it. If the console input queue is full, the remaining
+ * lines are kept, and the fd is removed from the epoll so the writer blocks instead of lines being lost.
+ */
+static int ns_conin_lines(struct ns_conin *c, struct ns_ioproc *p) {
+    char *l = c->buf, *e;
+    while ((e = memchr(l, '\n', c->buf + c->n - l))) {
+        if (c->discard) {
+            c->discard = false;
+        } else if (e != l) {
+            if (ns_ioproc_input(p, l, e - l + 1)) {
+                if (errno != EAGAIN) {
+                    ns_perror("warning: failed to write console input");
+                } else if (epoll_ctl(c->fd_epoll, EPOLL_CTL_DEL, c->fd, NULL)) {
+                    return -1;
+                } else {
+                    c->blocked = true;
+                    break;
+                }
+            } else {
+                ns_log("console input: %.*s", (int)(e - l), l);
+            }
+        }
+        l = e + 1;
+    }
+    c->n -= l - c->buf;
+    memmove(c->buf, l, c->n);
+
+    if (c->n == sizeof(c->buf) && !c->blocked) {
+        ns_log("warning: console input line too long; discarding it");
+        c->n = 0;
+        c->discard = true;
+    }
+    return 0;
+}
+
+/**
+ * Processes an epoll event, writing each complete line to the console and logging it (note that carriage returns are
+ * ignored by the pty). At EOF, the fd is closed (which also removes it from the epoll). Returns -1 with errno set on error.
+ */
+static int ns_conin_epoll_process(struct ns_conin *c, struct ns_ioproc *p) {
+    ssize_t r = read(c->fd, c->buf + c->n, sizeof(c->buf) - c->n);
+    if (r == -1) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    if (r == 0) {
+        ns_log("console input closed");
+        ns_conin_close(c);
+        return 0;
+    }
+    c->n += r;
+    return ns_conin_lines(c, p);
+}
+
+/**
+ * Writes the lines left over after the console input queue was full, and starts reading from the fd again if they all
+ * fit. This should be called whenever the queue may have room again. Returns -1 with errno set on error.
+ */
+static int ns_conin_resume(struct ns_conin *c, struct ns_ioproc *p) {
+    if (c->fd == -1 || !c->blocked) {
+        return 0;
+    }
+    c->blocked = false;
+    if (ns_conin_lines(c, p)) {
+        return -1;
+    }
+    if (!c->blocked) {
+        return ns_conin_epoll_add(c, c->fd_epoll);
+    }
+    return 0;
+}
+
+/** Traffic counters for the network namespace. */
+struct ns_netstat_sample {
+    struct timespec t;
+    uint64_t rx_bytes, rx_packets, tx_bytes, tx_packets;
+    uint64_t udp_in, udp_out, tcp_in, tcp_out;
+};
+
+/**
+ * Periodically logs the traffic of the network namespace (i.e., the container, unless it's using host networking)
+ * alongside the player count from the last title update.
+ */
+struct ns_netstat {
+    int timerfd;
+    struct ns_netstat_sample last;
+    char title[NS_IOPROC_OUTPUT_CHUNK_SIZE + 1];
+    char buf[320];
+};
+
+/** Gets the value of the named column of a /proc/net/snmp table (e.g., "Udp:"). */
+static bool ns_netstat_snmp(const char *snmp, const char *table, const char *col, uint64_t *out) {
+    size_t tl = strlen(table);
+    const char *hdr = NULL;
+    for (const char *l = snmp; l && *l; l = strchr(l, '\n') ? strchr(l, '\n') + 1 : NULL) {
+        if (strncmp(l, table, tl)) {
+            continue;
+        }
+        if (!hdr) {
+            hdr = l;
+            continue;
+        }
+        // find the index of the column in the header, then skip that many values
+        int i = 0;
+        bool found = false;
+        for (const char *x = hdr + tl; *x && *x != '\n'; i++) {
+            x += strspn(x, " ");
+            size_t n = strcspn(x, " \n");
+            if (n == strlen(col) && !strncmp(x, col, n)) {
+                found = true;
+                break;
+            }
+            x += n;
+        }
+        if (!found) {
+            return false;
+        }
+        const char *v = l + tl;
+        for (; i; i--) {
+            v += strspn(v, " ");
+            v += strcspn(v, " \n");
+        }
+        *out = strtoull(v, NULL, 10);
+        return true;
+    }
+    return false;
+}
+
+/** Reads the counters from /proc/self/net. Returns 0 on success, or -1 with errno set. */
+static int ns_netstat_read(struct ns_netstat_sample *s) {
+    char buf[8192];
+    *s = (struct ns_netstat_sample) {};
+    if (clock_gettime(CLOCK_MONOTONIC, &s->t)) {
+        return -1;
+    }
+    if (ns_read_file("/proc/self/net/dev", buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    for (char *l = buf; l; l = strchr(l, '\n') ? strchr(l, '\n') + 1 : NULL) {
+        char ifname[32];
+        unsigned long long v[16];
+        if (sscanf(l, " %31[^:]: %llu %llu %llu %llu %llu %llu %llu %llu %llu %llu",
+            ifname, &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8], &v[9]) != 11) {
+            continue;
+        }
+        if (!strcmp(ifname, "lo")) {
+            continue;
+        }
+        s->rx_bytes += v[0];
+        s->rx_packets += v[1];
+        s->tx_bytes += v[8];
+        s->tx_packets += v[9];
+    }
+    if (ns_read_file("/proc/self/net/snmp", buf, sizeof(buf)) == -1) {
+        return -1;
+    }
+    ns_netstat_snmp(buf, "Udp:", "InDatagrams", &s->udp_in);
+    ns_netstat_snmp(buf, "Udp:", "OutDatagrams", &s->udp_out);
+    ns_netstat_snmp(buf, "Tcp:", "InSegs", &s->tcp_in);
+    ns_netstat_snmp(buf, "Tcp:", "OutSegs", &s->tcp_out);
+    return 0;
+}
+
+/** Initializes a ns_netstat which logs every interval_sec. Returns 0 on success, or -1 with errno set. */
+static int ns_netstat_init(struct ns_netstat *n, int interval_sec) {
+    *n = (struct ns_netstat) {
+        .timerfd = -1,
+    };
+    if (ns_netstat_read(&n->last)) {
+        preserve_errno({
+            ns_perror_dbg("read network counters");
+        });
+        return -1;
+    }
+    n->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (n->timerfd == -1) {
+        preserve_errno({
+            ns_perror_dbg("create timerfd");
+        });
+        return -1;
+    }
+    if (timerfd_settime(n->timerfd, 0, &(struct itimerspec) {
+        .it_value.tv_sec = interval_sec,
+        .it_interval.tv_sec = interval_sec,
+    }, NULL) == -1) {
+        preserve_errno({
+            ns_perror_dbg("set timerfd");
+            close(n->timerfd);
+            n->timerfd = -1;
+        });
+        return -1;
+    }
+    return 0;
+}
+
+/** Frees the timerfd. */
+static void ns_netstat_close(struct ns_netstat *n) {
+    if (n->timerfd != -1) {
+        close(n->timerfd);
+        n->timerfd = -1;
+    }
+}
+
+/** Saves the latest title for the player count. */
+static void ns_netstat_title(struct ns_netstat *n, const char *title) {
+    if (n->timerfd != -1) {
+        size_t l = strnlen(title, sizeof(n->title) - 1);
+        memcpy(n->title, title, l);
+        n->title[l] = '\0';
+    }
+}
+
+/** Adds the netstat timer to the epoll file descriptor. */
+static int ns_netstat_epoll_add(struct ns_netstat *n, int fd) {
+    return epoll_ctl(fd, EPOLL_CTL_ADD, n->timerfd, &(struct epoll_event) {
+        .events = EPOLLIN,
+        .data.fd = n->timerfd,
+    });
+}
+
+/** Checks if an epoll event matches the netstat timer. */
+static bool ns_netstat_epoll_check(struct ns_netstat *n, struct epoll_event ev) {
+    return n->timerfd != -1 && ev.data.fd == n->timerfd;
+}
+
+/** Processes an epoll event and returns the line to log, or NULL with errno set. */
+static const char *ns_netstat_epoll_process(struct ns_netstat *n) {
+    uint64_t v;
+    if (read(n->timerfd, &v, sizeof(v)) == -1) {
+        return NULL;
+    }
+    struct ns_netstat_sample s;
+    if (ns_netstat_read(&s)) {
+        return NULL;
+    }
+    double dt = (s.t.tv_sec - n->last.t.tv_sec) + (s.t.tv_nsec - n->last.t.tv_nsec) / 1e9;
+    if (dt <= 0) {
+        dt = 1;
+    }
+    #define rate(x) ((double)(s.x - n->last.x) / dt)
+    struct ns_status st;
+    char players[64] = "? players";
+    double per_player = 0;
+    if (*n->title && !ns_status_parse(&st, n->title)) {
+        snprintf(players, sizeof(players), "%d/%d players", st.player_count, st.max_players);
+        if (st.player_count > 0) {
+            per_player = rate(tx_bytes) * 8 / 1e6 / st.player_count;
+        }
+    }
+    int m = snprintf(n->buf, sizeof(n->buf), "%s | udp %.0f/%.0f pkt/s in/out | tcp %.0f/%.0f seg/s in/out | net %.2f/%.2f Mbit/s rx/tx, %.0f/%.0f pkt/s",
+        players, rate(udp_in), rate(udp_out), rate(tcp_in), rate(tcp_out),
+        rate(rx_bytes) * 8 / 1e6, rate(tx_bytes) * 8 / 1e6, rate(rx_packets), rate(tx_packets));
+    if (per_player && m > 0 && (size_t) m < sizeof(n->buf)) {
+        snprintf(n->buf + m, sizeof(n->buf) - m, " (%.2f Mbit/s tx per player)", per_player);
+    }
+    #undef rate
+    n->last = s;
+    return n->buf;
+}
+
+/**
+ * Reads the Wine and game modules into the page cache in the background, so they aren't loaded from disk a page fault
+ * at a time while Wine starts (which is slow on a fresh node or with network storage).
+ */
+struct ns_preload {
+    const char *dirs[4];
+    size_t files;
+    size_t bytes;
+};
+
+/** Checks if a file name looks like something the Wine loader maps. */
+static bool ns_preload_match(const char *name) {
+    static const char *const ext[] = { ".dll", ".exe", ".so", ".drv", ".sys", ".nls" };
+    const char *x = strrchr(name, '.');
+    if (x) {
+        for (size_t i = 0; i < sizeof(ext)/sizeof(*ext); i++) {
+            if (!strcasecmp(x, ext[i])) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+/** Recursively reads ahead matching files in dirfd, which is closed. */
+static void ns_preload_dir(struct ns_preload *p, int dirfd, int depth) {
+    DIR *d = fdopendir(dirfd);
+    if (!d) {
+        close(dirfd);
+        return;
+    }
+    for (struct dirent *e; (e = readdir(d));) {
+        if (*e->d_name == '.') {
+            continue;
+        }
+        if (e->d_type == DT_DIR) {
+            if (depth) {
+                int fd = openat(dirfd, e->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+                if (fd != -1) {
+                    ns_preload_dir(p, fd, depth - 1);
+                }
+            }
+            continue;
+        }
+        if ((e->d_type != DT_REG && e->d_type != DT_LNK && e->d_type != DT_UNKNOWN) || !ns_preload_match(e->d_name)) {
+            continue;
+        }
+        int fd = openat(dirfd, e->d_name, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            continue;
+        }
+        struct stat st;
+        if (!fstat(fd, &st) && S_ISREG(st.st_mode) && (!readahead(fd, 0, st.st_size) || !posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED))) {
+            p->files++;
+            p->bytes += st.st_size;
+        }
+        close(fd);
+    }
+    closedir(d);
+}
+
+static void *ns_preload_thread(void *arg) {
+    struct ns_preload *p = arg;
+    struct timespec ts1, ts2;
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    for (size_t i = 0; i < sizeof(p->dirs)/sizeof(*p->dirs) && p->dirs[i]; i++) {
+        int fd = open(p->dirs[i], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd != -1) {
+            ns_preload_dir(p, fd, 4);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    ns_log("preload: read ahead %zu files (%.1f MiB) in %.0fms", p->files, p->bytes / 1048576.0, (ts2.tv_sec - ts1.tv_sec) * 1e3 + (ts2.tv_nsec - ts1.tv_nsec) / 1e6);
+    return NULL;
+}
+
+/** Starts reading ahead the modules in the provided directories (up to 4) in a detached thread. */
+static int ns_preload_start(struct ns_preload *p, const char *const *dirs, size_t n) {
+    *p = (struct ns_preload) {};
+    for (size_t i = 0; i < n && i < sizeof(p->dirs)/sizeof(*p->dirs); i++) {
+        p->dirs[i] = dirs[i];
+    }
+
+    // don't let the helper thread steal signals meant for the signalfd
+    pthread_t thread;
+    pthread_attr_t attr;
+    sigset_t all, old;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&thread, &attr, ns_preload_thread, p);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    pthread_attr_destroy(&attr);
+    if (err) {
+        errno = err;
+        return -1;
+    }
+    return 0;
+}
+
+/** The PSI resources checked by ns_psi, in order. */
+static const char *const ns_psi_resources[] = { "memory", "io", "cpu" };
+
+/**
+ * Delays the start of wine, and pauses it while it's booting, while the host is under memory, I/O, or CPU pressure (as
+ * reported by PSI), so multiple servers booting at once on a host don't push each other into swap or I/O contention.
+ */
+struct ns_psi {
+    int threshold[3]; // some avg10 percentage, or 0 to ignore
+    int trigfd[3]; // -1 if not supported (unprivileged triggers require Linux 6.5+)
+    int timerfd; // re-checks the pressure every second while throttling
+    pid_t pgid; // process group to pause while throttling, or 0
+    bool paused;
+    struct timespec paused_at;
+    unsigned long paused_ms, max_paused_ms;
+    char reason[128];
+    char msg[192];
+};
+
+/**
+ * Initializes a ns_psi with the provided thresholds. If PSI isn't available, -1 is returned with errno set (ENOENT if
+ * the kernel doesn't support it). Otherwise, 0 is returned.
+ */
+static int ns_psi_init(struct ns_psi *p, int mem, int io, int cpu) {
+    *p = (struct ns_psi) {
+        .threshold = { mem, io, cpu },
+        .trigfd = { -1, -1, -1 },
+        .timerfd = -1,
+    };
+    for (int i = 0; i < 3; i++) {
+        char path[32];
+        snprintf(path, sizeof(path), "/proc/pressure/%s", ns_psi_resources[i]);
+        if (access(path, R_OK)) {
+            return -1;
+        }
+        if (!p->threshold[i]) {
+            continue;
+        }
+        // notify us when the stall time exceeds the threshold within a 2s window (the minimum for unprivileged users)
+        char trig[48];
+        int n = snprintf(trig, sizeof(trig), "some %d 2000000", p->threshold[i] * 20000);
+        int fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (fd != -1 && write(fd, trig, n + 1) == -1) {
+            close(fd);
+            fd = -1;
+        }
+        p->trigfd[i] = fd;
+    }
+    p->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (p->timerfd == -1) {
+        preserve_errno({
+            ns_perror_dbg("create timerfd");
+            for (int i = 0; i < 3; i++) {
+                if (p->trigfd[i] != -1) {
+                    close(p->trigfd[i]);
+                }
+            }
+        });
+        return -1;
+    }
+    return 0;
+}
+
+/** Closes the triggers and the timerfd. */
+static void ns_psi_close(struct ns_psi *p) {
+    for (int i = 0; i < 3; i++) {
+        if (p->trigfd[i] != -1) {
+            close(p->trigfd[i]);
+            p->trigfd[i] = -1;
+        }
+    }
+    if (p->timerfd != -1) {
+        close(p->timerfd);
+        p->timerfd = -1;
+    }
+}
+
+/** Checks if any resource is over its threshold, and if so, writes the reason to p->reason. */
+static bool ns_psi_check(struct ns_psi *p) {
+    for (int i = 0; i < 3; i++) {
+        if (!p->threshold[i]) {
+            continue;
+        }
+        char path[32], buf[256];
+        snprintf(path, sizeof(path), "/proc/pressure/%s", ns_psi_resources[i]);
+        double avg10;
+        if (ns_read_file(path, buf, sizeof(buf)) == -1 || sscanf(buf, "some avg10=%lf", &avg10) != 1) {
+            continue;
+        }
+        if (avg10 > p->threshold[i]) {
+            snprintf(p->reason, sizeof(p->reason), "%s pressure is %.1f%% (threshold %d%%)", ns_psi_resources[i], avg10, p->threshold[i]);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Waits for up to timeout_sec for the pressure to be under the thresholds, logging why. SIGCHLD, SIGINT and SIGTERM
+ * must be blocked and readable on fd_signalfd. Returns the signal number if SIGINT or SIGTERM was received while
+ * waiting, or 0 once wine should be started (including if it timed out).
+ */
+static int ns_psi_wait(struct ns_psi *p, unsigned long timeout_sec, int fd_signalfd) {
+    struct timespec ts, tc;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    char last[sizeof(p->reason)] = "";
+    while (ns_psi_check(p)) {
+        clock_gettime(CLOCK_MONOTONIC, &tc);
+        if ((unsigned long)(tc.tv_sec - ts.tv_sec) >= timeout_sec) {
+            ns_log("warning: starting wine anyway after waiting %lus: %s", timeout_sec, p->reason);
+            return 0;
+        }
+        if (strcmp(last, p->reason)) {
+            ns_log("waiting to start wine: %s", p->reason);
+            strcpy(last, p->reason);
+        }
+        // wake up early if a trigger fires, but re-check every second anyway since avg10 also needs to go down
+        struct pollfd pfd[4];
+        nfds_t n = 0;
+        pfd[n++] = (struct pollfd) { .fd = fd_signalfd, .events = POLLIN };
+        for (int i = 0; i < 3; i++) {
+            if (p->trigfd[i] != -1) {
+                pfd[n++] = (struct pollfd) { .fd = p->trigfd[i], .events = POLLPRI };
+            }
+        }
+        if (poll(pfd, n, 1000) > 0 && pfd[0].revents & POLLIN) {
+            int sig = ns_signalfd_wait(fd_signalfd, 0);
+            if (sig == SIGINT || sig == SIGTERM) {
+                return sig;
+            }
+            if (sig > 0) {
+                ns_log("warning: unexpected signal %d while waiting to start wine; ignoring", sig);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &tc);
+    if (*last) {
+        ns_log("starting wine after waiting %lds for the pressure to go down", (long)(tc.tv_sec - ts.tv_sec));
+    }
+    return 0;
+}
+
+/**
+ * Starts pausing the process group while it's booting and the pressure is over the thresholds, for up to max_sec in
+ * total. Returns 0 on success, or -1 with errno set.
+ */
+static int ns_psi_throttle(struct ns_psi *p, pid_t pgid, unsigned long max_sec) {
+    p->pgid = pgid;
+    p->max_paused_ms = max_sec * 1000;
+    return timerfd_settime(p->timerfd, 0, &(struct itimerspec) {
+        .it_value.tv_sec = 1,
+        .it_interval.tv_sec = 1,
+    }, NULL);
+}
+
+/** Stops throttling, resuming the process group if it's paused. The triggers are closed since they're not needed anymore. */
+static void ns_psi_throttle_stop(struct ns_psi *p) {
+    if (p->paused) {
+        struct timespec tc;
+        clock_gettime(CLOCK_MONOTONIC, &tc);
+        p->paused_ms += (tc.tv_sec - p->paused_at.tv_sec) * 1000 + (tc.tv_nsec - p->paused_at.tv_nsec) / 1000000;
+        kill(-p->pgid, SIGCONT);
+        p->paused = false;
+    }
+    p->pgid = 0;
+    for (int i = 0; i < 3; i++) {
+        if (p->trigfd[i] != -1) {
+            close(p->trigfd[i]);
+            p->trigfd[i] = -1;
+        }
+    }
+    if (p->timerfd != -1) {
+        timerfd_settime(p->timerfd, 0, &(struct itimerspec) {}, NULL);
+    }
+}
+
+/** Adds the triggers and timer to the epoll file descriptor. */
+static int ns_psi_epoll_add(struct ns_psi *p, int fd) {
+    for (int i = 0; i < 3; i++) {
+        if (p->trigfd[i] != -1 && epoll_ctl(fd, EPOLL_CTL_ADD, p->trigfd[i], &(struct epoll_event) {
+            .events = EPOLLPRI,
+            .data.fd = p->trigfd[i],
+        })) {
+            return -1;
+        }
+    }
+    return epoll_ctl(fd, EPOLL_CTL_ADD, p->timerfd, &(struct epoll_event) {
+        .events = EPOLLIN,
+        .data.fd = p->timerfd,
+    });
+}
+
+/** Checks if an epoll event matches a trigger or the timer. */
+static bool ns_psi_epoll_check(struct ns_psi *p, struct epoll_event ev) {
+    if (p->timerfd != -1 && ev.data.fd == p->timerfd) {
+        return true;
+    }
+    for (int i = 0; i < 3; i++) {
+        if (p->trigfd[i] != -1 && ev.data.fd == p->trigfd[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/** Processes an epoll event, pausing or resuming the process group as needed. Returns the line to log, or an empty string. */
+static const char *ns_psi_epoll_process(struct ns_psi *p, struct epoll_event ev) {
+    uint64_t v;
+    if (ev.data.fd == p->timerfd) {
+        read(p->timerfd, &v, sizeof(v));
+    }
+    *p->msg = '\0';
+    if (!p->pgid) {
+        return p->msg; // trigger after the boot, or a leftover timer tick
+    }
+    struct timespec tc;
+    clock_gettime(CLOCK_MONOTONIC, &tc);
+    unsigned long ms = p->paused_ms;
+    if (p->paused) {
+        ms += (tc.tv_sec - p->paused_at.tv_sec) * 1000 + (tc.tv_nsec - p->paused_at.tv_nsec) / 1000000;
+    }
+    bool over = ns_psi_check(p);
+    if (p->paused && (!over || ms >= p->max_paused_ms)) {
+        kill(-p->pgid, SIGCONT);
+        p->paused = false;
+        p->paused_ms = ms;
+        if (over) {
+            snprintf(p->msg, sizeof(p->msg), "warning: resuming boot after pausing it for %lums in total: %s", ms, p->reason);
+        } else {
+            snprintf(p->msg, sizeof(p->msg), "resuming boot (paused for %lums in total)", ms);
+        }
+    } else if (!p->paused && over && ms < p->max_paused_ms) {
+        if (kill(-p->pgid, SIGSTOP) == 0) {
+            p->paused = true;
+            p->paused_at = tc;
+            snprintf(p->msg, sizeof(p->msg), "pausing boot: %s", p->reason);
+        }
+    }
+    return p->msg;
+}
+
+/**
+ * A child cgroup (v2) for the server, which is used to kill the whole process tree (including the wineserver and
+ * anything else which was orphaned) at once. It requires Linux 5.14+ for cgroup.kill and a writable cgroup.
+ */
+struct ns_cgroup {
+    char path[PATH_MAX];
+    int fd_procs;
+};
+
+/**
+ * Creates a child cgroup under parent, or under the current cgroup if parent is NULL. If the cgroup can't be created,
+ * -1 is returned with errno set, and the ns_cgroup is still safe to use (the other functions do nothing).
+ */
+static int ns_cgroup_init(struct ns_cgroup *cg, const char *parent) {
+    *cg = (struct ns_cgroup) {
+        .fd_procs = -1,
+    };
+    char buf[PATH_MAX];
+    if (!parent) {
+        FILE *f = fopen("/proc/self/cgroup", "r");
+        if (!f) {
+            return -1;
+        }
+        *buf = '\0';
+        char line[PATH_MAX - 64];
+        while (fgets(line, sizeof(line), f)) {
+            if (!strncmp(line, "0::", 3)) {
+                line[strcspn(line, "\n")] = '\0';
+                snprintf(buf, sizeof(buf), "/sys/fs/cgroup%s", line + 3);
+                break;
+            }
+        }
+        fclose(f);
+        if (!*buf) {
+            errno = ENOTSUP; // not cgroup v2
+            return -1;
+        }
+        parent = buf;
+    }
+    struct statfs sfs;
+    if (statfs(parent, &sfs) == -1) {
+        return -1;
+    }
+    if (sfs.f_type != 0x63677270 /* CGROUP2_SUPER_MAGIC */) {
+        errno = ENOTSUP; // not cgroup v2 (or hybrid with the current cgroup in the unified hierarchy)
+        return -1;
+    }
+    if (snprintf(cg->path, sizeof(cg->path), "%s/nswrap-%ld", parent, (long) (getpid())) >= (int) sizeof(cg->path)) {
+        *cg->path = '\0';
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (mkdir(cg->path, 0755) == -1) {
+        *cg->path = '\0';
+        return -1;
+    }
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s/cgroup.kill", cg->path);
+    if (access(tmp, W_OK) == -1) {
+        preserve_errno({
+            rmdir(cg->path);
+            *cg->path = '\0';
+        });
+        return -1;
+    }
+    snprintf(tmp, sizeof(tmp), "%s/cgroup.procs", cg->path);
+    if ((cg->fd_procs = open(tmp, O_WRONLY | O_CLOEXEC)) == -1) {
+        preserve_errno({
+            rmdir(cg->path);
+            *cg->path = '\0';
+        });
+        return -1;
+    }
+    return 0;
+}
+
+/** Moves the calling process into the cgroup. This is async-signal-safe, so it can be used after forking. */
+static int ns_cgroup_enter(struct ns_cgroup *cg) {
+    if (cg->fd_procs == -1) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    return write(cg->fd_procs, "0", 1) == 1 ? 0 : -1;
+}
+
+/** Kills every process in the cgroup. Returns 0 on success, or -1 with errno set. */
+static int ns_cgroup_kill(struct ns_cgroup *cg) {
+    if (!*cg->path) {
+        errno = ENOTSUP;
+        return -1;
+    }
+    char tmp[PATH_MAX + 16];
+    snprintf(tmp, sizeof(tmp), "%s/cgroup.kill", cg->path);
+    int fd = open(tmp, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+    int r = write(fd, "1", 1) == 1 ? 0 : -1;
+    preserve_errno({
+        close(fd);
+    });
+    return r;
+}
+
+/** Removes the cgroup. It must be empty. */
+static void ns_cgroup_close(struct ns_cgroup *cg) {
+    if (cg->fd_procs != -1) {
+        close(cg->fd_procs);
+        cg->fd_procs = -1;
+    }
+    if (*cg->path) {
+        if (rmdir(cg->path) == -1 && errno != ENOENT) {
+            ns_perror("warning: failed to remove cgroup '%s'", cg->path);
+        }
+        *cg->path = '\0';
+    }
+}
+
+/**
+ * Reaps children (including orphaned descendants, since we're a subreaper) until there aren't any left, waiting on the
+ * signalfd (which must include SIGCHLD) for up to timeout_ms. Returns 0 if there aren't any children left, or -1 with
+ * errno set (ETIMEDOUT if the timeout expired, or EINTR if SIGINT or SIGTERM was received). Other signals are ignored.
+ */
+static int ns_reap_children(int fd_signalfd, int timeout_ms) {
+    struct timespec ts, tc;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    for (;;) {
+        switch (waitpid(-1, NULL, WNOHANG)) {
+        case -1:
+            if (errno == EINTR) {
+                continue; // try again immediately
+            }
+            if (errno == ECHILD) {
+                return 0;
+            }
+            return -1;
+        case 0:
+            break; // no children to reap right now
+        default:
+            continue; // child reaped; try another one immediately
+        }
+        clock_gettime(CLOCK_MONOTONIC, &tc);
+        long left = timeout_ms - ((tc.tv_sec - ts.tv_sec) * 1000 + (tc.tv_nsec - ts.tv_nsec) / 1000000);
+        if (left <= 0) {
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        int sig = ns_signalfd_wait(fd_signalfd, left);
+        if (sig == -1) {
+            return -1;
+        }
+        if (sig == SIGINT || sig == SIGTERM) {
+            errno = EINTR;
+            return -1;
+        }
+    }
+}
+
+/**
+ * Watches for server hangs by taking advantage of the title updates in the server loop.
+ *
+ * While booting, it must receive init_target title updates less than max_sec apart within boot_sec. After that, the
+ * timeout adapts to the server: it's factor times the (slowly decaying) peak interval between title updates, clamped
+ * to min_sec and max_sec (max_sec is used until there are enough updates to go by). The title isn't updated while a
+ * map is loading, and there's no way to tell a load from a hang until the title changes, so any gap is tolerated up to
+ * twice the longest load seen so far (which is only learned from the gaps before the map or playlist changes), or
+ * max_sec before the first one, clamped to the timeout and load_sec.
+ */
+struct ns_watchdog {
+    int timerfd;
+    int init_ctr;
+    int init_target;
+    int boot_sec;
+    int min_sec;
+    int max_sec;
+    int load_sec;
+    int factor;
+    uint64_t last_title_ms;
+    uint64_t timeout_ms;
+    double peak_ms;
+    uint64_t samples;
+    uint64_t load_max_ms;
+    uint64_t loads;
+    bool loading;
+    bool paused;
+    uint64_t paused_ms;
+    uint64_t paused_left_ms;
+    char title[NS_IOPROC_OUTPUT_CHUNK_SIZE + 1];
+    char map[sizeof(((struct ns_status*)0)->map_name) + sizeof(((struct ns_status*)0)->playlist_name)];
+    char note[150];
+    char err[200];
+};
+
+/** The number of title updates (after the initial ones) needed before the timeout is adapted. */
+#define NS_WATCHDOG_SAMPLES 100
+
+static uint64_t ns_watchdog_now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+/** Arms the timer to fire after ms. */
+static int ns_watchdog_arm(struct ns_watchdog *wd, uint64_t ms) {
+    return timerfd_settime(wd->timerfd, 0, &(struct itimerspec) {
+        .it_value.tv_sec = ms / 1000,
+        .it_value.tv_nsec = ms % 1000 * 1000000 + (ms ? 0 : 1), // zero would disarm it
+    }, NULL);
+}
+
+/**
+ * Initializes a ns_watchdog (see the struct for the meaning of the arguments). If the timerfd can't be created, -1 is
+ * returned and errno is set. Otherwise, 0 is returned.
+ */
+static int ns_watchdog_init(struct ns_watchdog *wd, int init_target, int boot_sec, int min_sec, int max_sec, int load_sec, int factor) {
+    *wd = (struct ns_watchdog) {
+        .timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK),
+        .init_target = init_target,
+        .boot_sec = boot_sec,
+        .min_sec = min_sec,
+        .max_sec = max_sec,
+        .load_sec = load_sec,
+        .factor = factor,
+    };
+    if (wd->timerfd == -1) {
+        preserve_errno({
+            ns_perror_dbg("create timerfd");
+        });
+        return -1;
+    }
+    if (ns_watchdog_arm(wd, boot_sec * 1000ULL) == -1) {
+        preserve_errno({
+            ns_perror_dbg("set timerfd");
+            close(wd->timerfd);
+        });
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Stops a ns_watchdog and frees the timerfd.
+ */
+static void ns_watchdog_stop(struct ns_watchdog *wd) {
+    close(wd->timerfd);
+}
+
+/** Checks if the watchdog has received the initial ticks. */
+static bool ns_watchdog_initialized(struct ns_watchdog *wd) {
+    return wd->init_ctr >= wd->init_target;
+}
+
+/**
+ * Pauses or resumes the boot timer while the server is stopped (e.g., by ns_psi), so the stopped time doesn't count
+ * against boot_sec or as a gap between the initial ticks. It does nothing once the watchdog is initialized. Returns 0 on
+ * success or -1 with errno set.
+ */
+static int ns_watchdog_pause(struct ns_watchdog *wd, bool paused) {
+    if (wd->paused == paused) {
+        return 0;
+    }
+    wd->paused = paused;
+    if (ns_watchdog_initialized(wd)) {
+        return 0;
+    }
+    uint64_t now = ns_watchdog_now_ms();
+    if (paused) {
+        struct itimerspec its;
+        if (timerfd_gettime(wd->timerfd, &its) == -1) {
+            return -1;
+        }
+        wd->paused_ms = now;
+        wd->paused_left_ms = its.it_value.tv_sec * 1000ULL + (its.it_value.tv_nsec + 999999) / 1000000;
+        return timerfd_settime(wd->timerfd, 0, &(struct itimerspec) {}, NULL);
+    }
+    if (wd->last_title_ms) {
+        wd->last_title_ms += now - wd->paused_ms;
+    }
+    if (!wd->paused_left_ms) {
+        return 0; // it already fired
+    }
+    return ns_watchdog_arm(wd, wd->paused_left_ms);
+}
+
+/** Gets the current timeout for title updates while the server isn't loading. */
+static uint64_t ns_watchdog_timeout_ms(struct ns_watchdog *wd) {
+    if (wd->samples < NS_WATCHDOG_SAMPLES) {
+        return wd->max_sec * 1000ULL;
+    }
+    uint64_t ms = wd->factor * wd->peak_ms;
+    if (ms < wd->min_sec * 1000ULL) {
+        ms = wd->min_sec * 1000ULL;
+    }
+    if (ms > wd->max_sec * 1000ULL) {
+        ms = wd->max_sec * 1000ULL;
+    }
+    return ms;
+}
+
+/** Gets the current timeout for title updates while the server may be loading a map. */
+static uint64_t ns_watchdog_load_timeout_ms(struct ns_watchdog *wd) {
+    uint64_t ms = wd->loads ? 2 * wd->load_max_ms : wd->max_sec * 1000ULL;
+    if (ms > wd->load_sec * 1000ULL) {
+        ms = wd->load_sec * 1000ULL;
+    }
+    if (ms < ns_watchdog_timeout_ms(wd)) {
+        ms = ns_watchdog_timeout_ms(wd);
+    }
+    return ms;
+}
+
+/**
+ * Sends a title update to the watchdog. Returns 0 on success or -1 with errno set. If something interesting happened
+ * (i.e., a map finished loading), note is set to a message to log.
+ */
+static int ns_watchdog_update(struct ns_watchdog *wd, const char *title) {
+    uint64_t now = ns_watchdog_now_ms(), gap = now - wd->last_title_ms;
+    *wd->note = '\0';
+
+    // the title usually doesn't change, so only parse it when it does
+    bool changed = false;
+    if (strcmp(title, wd->title)) {
+        snprintf(wd->title, sizeof(wd->title), "%s", title);
+        struct ns_status st;
+        if (!ns_status_parse(&st, title)) {
+            char map[sizeof(wd->map)];
+            snprintf(map, sizeof(map), "%s %s", st.map_name, st.playlist_name);
+            changed = *wd->map && strcmp(map, wd->map);
+            memcpy(wd->map, map, sizeof(map));
+        }
+    }
+
+    if (!ns_watchdog_initialized(wd)) {
+        bool reset = wd->last_title_ms && gap > wd->max_sec * 1000ULL;
+        wd->last_title_ms = now;
+        if (reset) {
+            wd->init_ctr = 0;
+            return 0;
+        } else if (++wd->init_ctr < wd->init_target) {
+            return 0;
+        }
+    } else {
+        wd->last_title_ms = now;
+        if (changed) {
+            if (gap > wd->load_max_ms) {
+                wd->load_max_ms = gap;
+            }
+            wd->loads++;
+            snprintf(wd->note, sizeof(wd->note), "map load took %.1fs", gap / 1000.0);
+        } else if (wd->loading || gap > wd->timeout_ms) {
+            // don't learn from it, or a server which keeps almost hanging would keep raising its own limits
+            snprintf(wd->note, sizeof(wd->note), "stall took %.1fs (without a map change)", gap / 1000.0);
+        } else {
+            wd->peak_ms -= wd->peak_ms / 4096; // decay with a half-life of ~2800 updates
+            if (gap > wd->peak_ms) {
+                wd->peak_ms = gap;
+            }
+            wd->samples++;
+        }
+        wd->loading = false;
+    }
+    wd->timeout_ms = ns_watchdog_timeout_ms(wd);
+    return ns_watchdog_arm(wd, wd->timeout_ms);
+}
+
+/** Adds the watchdog to the epoll file descriptor. */
+static int ns_watchdog_epoll_add(struct ns_watchdog *wd, int fd) {
+    return epoll_ctl(fd, EPOLL_CTL_ADD, wd->timerfd, &(struct epoll_event) {
+        .events = EPOLLIN,
+        .data.fd = wd->timerfd,
+    });
+}
+
+/** Checks if an epoll event matches the watchdog. */
+static bool ns_watchdog_epoll_check(struct ns_watchdog *wd, struct epoll_event ev) {
+    return ev.data.fd == wd->timerfd;
+}
+
+/**
+ * Processes an epoll event and returns a message, or NULL with errno set. If the server is hung (or didn't finish
+ * booting in time), hang is set to true. Otherwise, the message is empty or a warning to log.
+ */
+static const char *ns_watchdog_epoll_process(struct ns_watchdog *wd, bool *hang) {
+    uint64_t v;
+    if (read(wd->timerfd, &v, sizeof(v)) == -1) {
+        return NULL;
+    }
+    *hang = true;
+    if (!ns_watchdog_initialized(wd)) {
+        snprintf(wd->err, sizeof(wd->err), "watchdog did not receive enough title updates for initialization: only received %d/%d initial ticks less than %ds apart within %ds", wd->init_ctr, wd->init_target, wd->max_sec, wd->boot_sec);
+        return wd->err;
+    }
+    uint64_t now = ns_watchdog_now_ms(), load_ms = ns_watchdog_load_timeout_ms(wd);
+    uint64_t since_title = now - wd->last_title_ms;
+    if (since_title >= load_ms) {
+        snprintf(wd->err, sizeof(wd->err), "watchdog did not receive a title update in time: last tick was %.1fs ago, and the limit while loading is %.1fs (%llu map loads, longest %.1fs)", since_title / 1000.0, load_ms / 1000.0, (unsigned long long)(wd->loads), wd->load_max_ms / 1000.0);
+        return wd->err;
+    }
+    *hang = false;
+    if (ns_watchdog_arm(wd, wd->last_title_ms + load_ms - now) == -1) {
+        return NULL;
+    }
+    *wd->err = '\0';
+    if (!wd->loading) {
+        wd->loading = true;
+        snprintf(wd->err, sizeof(wd->err), "no title update for %.1fs; assuming the server is loading a map (for up to %.1fs)", since_title / 1000.0, load_ms / 1000.0);
+    }
+    return wd->err;
+}
+
+/** Writes a summary of the learned thresholds. */
+static void ns_watchdog_str(struct ns_watchdog *wd, char *buf, size_t buf_sz) {
+    snprintf(buf, buf_sz, "timeout %.1fs (peak interval %.0fms over %llu updates), %llu loads (longest %.1fs), load timeout %.1fs",
+        ns_watchdog_timeout_ms(wd) / 1000.0, wd->peak_ms, (unsigned long long)(wd->samples),
+        (unsigned long long)(wd->loads), wd->load_max_ms / 1000.0, ns_watchdog_load_timeout_ms(wd) / 1000.0);
+}
+
+/** The maximum number of startup phases, including the ones from the entrypoint. */
+#define NS_STARTUP_PHASES 24
+
+/**
+ * Records when each phase of the startup ends and the bytes read from storage during it (by nswrap and wine), to log a
+ * summary once the server is ready. It continues from the phases recorded by the entrypoint, if any.
+ */
+struct ns_startup {
+    int n;
+    struct {
+        char name[16];
+        uint64_t end_ns;
+        uint64_t read_bytes;
+    } phase[NS_STARTUP_PHASES];
+    pid_t pid;
+    uint64_t read_bytes;
+    bool done;
+};
+
+static uint64_t ns_startup_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Gets the bytes read from storage by a process, or 0 if it isn't available. */
+static uint64_t ns_startup_read_bytes(pid_t pid) {
+    char path[32];
+    snprintf(path, sizeof(path), "/proc/%ld/io", (long) (pid));
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+    unsigned long long v = 0;
+    char line[64];
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "read_bytes: %llu", &v) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return v;
+}
+
+/**
+ * Initializes a ns_startup from the phases recorded by the entrypoint, if any (see nsstartup.go). The time until
+ * nswrap started is recorded as the exec phase.
+ */
+static void ns_startup_init(struct ns_startup *s, const char *env) {
+    *s = (struct ns_startup) {
+        .read_bytes = ns_startup_read_bytes(getpid()),
+    };
+    for (const char *x = env ?: ""; *x && s->n < NS_STARTUP_PHASES - 1;) {
+        x += strspn(x, " ");
+        unsigned long long end, rb;
+        int n = 0;
+        if (sscanf(x, "%15[^: ]:%llu:%llu%n", s->phase[s->n].name, &end, &rb, &n) != 3) {
+            break;
+        }
+        s->phase[s->n].end_ns = end;
+        s->phase[s->n].read_bytes = rb;
+        s->n++;
+        x += n;
+    }
+    snprintf(s->phase[s->n].name, sizeof(s->phase[s->n].name), "%s", s->n ? "exec" : "start");
+    s->phase[s->n].end_ns = ns_startup_now();
+    s->n++;
+}
+
+/** Includes the I/O of another process (i.e., wine) in the following phases. */
+static void ns_startup_pid(struct ns_startup *s, pid_t pid) {
+    s->pid = pid;
+}
+
+/** Ends the current phase, unless a phase with the same name has already ended. */
+static void ns_startup_mark(struct ns_startup *s, const char *name) {
+    if (s->done || s->n >= NS_STARTUP_PHASES) {
+        return;
+    }
+    for (int i = 0; i < s->n; i++) {
+        if (!strcmp(s->phase[i].name, name)) {
+            return;
+        }
+    }
+    uint64_t rb = ns_startup_read_bytes(getpid()) + (s->pid ? ns_startup_read_bytes(s->pid) : 0);
+    snprintf(s->phase[s->n].name, sizeof(s->phase[s->n].name), "%s", name);
+    s->phase[s->n].end_ns = ns_startup_now();
+    s->phase[s->n].read_bytes = rb > s->read_bytes ? rb - s->read_bytes : 0;
+    s->read_bytes = rb;
+    s->n++;
+}
+
+/**
+ * Ends the last phase and writes the summary, which is a single line with the total time followed by each phase as
+ * name=seconds/bytes.
+ */
+static void ns_startup_done(struct ns_startup *s, const char *name, char *buf, size_t buf_sz) {
+    ns_startup_mark(s, name);
+    s->done = true;
+
+    int r = snprintf(buf, buf_sz, "%.3fs total,", s->n ? (s->phase[s->n - 1].end_ns - s->phase[0].end_ns) / 1e9 : 0);
+    for (int i = 1; i < s->n && r >= 0 && (size_t) r < buf_sz; i++) {
+        r += snprintf(buf + r, buf_sz - r, " %s=%.3fs/%lluB", s->phase[i].name, (s->phase[i].end_ns - s->phase[i - 1].end_ns) / 1e9, (unsigned long long) (s->phase[i].read_bytes));
+    }
+}
+
+/**
+ * Tracks a graceful shutdown, which waits until there aren't any players left or the match ends (i.e., the map or
+ * playlist changes), up to a deadline.
+ */
+struct ns_drain {
+    int timerfd;
+    bool active;
+    struct timespec deadline;
+    char map[sizeof(((struct ns_status*)0)->map_name) + sizeof(((struct ns_status*)0)->playlist_name)];
+    int players;
+    char msg[160];
+};
+
+/** Initializes a ns_drain. Returns 0 on success, or -1 with errno set. */
+static int ns_drain_init(struct ns_drain *d) {
+    *d = (struct ns_drain) {
+        .timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK),
+        .players = -1,
+    };
+    return d->timerfd == -1 ? -1 : 0;
+}
+
+static void ns_drain_close(struct ns_drain *d) {
+    if (d->timerfd != -1) {
+        close(d->timerfd);
+        d->timerfd = -1;
+    }
+}
+
+/** Starts draining with a deadline. Returns 0 on success, or -1 with errno set. */
+static int ns_drain_start(struct ns_drain *d, unsigned long sec) {
+    if (clock_gettime(CLOCK_MONOTONIC, &d->deadline) == -1) {
+        return -1;
+    }
+    d->deadline.tv_sec += sec;
+    d->active = true;
+    *d->map = '\0';
+    d->players = -1;
+    return timerfd_settime(d->timerfd, TFD_TIMER_ABSTIME, &(struct itimerspec) {
+        .it_value = d->deadline,
+    }, NULL);
+}
+
+/** Stops draining. */
+static void ns_drain_stop(struct ns_drain *d) {
+    d->active = false;
+    timerfd_settime(d->timerfd, 0, &(struct itimerspec) {}, NULL);
+}
+
+/** Gets the number of seconds left until the deadline. */
+static long ns_drain_left(struct ns_drain *d) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return d->deadline.tv_sec - ts.tv_sec;
+}
+
+/**
+ * Processes a title update while draining, returning true if the server can be stopped. If the status changed, msg is
+ * set to a line to log.
+ */
+static bool ns_drain_update(struct ns_drain *d, const char *title) {
+    *d->msg = '\0';
+    struct ns_status st;
+    if (!d->active || ns_status_parse(&st, title)) {
+        return false;
+    }
+    char map[sizeof(d->map)];
+    snprintf(map, sizeof(map), "%s %s", st.map_name, st.playlist_name);
+    if (*d->map && strcmp(map, d->map)) {
+        snprintf(d->msg, sizeof(d->msg), "match ended (now %s) with %d players left", map, st.player_count);
+        return true;
+    }
+    memcpy(d->map, map, sizeof(map));
+    if (st.player_count == 0) {
+        snprintf(d->msg, sizeof(d->msg), "no players left");
+        return true;
+    }
+    if (st.player_count != d->players) {
+        snprintf(d->msg, sizeof(d->msg), "%d players left on %s, %lds until the deadline", st.player_count, map, ns_drain_left(d));
+        d->players = st.player_count;
+    }
+    return false;
+}
+
+/** Adds the deadline timer to the epoll file descriptor. */
+static int ns_drain_epoll_add(struct ns_drain *d, int fd) {
+    return epoll_ctl(fd, EPOLL_CTL_ADD, d->timerfd, &(struct epoll_event) {
+        .events = EPOLLIN,
+        .data.fd = d->timerfd,
+    });
+}
+
+/** Checks if an epoll event matches the deadline timer. */
+static bool ns_drain_epoll_check(struct ns_drain *d, struct epoll_event ev) {
+    return ev.data.fd == d->timerfd;
+}
+
+/** Processes an epoll event, returning true if the deadline was reached. */
+static bool ns_drain_epoll_process(struct ns_drain *d) {
+    uint64_t v;
+    return read(d->timerfd, &v, sizeof(v)) > 0 && d->active;
+}
+
+#define NS_STATUSPAGE_MAGIC   0x5453534E // "NSST"
+#define NS_STATUSPAGE_VERSION 1
+
+#define NS_STATUSPAGE_INITIALIZED (1 << 0) // the watchdog received the initial title updates
+#define NS_STATUSPAGE_LOADING     (1 << 1) // the watchdog assumes the server is loading a map
+#define NS_STATUSPAGE_PAUSED      (1 << 2) // the boot is paused due to pressure (NSWRAP_PSI_THROTTLE)
+#define NS_STATUSPAGE_DRAINING    (1 << 3) // waiting for the players to leave (NSWRAP_DRAIN)
+#define NS_STATUSPAGE_EXITING     (1 << 4) // the server was told to exit
+
+/**
+ * The layout of the status page. It's native-endian with natural alignment, and fields are only ever added to the end
+ * (with the size updated) unless the version changes.
+ *
+ * The writer increments seq before and after every update, so it's odd while the page is being written. To read it
+ * without blocking the writer, load seq (acquire), retry if it's odd, copy the fields, then load seq again (after an
+ * acquire fence) and retry if it changed.
+ */
+struct ns_statuspage_data {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;
+    _Atomic uint32_t seq;
+    int32_t nswrap_pid;
+    int32_t wine_pid;
+    uint32_t flags;            // NS_STATUSPAGE_*
+    int32_t player_count;      // -1 if unknown
+    int32_t max_players;       // -1 if unknown
+    char map_name[32];         // empty if unknown
+    char playlist_name[32];    // empty if unknown
+    uint64_t start_ns;         // CLOCK_MONOTONIC
+    uint64_t update_ns;        // CLOCK_MONOTONIC of the last update
+    uint64_t title_ns;         // CLOCK_MONOTONIC of the last title update
+    uint64_t titles;           // title updates received
+    uint64_t output_bytes;     // console output received
+    uint64_t watchdog_timeout_ms;
+    uint64_t watchdog_peak_us;
+    uint64_t watchdog_loads;
+    uint64_t watchdog_load_max_ms;
+};
+
+_Static_assert(sizeof(((struct ns_statuspage_data*)0)->map_name) == sizeof(((struct ns_status*)0)->map_name), "map_name size mismatch");
+_Static_assert(sizeof(((struct ns_statuspage_data*)0)->playlist_name) == sizeof(((struct ns_status*)0)->playlist_name), "playlist_name size mismatch");
+
+/**
+ * Publishes the status in a memory-mapped file, so it can be read by other processes (e.g., a host agent monitoring
+ * many servers) without any syscalls or parsing, and without waiting for the throttled process title.
+ */
+struct ns_statuspage {
+    int fd;
+    struct ns_statuspage_data *d;
+    char path[PATH_MAX];
+    char title[NS_IOPROC_OUTPUT_CHUNK_SIZE + 1];
+};
+
+/**
+ * Creates the status page, or if path is NULL, an anonymous one which is only used within nswrap (e.g., for
+ * NSWRAP_TELEMETRY). Returns 0 on success, or -1 with errno set.
+ */
+static int ns_statuspage_init(struct ns_statuspage *p, const char *path) {
+    *p = (struct ns_statuspage) {
+        .fd = -1,
+    };
+    if (!path) {
+        void *m = mmap(NULL, sizeof(*p->d), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (m == MAP_FAILED) {
+            return -1;
+        }
+        p->d = m;
+    } else if (strlen(path) >= sizeof(p->path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    } else {
+        strcpy(p->path, path);
+        if ((p->fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+            return -1;
+        }
+        if (ftruncate(p->fd, sizeof(*p->d)) == -1) {
+            preserve_errno({
+                close(p->fd);
+                unlink(p->path);
+                p->fd = -1;
+            });
+            return -1;
+        }
+        void *m = mmap(NULL, sizeof(*p->d), PROT_READ | PROT_WRITE, MAP_SHARED, p->fd, 0);
+        if (m == MAP_FAILED) {
+            preserve_errno({
+                close(p->fd);
+                unlink(p->path);
+                p->fd = -1;
+            });
+            return -1;
+        }
+        p->d = m;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    p->d->size = sizeof(*p->d);
+    p->d->version = NS_STATUSPAGE_VERSION;
+    p->d->nswrap_pid = getpid();
+    p->d->player_count = -1;
+    p->d->max_players = -1;
+    p->d->start_ns = p->d->update_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    atomic_thread_fence(memory_order_release);
+    p->d->magic = NS_STATUSPAGE_MAGIC; // last, so readers can tell it's initialized
+    return 0;
+}
+
+/** Unmaps and removes the status page. */
+static void ns_statuspage_close(struct ns_statuspage *p) {
+    if (p->d) {
+        munmap(p->d, sizeof(*p->d));
+        p->d = NULL;
+    }
+    if (p->fd != -1) {
+        close(p->fd);
+        unlink(p->path);
+        p->fd = -1;
+    }
+}
+
+static uint64_t ns_statuspage_begin(struct ns_statuspage *p) {
+    atomic_fetch_add_explicit(&p->d->seq, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return p->d->update_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void ns_statuspage_end(struct ns_statuspage *p) {
+    atomic_fetch_add_explicit(&p->d->seq, 1, memory_order_release);
+}
+
+/** Sets the wine pid. */
+static void ns_statuspage_pid(struct ns_statuspage *p, pid_t pid) {
+    if (p->d) {
+        ns_statuspage_begin(p);
+        p->d->wine_pid = pid;
+        ns_statuspage_end(p);
+    }
+}
+
+/** Updates the flags if they changed. */
+static void ns_statuspage_flags(struct ns_statuspage *p, uint32_t flags) {
+    if (p->d && p->d->flags != flags) {
+        ns_statuspage_begin(p);
+        p->d->flags = flags;
+        ns_statuspage_end(p);
+    }
+}
+
+/** Records console output. */
+static void ns_statuspage_output(struct ns_statuspage *p, size_t n) {
+    if (p->d) {
+        ns_statuspage_begin(p);
+        p->d->output_bytes += n;
+        ns_statuspage_end(p);
+    }
+}
+
+/** Records a title update, parsing it if it changed. */
+static void ns_statuspage_title(struct ns_statuspage *p, const char *title, struct ns_watchdog *wd) {
+    if (!p->d) {
+        return;
+    }
+    struct ns_status st;
+    bool changed = false;
+    if (strcmp(title, p->title)) {
+        snprintf(p->title, sizeof(p->title), "%s", title);
+        changed = !ns_status_parse(&st, title);
+    }
+    p->d->title_ns = ns_statuspage_begin(p);
+    p->d->titles++;
+    if (changed) {
+        p->d->player_count = st.player_count;
+        p->d->max_players = st.max_players;
+        memcpy(p->d->map_name, st.map_name, sizeof(p->d->map_name));
+        memcpy(p->d->playlist_name, st.playlist_name, sizeof(p->d->playlist_name));
+    }
+    p->d->watchdog_timeout_ms = wd->timeout_ms;
+    p->d->watchdog_peak_us = wd->peak_ms * 1000;
+    p->d->watchdog_loads = wd->loads;
+    p->d->watchdog_load_max_ms = wd->load_max_ms;
+    ns_statuspage_end(p);
+}
+
+#define NS_TELEMETRY_MAGIC      0x4654534E // "NSTF"
+#define NS_TELEMETRY_VERSION    1
+#define NS_TELEMETRY_FRAME_SIZE 180
+#define NS_TELEMETRY_CADENCE    8
+
+#define NS_TELEMETRY_FINAL (1u << 31) // the last frame of the session (the other flags are NS_STATUSPAGE_*)
+
+/** The upper bounds of the title cadence bins in microseconds (the last bin is everything longer). */
+static const uint64_t ns_telemetry_cadence_us[NS_TELEMETRY_CADENCE - 1] = {
+    5000, 10000, 20000, 50000, 100000, 250000, 1000000,
+};
+
+/**
+ * A telemetry frame. On the wire, it's NS_TELEMETRY_FRAME_SIZE bytes of the fields in this order, little-endian with
+ * no padding. Fields are only ever added to the end (with the size updated) unless the version changes, so receivers
+ * should accept larger frames.
+ *
+ * Counters (marked as deltas) are relative to the previous frame which was sent successfully, so a receiver can sum
+ * them across servers without keeping any state. Frames which couldn't be sent are folded into the next one, so a gap
+ * in seq only means frames were lost after being sent (e.g., the receiver's buffer was full).
+ */
+struct ns_telemetry_frame {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint64_t session;          // random, new every time nswrap starts
+    uint32_t seq;              // incremented for every frame
+    uint32_t interval_ms;      // since the previous frame
+    uint32_t nswrap_pid;
+    uint32_t flags;            // NS_STATUSPAGE_*, NS_TELEMETRY_FINAL
+    uint32_t restarts;         // NSWRAP_RESTARTS
+    int16_t player_count;      // -1 if unknown
+    int16_t max_players;       // -1 if unknown
+    char id[32];               // NSWRAP_TELEMETRY_ID
+    char map_name[32];         // empty if unknown
+    char playlist_name[32];    // empty if unknown
+    uint64_t output_bytes;     // delta
+    uint32_t titles;           // delta
+    uint32_t memory_kib;       // of the server's cgroup, or the wine process if there isn't one
+    uint32_t watchdog_timeout_ms;
+    uint32_t watchdog_loads;   // delta
+    uint16_t cadence[NS_TELEMETRY_CADENCE]; // delta, title update intervals binned by ns_telemetry_cadence_us
+    uint32_t uptime_sec;
+};
+
+#define NS_TELEMETRY_FIELDS(X, S) \
+    X(magic) X(version) X(size) X(session) X(seq) X(interval_ms) X(nswrap_pid) X(flags) X(restarts) \
+    X(player_count) X(max_players) S(id) S(map_name) S(playlist_name) X(output_bytes) X(titles) X(memory_kib) \
+    X(watchdog_timeout_ms) X(watchdog_loads) \
+    X(cadence[0]) X(cadence[1]) X(cadence[2]) X(cadence[3]) X(cadence[4]) X(cadence[5]) X(cadence[6]) X(cadence[7]) \
+    X(uptime_sec)
+
+#define X(x) + sizeof(((struct ns_telemetry_frame*)0)->x)
+_Static_assert(0 NS_TELEMETRY_FIELDS(X, X) == NS_TELEMETRY_FRAME_SIZE, "NS_TELEMETRY_FRAME_SIZE mismatch");
+#undef X
+
+/** Encodes a frame into buf, which must be NS_TELEMETRY_FRAME_SIZE bytes. */
+static void ns_telemetry_encode(const struct ns_telemetry_frame *f, uint8_t *buf) {
+    uint8_t *p = buf;
+    #define X(x) for (size_t i = 0; i < sizeof(f->x); i++) *p++ = (uint64_t)(f->x) >> (8 * i);
+    #define S(x) memcpy(p, f->x, sizeof(f->x)); p += sizeof(f->x);
+    NS_TELEMETRY_FIELDS(X, S)
+    #undef X
+    #undef S
+}
+
+/**
+ * Decodes a frame from buf, for receivers (see scripts/nstelemetry). Returns 0 on success, or -1 with errno set if it
+ * isn't a valid frame.
+ */
+__attribute__((unused)) static int ns_telemetry_decode(struct ns_telemetry_frame *f, const uint8_t *buf, size_t n) {
+    if (n < NS_TELEMETRY_FRAME_SIZE) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+    const uint8_t *p = buf;
+    #define X(x) { uint64_t v = 0; for (size_t i = 0; i < sizeof(f->x); i++) v |= (uint64_t)(*p++) << (8 * i); f->x = v; }
+    #define S(x) memcpy(f->x, p, sizeof(f->x)); f->x[sizeof(f->x) - 1] = '\0'; p += sizeof(f->x);
+    NS_TELEMETRY_FIELDS(X, S)
+    #undef X
+    #undef S
+    if (f->magic != NS_TELEMETRY_MAGIC || f->version != NS_TELEMETRY_VERSION || f->size < NS_TELEMETRY_FRAME_SIZE || f->size > n) {
+        errno = EPROTO;
+        return -1;
+    }
+    return 0;
+}
+
+/** Parses a unix:/path or udp:host:port (with a numeric host) address. Returns 0 on success, or -1 with errno set. */
+static int ns_telemetry_addr(const char *s, struct sockaddr_storage *addr, socklen_t *addr_len) {
+    memset(addr, 0, sizeof(*addr));
+    if (!strncmp(s, "unix:", 5)) {
+        struct sockaddr_un *un = (struct sockaddr_un*) addr;
+        if (!s[5] || strlen(s + 5) >= sizeof(un->sun_path)) {
+            errno = EINVAL;
+            return -1;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, s + 5);
+        *addr_len = sizeof(*un);
+        return 0;
+    }
+    if (!strncmp(s, "udp:", 4)) {
+        char host[INET6_ADDRSTRLEN + 2];
+        const char *port = strrchr(s + 4, ':');
+        if (!port || (size_t)(port - s - 4) >= sizeof(host)) {
+            errno = EINVAL;
+            return -1;
+        }
+        snprintf(host, sizeof(host), "%.*s", (int)(port - s - 4), s + 4);
+        char *e;
+        unsigned long p = strtoul(++port, &e, 10);
+        if (!*port || *e || !p || p > 65535) {
+            errno = EINVAL;
+            return -1;
+        }
+        struct sockaddr_in *in = (struct sockaddr_in*) addr;
+        struct sockaddr_in6 *in6 = (struct sockaddr_in6*) addr;
+        size_t hl = strlen(host);
+        if (inet_pton(AF_INET, host, &in->sin_addr) == 1) {
+            in->sin_family = AF_INET;
+            in->sin_port = htons(p);
+            *addr_len = sizeof(*in);
+            return 0;
+        }
+        if (hl > 2 && host[0] == '[' && host[hl - 1] == ']') {
+            host[hl - 1] = '\0';
+            if (inet_pton(AF_INET6, host + 1, &in6->sin6_addr) == 1) {
+                in6->sin6_family = AF_INET6;
+                in6->sin6_port = htons(p);
+                *addr_len = sizeof(*in6);
+                return 0;
+            }
+        }
+    }
+    errno = EINVAL;
+    return -1;
+}
+
+/**
+ * Periodically sends the status and counters as fixed-layout binary frames over a unix datagram socket or UDP, so an
+ * aggregator can collect them from many servers without parsing anything. The status fields come from the status page
+ * (which is anonymous if NSWRAP_STATUS_FILE isn't set).
+ */
+struct ns_telemetry {
+    int timerfd;
+    int sockfd;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    struct ns_telemetry_frame f;
+    uint64_t start_ns;
+    uint64_t last_ns;
+    uint64_t output_bytes;
+    uint64_t titles;
+    uint64_t loads;
+    uint64_t cadence[NS_TELEMETRY_CADENCE];
+    char mem_path[PATH_MAX + 32];
+    bool mem_cgroup;
+    uint64_t failed;
+    char msg[160];
+};
+
+static uint64_t ns_telemetry_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/** Initializes a ns_telemetry which sends to addr every interval_ms. Returns 0 on success, or -1 with errno set. */
+static int ns_telemetry_init(struct ns_telemetry *t, const char *addr, int interval_ms, const char *id, uint32_t restarts) {
+    *t = (struct ns_telemetry) {
+        .timerfd = -1,
+        .sockfd = -1,
+        .f = {
+            .magic = NS_TELEMETRY_MAGIC,
+            .version = NS_TELEMETRY_VERSION,
+            .size = NS_TELEMETRY_FRAME_SIZE,
+            .nswrap_pid = getpid(),
+            .restarts = restarts,
+        },
+    };
+    if (ns_telemetry_addr(addr, &t->addr, &t->addr_len)) {
+        return -1;
+    }
+    snprintf(t->f.id, sizeof(t->f.id), "%s", id);
+    if (getrandom(&t->f.session, sizeof(t->f.session), GRND_NONBLOCK) != sizeof(t->f.session)) {
+        t->f.session = ns_telemetry_now() ^ ((uint64_t) getpid() << 32);
+    }
+    t->start_ns = t->last_ns = ns_telemetry_now();
+
+    if ((t->sockfd = socket(t->addr.ss_family, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0)) == -1) {
+        preserve_errno({
+            ns_perror_dbg("create socket");
+        });
+        return -1;
+    }
+    t->timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (t->timerfd == -1) {
+        preserve_errno({
+            ns_perror_dbg("create timerfd");
+            close(t->sockfd);
+            t->sockfd = -1;
+        });
+        return -1;
+    }
+    struct timespec iv = {
+        .tv_sec = interval_ms / 1000,
+        .tv_nsec = interval_ms % 1000 * 1000000L,
+    };
+    if (timerfd_settime(t->timerfd, 0, &(struct itimerspec) {
+        .it_value = iv,
+        .it_interval = iv,
+    }, NULL) == -1) {
+        preserve_errno({
+            ns_perror_dbg("set timerfd");
+            close(t->timerfd);
+            close(t->sockfd);
+            t->timerfd = t->sockfd = -1;
+        });
+        return -1;
+    }
+    return 0;
+}
+
+/** Frees the timer and socket. */
+static void ns_telemetry_close(struct ns_telemetry *t) {
+    if (t->timerfd != -1) {
+        close(t->timerfd);
+        t->timerfd = -1;
+    }
+    if (t->sockfd != -1) {
+        close(t->sockfd);
+        t->sockfd = -1;
+    }
+}
+
+/** Sets the server's memory usage source: the cgroup if it has the memory controller, otherwise the wine process. */
+static void ns_telemetry_pid(struct ns_telemetry *t, pid_t pid, const char *cgroup) {
+    if (t->timerfd != -1) {
+        snprintf(t->mem_path, sizeof(t->mem_path), "%s/memory.current", cgroup);
+        if (!(t->mem_cgroup = *cgroup && access(t->mem_path, R_OK) == 0)) {
+            snprintf(t->mem_path, sizeof(t->mem_path), "/proc/%d/statm", pid);
+        }
+    }
+}
+
+/** Gets the server's memory usage in KiB, or 0 if it isn't known. */
+static uint32_t ns_telemetry_memory(struct ns_telemetry *t) {
+    char buf[128];
+    unsigned long long v;
+    if (!*t->mem_path || ns_read_file(t->mem_path, buf, sizeof(buf)) == -1) {
+        return 0;
+    }
+    if (t->mem_cgroup) {
+        return sscanf(buf, "%llu", &v) == 1 ? v / 1024 : 0;
+    }
+    return sscanf(buf, "%*u %llu", &v) == 1 ? v * (sysconf(_SC_PAGESIZE) / 1024) : 0;
+}
+
+/** Sends a frame with the status and the counters since the last one. Returns 0 on success, or -1 with errno set. */
+static int ns_telemetry_send(struct ns_telemetry *t, const struct ns_statuspage_data *d, const struct ns_cadence *c, uint32_t flags) {
+    uint64_t now = ns_telemetry_now();
+    struct ns_telemetry_frame f = t->f;
+    f.seq = t->f.seq++;
+    f.interval_ms = (now - t->last_ns) / 1000000;
+    f.uptime_sec = (now - t->start_ns) / 1000000000;
+    f.flags = d->flags | flags;
+    f.player_count = d->player_count;
+    f.max_players = d->max_players;
+    memcpy(f.map_name, d->map_name, sizeof(f.map_name));
+    memcpy(f.playlist_name, d->playlist_name, sizeof(f.playlist_name));
+    f.map_name[sizeof(f.map_name) - 1] = f.playlist_name[sizeof(f.playlist_name) - 1] = '\0';
+    f.output_bytes = d->output_bytes - t->output_bytes;
+    f.titles = d->titles - t->titles;
+    f.memory_kib = ns_telemetry_memory(t);
+    f.watchdog_timeout_ms = d->watchdog_timeout_ms;
+    f.watchdog_loads = d->watchdog_loads - t->loads;
+
+    // the bins are cumulative like the buckets, and anything which doesn't fit is left for the next frame
+    uint64_t cadence[NS_TELEMETRY_CADENCE] = {};
+    for (size_t i = 0, b = 0; i < NS_CADENCE_BUCKETS; i++) {
+        while (b < NS_TELEMETRY_CADENCE - 1 && ns_cadence_bucket_us(i) > ns_telemetry_cadence_us[b]) {
+            b++;
+        }
+        cadence[b] += c->buckets[i];
+    }
+    for (size_t b = 0; b < NS_TELEMETRY_CADENCE; b++) {
+        uint64_t x = cadence[b] - t->cadence[b];
+        f.cadence[b] = x > UINT16_MAX ? UINT16_MAX : x;
+    }
+
+    uint8_t buf[NS_TELEMETRY_FRAME_SIZE];
+    ns_telemetry_encode(&f, buf);
+    if (sendto(t->sockfd, buf, sizeof(buf), MSG_DONTWAIT | MSG_NOSIGNAL, (struct sockaddr*) &t->addr, t->addr_len) == -1) {
+        return -1;
+    }
+    t->last_ns = now;
+    t->output_bytes += f.output_bytes;
+    t->titles += f.titles;
+    t->loads += f.watchdog_loads;
+    for (size_t b = 0; b < NS_TELEMETRY_CADENCE; b++) {
+        t->cadence[b] += f.cadence[b];
+    }
+    return 0;
+}
+
+/** Adds the telemetry timer to the epoll file descriptor. */
+static int ns_telemetry_epoll_add(struct ns_telemetry *t, int fd) {
+    return epoll_ctl(fd, EPOLL_CTL_ADD, t->timerfd, &(struct epoll_event) {
+        .events = EPOLLIN,
+        .data.fd = t->timerfd,
+    });
+}
+
+/** Checks if an epoll event matches the telemetry timer. */
+static bool ns_telemetry_epoll_check(struct ns_telemetry *t, struct epoll_event ev) {
+    return t->timerfd != -1 && ev.data.fd == t->timerfd;
+}
+
+/**
+ * Processes an epoll event, sending a frame. Returns a message to log (only when sending starts failing or works again
+ * so it doesn't spam the log while the aggregator is down), or an empty string.
+ */
+static const char *ns_telemetry_epoll_process(struct ns_telemetry *t, const struct ns_statuspage_data *d, const struct ns_cadence *c) {
+    uint64_t v;
+    *t->msg = '\0';
+    if (read(t->timerfd, &v, sizeof(v)) == -1) {
+        return t->msg;
+    }
+    if (ns_telemetry_send(t, d, c, 0)) {
+        if (!t->failed++) {
+            snprintf(t->msg, sizeof(t->msg), "warning: failed to send telemetry: %s (will keep trying)", strerror(errno));
+        }
+    } else if (t->failed) {
+        snprintf(t->msg, sizeof(t->msg), "sending telemetry again after %llu failed frames", (unsigned long long) (t->failed));
+        t->failed = 0;
+    }
+    return t->msg;
+}
+
+int main(int argc, char **argv) {
+    if (argc <= 1) {
+        fprintf(stderr, "usage: %s game_dir [args...]\n", argc ? argv[0] : "nswrap");
+        return 2;
+    }
+
+    if (geteuid() == 0) {
+        ns_log("error: this program must not be run as root");
+        return 1;
+    }
+
+    // init setproctitle and attempt to ensure there is a placeholder arg consisting of spaces
+    for (const char *x = argv[argc - 1]; *x; x++) {
+        if (*x != ' ') {
+            char **nargv = alloca(argc + 2*sizeof(char*));
+            for (int i = 0; i < argc; i++) {
+                nargv[i] = argv[i];
+            }
+            nargv[argc] = "                                                                                                                                ";
+            nargv[argc+1] = NULL;
+            if (execve("/proc/self/exe", nargv, environ) == -1) {
+                ns_perror("warning: self-exec with additional space in argv for process title failed: execve");
+                argc++;
+            }
+            break;
+        }
+    }
+    argc--;
+    setproctitle(argv, NULL);
+    argv[argc] = NULL;
+
+    struct ns_startup st_startup;
+    ns_startup_init(&st_startup, getenv("NSWRAP_STARTUP"));
+
+    if (chdir(argv[1])) {
+        ns_perror("error: chdir '%s'", argv[1]);
+        return 1;
+    }
+
+    if (access("NorthstarLauncher.exe", F_OK)) {
+        ns_log("error: NorthstarLauncher.exe missing");
+        return 1;
+    }
+
+    int np = nprocs();
     struct sysinfo sinfo;
     struct utsname uinfo;
     if (sysinfo(&sinfo) == -1) {
@@ -955,9 +4633,45 @@ int main(int argc, char **argv) {
         ns_log("  USER=%s", getenv("USER") ?: "(null)");
         ns_log("  HOSTNAME=%s", getenv("HOSTNAME") ?: "(null)");
         ns_log("  DISPLAY=%s", getenv("DISPLAY") ?: "(null)");
+        ns_log("  NSWRAP_HEADLESS=%s", getenv("NSWRAP_HEADLESS") ?: "(null)");
+        ns_log("  NSWRAP_TIMERSLACK=%s", getenv("NSWRAP_TIMERSLACK") ?: "(null)");
+        ns_log("  NSWRAP_PRELOAD=%s", getenv("NSWRAP_PRELOAD") ?: "(null)");
         ns_log("  WINEPREFIX=%s", getenv("WINEPREFIX") ?: "(null)");
         ns_log("  WINEDEBUG=%s", getenv("WINEDEBUG") ?: "(null)");
         ns_log("  WINESERVER=%s", getenv("WINESERVER") ?: "(null)");
+        ns_log("  NSWRAP_STDOUT_BUFFER=%s", getenv("NSWRAP_STDOUT_BUFFER") ?: "(null)");
+        ns_log("  NSWRAP_STDOUT_POLICY=%s", getenv("NSWRAP_STDOUT_POLICY") ?: "(null)");
+        ns_log("  NSWRAP_STDOUT_SPILL=%s", getenv("NSWRAP_STDOUT_SPILL") ?: "(null)");
+        ns_log("  NSWRAP_CONSOLE_FD=%s", getenv("NSWRAP_CONSOLE_FD") ?: "(null)");
+        ns_log("  NSWRAP_CONSOLE_LOG_DIR=%s", getenv("NSWRAP_CONSOLE_LOG_DIR") ?: "(null)");
+        ns_log("  NSWRAP_CONSOLE_LOG_RING=%s", getenv("NSWRAP_CONSOLE_LOG_RING") ?: "(null)");
+        ns_log("  NSWRAP_CONSOLE_LOG_ROTATE=%s", getenv("NSWRAP_CONSOLE_LOG_ROTATE") ?: "(null)");
+        ns_log("  NSWRAP_CONSOLE_LOG_KEEP=%s", getenv("NSWRAP_CONSOLE_LOG_KEEP") ?: "(null)");
+        ns_log("  NSWRAP_CONSOLE_LOG_COMPRESS=%s", getenv("NSWRAP_CONSOLE_LOG_COMPRESS") ?: "(null)");
+        ns_log("  NSWRAP_DIAG_TIMEOUT=%s", getenv("NSWRAP_DIAG_TIMEOUT") ?: "(null)");
+        ns_log("  NSWRAP_DIAG_CMD=%s", getenv("NSWRAP_DIAG_CMD") ?: "(null)");
+        ns_log("  NSWRAP_PROF_DIR=%s", getenv("NSWRAP_PROF_DIR") ?: "(null)");
+        ns_log("  NSWRAP_PROF_INTERVAL=%s", getenv("NSWRAP_PROF_INTERVAL") ?: "(null)");
+        ns_log("  NSWRAP_PROF_PERF_SECONDS=%s", getenv("NSWRAP_PROF_PERF_SECONDS") ?: "(null)");
+        ns_log("  NSWRAP_NETSTAT_INTERVAL=%s", getenv("NSWRAP_NETSTAT_INTERVAL") ?: "(null)");
+        ns_log("  NSWRAP_WATCHDOG_BOOT=%s", getenv("NSWRAP_WATCHDOG_BOOT") ?: "(null)");
+        ns_log("  NSWRAP_WATCHDOG_MIN=%s", getenv("NSWRAP_WATCHDOG_MIN") ?: "(null)");
+        ns_log("  NSWRAP_WATCHDOG_MAX=%s", getenv("NSWRAP_WATCHDOG_MAX") ?: "(null)");
+        ns_log("  NSWRAP_WATCHDOG_LOAD=%s", getenv("NSWRAP_WATCHDOG_LOAD") ?: "(null)");
+        ns_log("  NSWRAP_WATCHDOG_FACTOR=%s", getenv("NSWRAP_WATCHDOG_FACTOR") ?: "(null)");
+        ns_log("  NSWRAP_DRAIN=%s", getenv("NSWRAP_DRAIN") ?: "(null)");
+        ns_log("  NSWRAP_DRAIN_CMD=%s", getenv("NSWRAP_DRAIN_CMD") ?: "(null)");
+        ns_log("  NSWRAP_STATUS_FILE=%s", getenv("NSWRAP_STATUS_FILE") ?: "(null)");
+        ns_log("  NSWRAP_TELEMETRY=%s", getenv("NSWRAP_TELEMETRY") ?: "(null)");
+        ns_log("  NSWRAP_TELEMETRY_INTERVAL=%s", getenv("NSWRAP_TELEMETRY_INTERVAL") ?: "(null)");
+        ns_log("  NSWRAP_TELEMETRY_ID=%s", getenv("NSWRAP_TELEMETRY_ID") ?: "(null)");
+        ns_log("  NSWRAP_RESTARTS=%s", getenv("NSWRAP_RESTARTS") ?: "(null)");
+        ns_log("  NSWRAP_CGROUP=%s", getenv("NSWRAP_CGROUP") ?: "(null)");
+        ns_log("  NSWRAP_PSI_WAIT=%s", getenv("NSWRAP_PSI_WAIT") ?: "(null)");
+        ns_log("  NSWRAP_PSI_THROTTLE=%s", getenv("NSWRAP_PSI_THROTTLE") ?: "(null)");
+        ns_log("  NSWRAP_PSI_MEMORY=%s", getenv("NSWRAP_PSI_MEMORY") ?: "(null)");
+        ns_log("  NSWRAP_PSI_IO=%s", getenv("NSWRAP_PSI_IO") ?: "(null)");
+        ns_log("  NSWRAP_PSI_CPU=%s", getenv("NSWRAP_PSI_CPU") ?: "(null)");
         ns_log("");
         ns_log("system info:");
         ns_log("  kernel: %s %s %s %s %s", uinfo.sysname, uinfo.nodename, uinfo.release, uinfo.version, uinfo.machine);
@@ -967,32 +4681,209 @@ int main(int argc, char **argv) {
         ns_log("");
     }
 
-    const char *wineprefix = getenv("WINEPREFIX");
-    if (!wineprefix || *wineprefix != '/' || access(wineprefix, F_OK|R_OK|W_OK|X_OK)) {
-        if (!wineprefix) {
-            ns_log("error: WINEPREFIX not set");
-        } else if (*wineprefix != '/') {
-            ns_log("error: invalid WINEPREFIX '%s': not an absolute path", wineprefix);
-        } else {
-            ns_perror("error: invalid WINEPREFIX '%s'", wineprefix);
-        }
-        ns_log("note: the wineprefix must set HKCU\\Software\\Wine\\WineDbg\\ShowCrashDialog to DWORD:0, and HKCU\\Software\\Wine\\DllOverrides\\{mscoree,mshtml} to REG_SZ:\"\"");
-        ns_log("note: optionally, it should also set HKLM\\System\\CurrentControlSet\\Services\\WineBus\\{DisableHidraw,DisableInput} to REG_DWORD:1 and HKCU\\Software\\Wine\\Drivers\\Audio to REG_SZ:\"\"");
-        ns_log("note: if pg9182's d3d11 and gfsdk stubs are used, set HKCU\\Software\\Wine\\DllOverrides\\d3d11 to REG_SZ:\"native\" and HKCU\\Software\\Wine\\DllOverrides\\{d3d9,d3d10,d3d12,wined3d,winevulkan} to REG_SZ:\"\"");
-        ns_log("note: each instance of nswrap should have its own prefix (to save space, you can symlink files in system32), but it's not (currently) required");
-        ns_log("note: you can use the nswrap-wineprefix script to set up a new wineprefix");
+    const char *wineprefix = getenv("WINEPREFIX");
+    if (!wineprefix || *wineprefix != '/' || access(wineprefix, F_OK|R_OK|W_OK|X_OK)) {
+        if (!wineprefix) {
+            ns_log("error: WINEPREFIX not set");
+        } else if (*wineprefix != '/') {
+            ns_log("error: invalid WINEPREFIX '%s': not an absolute path", wineprefix);
+        } else {
+            ns_perror("error: invalid WINEPREFIX '%s'", wineprefix);
+        }
+        ns_log("note: the wineprefix must set HKCU\\Software\\Wine\\WineDbg\\ShowCrashDialog to DWORD:0, and HKCU\\Software\\Wine\\DllOverrides\\{mscoree,mshtml} to REG_SZ:\"\"");
+        ns_log("note: optionally, it should also set HKLM\\System\\CurrentControlSet\\Services\\WineBus\\{DisableHidraw,DisableInput} to REG_DWORD:1 and HKCU\\Software\\Wine\\Drivers\\Audio to REG_SZ:\"\"");
+        ns_log("note: if pg9182's d3d11 and gfsdk stubs are used, set HKCU\\Software\\Wine\\DllOverrides\\d3d11 to REG_SZ:\"native\" and HKCU\\Software\\Wine\\DllOverrides\\{d3d9,d3d10,d3d12,wined3d,winevulkan} to REG_SZ:\"\"");
+        ns_log("note: each instance of nswrap should have its own prefix (to save space, you can symlink files in system32), but it's not (currently) required");
+        ns_log("note: you can use the nswrap-wineprefix script to set up a new wineprefix");
+        return 1;
+    }
+
+    if (!getenv("WINEDEBUG")) {
+        ns_log("using WINEDEBUG='%s'", WINEDEBUG_DEFAULT);
+    } else {
+        ns_log("warning: WINEDEBUG has been overridden to '%s' (replacing the recommended value '%s')", getenv("WINEDEBUG"), WINEDEBUG_DEFAULT);
+    }
+
+    unsigned long headless = 0;
+    if (getenvul("NSWRAP_HEADLESS", 0, 1, &headless)) {
+        return 1;
+    }
+    if (headless) {
+        ns_log("running headless; this requires pg9182's Wine build (which has the CreateWindow patch) and d3d11 and gfsdk stubs");
+        unsetenv("DISPLAY");
+    } else if (!getenv("DISPLAY")) {
+        ns_log("warning: no X server running");
+        ns_log("note: Xvfb is sufficient as long as you're using pg9182's d3d11 and gfsdk stubs");
+    }
+
+    // Wine's non-alertable Sleep is a plain select(2), and the wineserver's timeouts are a plain epoll_wait(2), so the
+    // timer slack (which is inherited by every process and thread wine creates) is added to every sleep in the game loop
+    unsigned long timerslack = 0;
+    if (getenvul("NSWRAP_TIMERSLACK", 0, 1000000000, &timerslack)) {
+        return 1;
+    }
+    if (timerslack) {
+        ns_log("using a timer slack of %luns for wine (default: %dns)", timerslack, prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0));
+    }
+
+    unsigned long preload = 0;
+    if (getenvul("NSWRAP_PRELOAD", 0, 1, &preload)) {
+        return 1;
+    }
+
+    unsigned long outbuf_size = NS_OUTBUF_DEFAULT_SIZE;
+    if (getenvul("NSWRAP_STDOUT_BUFFER", NS_IOPROC_OUTPUT_CHUNK_SIZE * 2, SIZE_MAX, &outbuf_size)) {
+        return 1;
+    }
+
+    enum ns_outbuf_policy outbuf_policy = NS_OUTBUF_POLICY_DROP;
+    if (getenv("NSWRAP_STDOUT_POLICY")) {
+        const char *v = getenv("NSWRAP_STDOUT_POLICY");
+        if (!strcmp(v, "drop")) {
+            outbuf_policy = NS_OUTBUF_POLICY_DROP;
+        } else if (!strcmp(v, "spill")) {
+            outbuf_policy = NS_OUTBUF_POLICY_SPILL;
+            if (!getenv("NSWRAP_STDOUT_SPILL") || !*getenv("NSWRAP_STDOUT_SPILL")) {
+                ns_log("error: NSWRAP_STDOUT_SPILL must be set when NSWRAP_STDOUT_POLICY is 'spill'");
+                return 1;
+            }
+        } else if (!strcmp(v, "block")) {
+            outbuf_policy = NS_OUTBUF_POLICY_BLOCK;
+        } else {
+            ns_log("error: invalid NSWRAP_STDOUT_POLICY '%s': must be drop, spill, or block", v);
+            return 1;
+        }
+    }
+
+    unsigned long conin_fd = 0;
+    if (getenvul("NSWRAP_CONSOLE_FD", 3, INT_MAX, &conin_fd)) {
+        return 1;
+    }
+    if (conin_fd && fcntl(conin_fd, F_GETFD) == -1) {
+        ns_perror("error: invalid NSWRAP_CONSOLE_FD %lu", conin_fd);
+        return 1;
+    }
+
+    const char *conlog_dir = getenv("NSWRAP_CONSOLE_LOG_DIR");
+    unsigned long conlog_ring = NS_CONLOG_DEFAULT_RING_SIZE, conlog_rotate = 0, conlog_keep = NS_CONLOG_DEFAULT_KEEP;
+    if (getenvul("NSWRAP_CONSOLE_LOG_RING", 4096, 1UL << 32, &conlog_ring)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_CONSOLE_LOG_ROTATE", 0, SIZE_MAX, &conlog_rotate)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_CONSOLE_LOG_KEEP", 1, 1000, &conlog_keep)) {
+        return 1;
+    }
+    enum ns_conlog_compress conlog_compress = NS_CONLOG_COMPRESS_NONE;
+    if (getenv("NSWRAP_CONSOLE_LOG_COMPRESS")) {
+        const char *v = getenv("NSWRAP_CONSOLE_LOG_COMPRESS");
+        if (!strcmp(v, "none")) {
+            conlog_compress = NS_CONLOG_COMPRESS_NONE;
+        } else if (!strcmp(v, "zstd")) {
+            conlog_compress = NS_CONLOG_COMPRESS_ZSTD;
+        } else if (!strcmp(v, "lz4")) {
+            conlog_compress = NS_CONLOG_COMPRESS_LZ4;
+        } else {
+            ns_log("error: invalid NSWRAP_CONSOLE_LOG_COMPRESS '%s': must be none, zstd, or lz4", v);
+            return 1;
+        }
+    }
+    unsigned long diag_timeout = 0;
+    if (getenvul("NSWRAP_DIAG_TIMEOUT", 0, 300, &diag_timeout)) {
+        return 1;
+    }
+    if (diag_timeout && !conlog_dir) {
+        ns_log("error: NSWRAP_CONSOLE_LOG_DIR must be set when NSWRAP_DIAG_TIMEOUT is set");
+        return 1;
+    }
+    if (conlog_dir && *conlog_dir != '/') {
+        ns_log("error: invalid NSWRAP_CONSOLE_LOG_DIR '%s': not an absolute path", conlog_dir);
+        return 1;
+    }
+
+    const char *prof_dir = getenv("NSWRAP_PROF_DIR");
+    unsigned long prof_interval = 1000, prof_perf_sec = 10;
+    if (getenvul("NSWRAP_PROF_INTERVAL", 100, 60000, &prof_interval)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_PROF_PERF_SECONDS", 0, 300, &prof_perf_sec)) {
+        return 1;
+    }
+    if (prof_dir && *prof_dir != '/') {
+        ns_log("error: invalid NSWRAP_PROF_DIR '%s': not an absolute path", prof_dir);
+        return 1;
+    }
+
+    unsigned long netstat_interval = 0;
+    if (getenvul("NSWRAP_NETSTAT_INTERVAL", 0, 3600, &netstat_interval)) {
+        return 1;
+    }
+
+    unsigned long watchdog_boot = 4 * 60, watchdog_min = 0, watchdog_max = 60, watchdog_load = 0, watchdog_factor = 10;
+    if (getenvul("NSWRAP_WATCHDOG_BOOT", 10, 3600, &watchdog_boot)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_WATCHDOG_MIN", 1, 3600, &watchdog_min)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_WATCHDOG_MAX", 1, 3600, &watchdog_max)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_WATCHDOG_LOAD", 1, 3600, &watchdog_load)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_WATCHDOG_FACTOR", 1, 1000, &watchdog_factor)) {
+        return 1;
+    }
+    if (!watchdog_min) {
+        watchdog_min = watchdog_max; // only adapt the timeout if it's opted into
+    } else if (watchdog_max < watchdog_min) {
+        watchdog_max = watchdog_min;
+    }
+    if (watchdog_load < watchdog_max) {
+        watchdog_load = watchdog_max; // also the default, so a gap is never tolerated for longer unless it's opted into
+    }
+
+    unsigned long drain_sec = 0;
+    if (getenvul("NSWRAP_DRAIN", 0, 86400, &drain_sec)) {
         return 1;
     }
+    const char *drain_cmd = getenv("NSWRAP_DRAIN_CMD") ?: "ns_report_server_to_masterserver 0";
 
-    if (!getenv("WINEDEBUG")) {
-        ns_log("using WINEDEBUG='%s'", WINEDEBUG_DEFAULT);
-    } else {
-        ns_log("warning: WINEDEBUG has been overridden to '%s' (replacing the recommended value '%s')", getenv("WINEDEBUG"), WINEDEBUG_DEFAULT);
+    const char *telemetry = getenv("NSWRAP_TELEMETRY");
+    if (telemetry && !*telemetry) {
+        telemetry = NULL;
+    }
+    unsigned long telemetry_interval = 1000, restarts = 0;
+    if (getenvul("NSWRAP_TELEMETRY_INTERVAL", 100, 3600000, &telemetry_interval)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_RESTARTS", 0, UINT32_MAX, &restarts)) {
+        return 1;
+    }
+    char telemetry_id[64];
+    if (getenv("NSWRAP_TELEMETRY_ID")) {
+        snprintf(telemetry_id, sizeof(telemetry_id), "%s", getenv("NSWRAP_TELEMETRY_ID"));
+    } else if (gethostname(telemetry_id, sizeof(telemetry_id))) {
+        *telemetry_id = '\0';
     }
 
-    if (!getenv("DISPLAY")) {
-        ns_log("warning: no X server running");
-        ns_log("note: Xvfb is sufficient as long as you're using pg9182's d3d11 and gfsdk stubs");
+    unsigned long psi_wait = 0, psi_throttle = 0, psi_mem = 10, psi_io = 40, psi_cpu = 0;
+    if (getenvul("NSWRAP_PSI_WAIT", 0, 3600, &psi_wait)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_PSI_THROTTLE", 0, 3600, &psi_throttle)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_PSI_MEMORY", 0, 100, &psi_mem)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_PSI_IO", 0, 100, &psi_io)) {
+        return 1;
+    }
+    if (getenvul("NSWRAP_PSI_CPU", 0, 100, &psi_cpu)) {
+        return 1;
     }
 
     if (np < NS_REQUIRED_CORES) {
@@ -1009,7 +4900,7 @@ int main(int argc, char **argv) {
     defer(close(fd_epoll));
 
     int fd_pipe_errno[2];
-    if (pipe2(fd_pipe_errno, O_DIRECT | O_NONBLOCK)) {
+    if (pipe2(fd_pipe_errno, O_DIRECT | O_NONBLOCK | O_CLOEXEC)) {
         ns_perror("error: failed to create errno pipe");
         return 1;
     }
@@ -1027,6 +4918,7 @@ int main(int argc, char **argv) {
     sigaddset(&mask, SIGINT);
     sigaddset(&mask, SIGTERM);
     sigaddset(&mask, SIGCHLD);
+    sigaddset(&mask, SIGUSR1);
 
     int fd_signalfd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
     if (fd_signalfd == -1) {
@@ -1035,6 +4927,13 @@ int main(int argc, char **argv) {
     }
     defer(close(fd_signalfd));
 
+    // block them now rather than after starting wine so a stop while we're still waiting to start it doesn't kill us
+    // before the defers run (children restore the mask before exec)
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
+        ns_perror("error: failed to register signal handlers: mask signals");
+        return 1;
+    }
+
     if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_signalfd, &(struct epoll_event) {
         .events  = EPOLLIN,
         .data.fd = fd_signalfd,
@@ -1059,7 +4958,7 @@ int main(int argc, char **argv) {
     }
 
     struct ns_watchdog st_watchdog;
-    if (ns_watchdog_init(&st_watchdog, 10, 4 * 60, 60)) {
+    if (ns_watchdog_init(&st_watchdog, 10, watchdog_boot, watchdog_min, watchdog_max, watchdog_load, watchdog_factor)) {
         ns_perror("error: failed to create watchdog");
         return 1;
     }
@@ -1070,6 +4969,46 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    struct ns_statuspage st_statuspage = { .fd = -1 };
+    const char *status_file = getenv("NSWRAP_STATUS_FILE");
+    if (status_file && *status_file) {
+        if (ns_statuspage_init(&st_statuspage, status_file)) {
+            ns_perror("error: failed to create status page '%s'", status_file);
+            return 1;
+        }
+    } else if (telemetry) {
+        if (ns_statuspage_init(&st_statuspage, NULL)) {
+            ns_perror("error: failed to create status page");
+            return 1;
+        }
+    }
+    defer(ns_statuspage_close(&st_statuspage));
+
+    struct ns_telemetry st_telemetry = { .timerfd = -1, .sockfd = -1 };
+    if (telemetry) {
+        if (ns_telemetry_init(&st_telemetry, telemetry, telemetry_interval, telemetry_id, restarts)) {
+            ns_perror("error: failed to init telemetry to '%s' (the address must be unix:/path or udp:ip:port)", telemetry);
+            return 1;
+        }
+        if (ns_telemetry_epoll_add(&st_telemetry, fd_epoll)) {
+            ns_perror("error: failed to add telemetry to epoll");
+            return 1;
+        }
+    }
+    defer(ns_telemetry_close(&st_telemetry));
+
+    struct ns_drain st_drain;
+    if (ns_drain_init(&st_drain)) {
+        ns_perror("error: failed to create drain timer");
+        return 1;
+    }
+    defer(ns_drain_close(&st_drain));
+
+    if (ns_drain_epoll_add(&st_drain, fd_epoll)) {
+        ns_perror("error: failed to add drain timer to epoll");
+        return 1;
+    }
+
     struct ns_ioproc st_ioproc;
     if (ns_ioproc_init(&st_ioproc)) {
         ns_perror("error: failed to init i/o processor");
@@ -1082,15 +5021,138 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    struct ns_conin st_conin = { .fd = -1 };
+    if (conin_fd) {
+        if (ns_conin_init(&st_conin, conin_fd)) {
+            ns_perror("error: failed to init console input");
+            return 1;
+        }
+        if (ns_conin_epoll_add(&st_conin, fd_epoll)) {
+            ns_perror("error: failed to add console input to epoll");
+            return 1;
+        }
+    }
+    defer(ns_conin_close(&st_conin));
+
     if (ns_ioproc_title_epoll_add(&st_ioproc, fd_epoll)) {
         ns_perror("error: failed to add title pipe to epoll");
         return 1;
     }
 
+    struct ns_outbuf st_outbuf;
+    fflush(stdout);
+    if (ns_outbuf_init(&st_outbuf, STDOUT_FILENO, outbuf_size, outbuf_policy, getenv("NSWRAP_STDOUT_SPILL"))) {
+        ns_perror("error: failed to init stdout writer");
+        return 1;
+    }
+    defer(ns_outbuf_close(&st_outbuf));
+
+    if (ns_outbuf_epoll_add(&st_outbuf, fd_epoll)) {
+        ns_perror("error: failed to add stdout to epoll");
+        return 1;
+    }
+
+    // log through a buffer too so a stalled consumer can't block the event loop, sharing the stdout one if they're the
+    // same file (e.g., a tty, or a single pipe for both) so lines aren't interleaved
+    struct ns_outbuf st_errbuf = { .fd = -1 };
+    {
+        struct stat st1, st2;
+        fflush(stderr);
+        if (fstat(STDOUT_FILENO, &st1) == 0 && fstat(STDERR_FILENO, &st2) == 0 && st1.st_dev == st2.st_dev && st1.st_ino == st2.st_ino) {
+            ns_log_outbuf = &st_outbuf;
+        } else if (ns_outbuf_init(&st_errbuf, STDERR_FILENO, outbuf_size, outbuf_policy, getenv("NSWRAP_STDOUT_SPILL"))) {
+            ns_perror("error: failed to init stderr writer");
+            return 1;
+        } else if (ns_outbuf_epoll_add(&st_errbuf, fd_epoll)) {
+            ns_perror("error: failed to add stderr to epoll");
+            ns_outbuf_close(&st_errbuf);
+            return 1;
+        } else {
+            ns_log_outbuf = &st_errbuf;
+        }
+    }
+    defer(if (st_errbuf.fd != -1) ns_outbuf_close(&st_errbuf));
+
+    struct ns_conlog st_conlog = { .fd_log = -1 };
+    if (conlog_dir && ns_conlog_init(&st_conlog, conlog_dir, conlog_ring, conlog_rotate, conlog_keep, conlog_compress)) {
+        ns_perror("error: failed to init console log");
+        return 1;
+    }
+    bool st_conlog_clean = false;
+    defer(ns_conlog_close(&st_conlog, st_conlog_clean));
+
+    struct ns_cadence st_cadence = {};
+
+    struct ns_prof st_prof = { .timerfd = -1, .sockfd = -1, .perf_pid = -1 };
+    if (prof_dir) {
+        if (ns_prof_init(&st_prof, prof_dir, prof_interval, prof_perf_sec)) {
+            ns_perror("error: failed to init profiler");
+            return 1;
+        }
+        st_prof.cadence = &st_cadence;
+        if (ns_prof_epoll_add(&st_prof, fd_epoll)) {
+            ns_perror("error: failed to add profiler to epoll");
+            return 1;
+        }
+        if (prof_perf_sec) {
+            char buf[16];
+            if (ns_read_file("/proc/sys/kernel/perf_event_paranoid", buf, sizeof(buf)) != -1 && atoi(buf) > 1) {
+                ns_log("warning: kernel.perf_event_paranoid is %d; perf will probably not be able to record stacks unless it is set to 1 or lower", atoi(buf));
+            }
+        }
+    }
+    defer(ns_prof_close(&st_prof));
+
+    struct ns_netstat st_netstat = { .timerfd = -1 };
+    if (netstat_interval) {
+        if (ns_netstat_init(&st_netstat, netstat_interval)) {
+            ns_perror("error: failed to init traffic stats");
+            return 1;
+        }
+        if (ns_netstat_epoll_add(&st_netstat, fd_epoll)) {
+            ns_perror("error: failed to add traffic stats to epoll");
+            return 1;
+        }
+    }
+    defer(ns_netstat_close(&st_netstat));
+
     if (prctl(PR_SET_CHILD_SUBREAPER, 1, 0, 0, 0)) {
         ns_log("warning: failed to set the child subreaper; processes will not be reaped");
     }
 
+    struct ns_psi st_psi = { .trigfd = { -1, -1, -1 }, .timerfd = -1 };
+    if (psi_wait || psi_throttle) {
+        if (ns_psi_init(&st_psi, psi_mem, psi_io, psi_cpu)) {
+            if (errno == ENOENT) {
+                ns_log("warning: the kernel does not support PSI; not waiting for the pressure to go down");
+            } else {
+                ns_perror("warning: failed to init PSI");
+            }
+            psi_wait = psi_throttle = 0;
+        } else if (psi_throttle && ns_psi_epoll_add(&st_psi, fd_epoll)) {
+            ns_perror("error: failed to add PSI to epoll");
+            return 1;
+        }
+    }
+    defer(ns_psi_close(&st_psi));
+    ns_startup_mark(&st_startup, "nswrap");
+    if (psi_wait) {
+        int sig = ns_psi_wait(&st_psi, psi_wait, fd_signalfd);
+        if (sig) {
+            ns_log("received %s while waiting to start wine; exiting", sig == SIGINT ? "SIGINT" : "SIGTERM");
+            return 1;
+        }
+        ns_startup_mark(&st_startup, "psi");
+    }
+
+    static struct ns_preload st_preload; // static since the thread may outlive main
+    if (preload) {
+        const char *dirs[] = { "/usr/lib/wine", "." };
+        if (ns_preload_start(&st_preload, dirs, sizeof(dirs)/sizeof(*dirs))) {
+            ns_perror("warning: failed to start preload thread");
+        }
+    }
+
     pid_t xvfb_pid = -1;
     if (getenv("DISPLAY") && !strcmp(getenv("DISPLAY"), "xvfb")) {
         ns_log("starting xvfb");
@@ -1108,6 +5170,7 @@ int main(int argc, char **argv) {
         snprintf(buf, sizeof(buf), ":%d", display);
         ns_log("xvfb started on display %s with pid %d", buf, xvfb_pid);
         setenv("DISPLAY", buf, 1);
+        ns_startup_mark(&st_startup, "xvfb");
     }
     defer({
         if (xvfb_pid != -1) {
@@ -1130,29 +5193,57 @@ int main(int argc, char **argv) {
     }
     wine_argv[wine_argv_n] = NULL;
 
-    char **wine_envp = (char *[]) {
+    char *wine_env[] = {
         getenve("PATH") ?: "PATH=/usr/local/bin:/bin:/usr/bin",
         getenve("HOSTNAME") ?: "HOSTNAME=none",
         getenve("HOME") ?: "HOME=/",
         getenve("USER") ?: "USER=none",
         getenve("WINEDEBUG") ?: "WINEDEBUG=" WINEDEBUG_DEFAULT,
         getenve("WINEPREFIX"), // will not be null; already checked
-        getenve("DISPLAY"), // will not be null; already checked
+        getenve("DISPLAY"), // may be null if headless
         getenve("WINESERVER"), // may be null
-        NULL,
+        *st_prof.sock_env ? st_prof.sock_env : NULL,
+        headless ? "WINEHEADLESS=1" : NULL,
     };
+    int wine_envp_n = 0;
+    char **wine_envp = alloca(sizeof(wine_env) + sizeof(char *));
+    for (size_t i = 0; i < sizeof(wine_env)/sizeof(*wine_env); i++) {
+        if (wine_env[i]) {
+            wine_envp[wine_envp_n++] = wine_env[i];
+        }
+    }
+    wine_envp[wine_envp_n] = NULL;
 
     int fd_pty_slave = ns_ioproc_output_pty(&st_ioproc);
 
+    struct ns_cgroup st_cgroup;
+    const char *cgroup_parent = getenv("NSWRAP_CGROUP");
+    if (cgroup_parent && !*cgroup_parent) {
+        st_cgroup = (struct ns_cgroup) { .fd_procs = -1 };
+    } else if (ns_cgroup_init(&st_cgroup, cgroup_parent)) {
+        if (cgroup_parent) {
+            ns_perror("warning: failed to create cgroup in '%s'; remaining processes will not be killed on exit", cgroup_parent);
+        }
+    } else {
+        ns_log("using cgroup '%s'", st_cgroup.path);
+    }
+    defer(ns_cgroup_close(&st_cgroup));
+
     pid_t wine_pid = fork();
     if (!wine_pid) {
+        ns_cgroup_enter(&st_cgroup);
         setsid();
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
         ioctl(fd_pty_slave, TIOCSCTTY, 0);
         dup2(fd_pty_slave, 0);
         dup2(fd_pty_slave, 1);
         dup2(fd_pty_slave, 2);
         close(fd_pty_slave);
         close(fd_pipe_errno[0]);
+        if (timerslack) {
+            prctl(PR_SET_TIMERSLACK, timerslack, 0, 0, 0);
+        }
         execvpe(wine_argv[0], (char *const *) (wine_argv), (char *const *) (wine_envp));
         int n = errno;
         write(fd_pipe_errno[1], &n, sizeof(n));
@@ -1160,11 +5251,36 @@ int main(int argc, char **argv) {
         _exit(127);
     }
 
-    if (sigprocmask(SIG_BLOCK, &mask, NULL) == -1) {
-        ns_perror("error: failed to register signal handlers: mask signals");
+    close(fd_pipe_errno[1]); // so we get EOF when wine is executed
+    ns_startup_pid(&st_startup, wine_pid);
+    ns_statuspage_pid(&st_statuspage, wine_pid);
+    ns_telemetry_pid(&st_telemetry, wine_pid, st_cgroup.path);
+
+    // get notified when wine exits even if the SIGCHLD is coalesced, and so we don't need to poll for it while exiting
+    int fd_pidfd = syscall(434 /* SYS_pidfd_open */, wine_pid, 0);
+    if (fd_pidfd == -1) {
+        if (errno != ENOSYS) {
+            ns_perror("warning: failed to open pidfd for wine");
+        }
+    } else if (epoll_ctl(fd_epoll, EPOLL_CTL_ADD, fd_pidfd, &(struct epoll_event) {
+        .events = EPOLLIN,
+        .data.fd = fd_pidfd,
+    })) {
+        ns_perror("error: failed to add pidfd to epoll");
         kill(wine_pid, SIGKILL);
         return 1;
     }
+    defer({
+        if (fd_pidfd != -1) {
+            close(fd_pidfd);
+        }
+    });
+
+    if (psi_throttle) {
+        if (ns_psi_throttle(&st_psi, wine_pid, psi_throttle)) {
+            ns_perror("warning: failed to start PSI boot throttling");
+        }
+    }
 
     const char *nswrap_title = getenv("NSWRAP_TITLE");
     if (nswrap_title) {
@@ -1176,10 +5292,33 @@ int main(int argc, char **argv) {
     }
 
     bool st_exiting = false;
+    bool st_stop = false;
+    const char *st_snapshot_reason = NULL;
     uint64_t st_last_title_update = 0;
     bool st_shown_title_warning = false;
 
     for (;;) {
+        if (st_stop && !st_exiting) {
+            st_exiting = true;
+            ns_drain_stop(&st_drain);
+            if (timerfd_settime(fd_timerfd_exit, 0, &(struct itimerspec) {
+                .it_value.tv_sec = 4,
+            }, NULL)) {
+                ns_perror("error: failed to set exit timer\n");
+                goto cleanup;
+            }
+            ns_psi_throttle_stop(&st_psi); // it can't exit while it's paused
+            ns_watchdog_pause(&st_watchdog, false);
+            if (kill(wine_pid, SIGTERM)) {
+                ns_log("warning: failed to send SIGTERM to pid %ld", (long) (wine_pid));
+            }
+        }
+        ns_statuspage_flags(&st_statuspage,
+            (ns_watchdog_initialized(&st_watchdog) ? NS_STATUSPAGE_INITIALIZED : 0) |
+            (st_watchdog.loading ? NS_STATUSPAGE_LOADING : 0) |
+            (st_psi.paused ? NS_STATUSPAGE_PAUSED : 0) |
+            (st_drain.active ? NS_STATUSPAGE_DRAINING : 0) |
+            (st_exiting ? NS_STATUSPAGE_EXITING : 0));
         struct epoll_event evt;
         if (epoll_wait(fd_epoll, &evt, 1, -1) == -1) {
             if (errno != EINTR) {
@@ -1200,43 +5339,76 @@ int main(int argc, char **argv) {
                 if (st_exiting) {
                     ns_log("killing process");
                     goto cleanup;
-                } else {
-                    st_exiting = true;
                 }
                 if (siginfo.ssi_signo == SIGINT) {
                     ns_log("received SIGINT; waiting for server to exit (press ctrl-c again to kill)");
+                } else if (st_drain.active) {
+                    ns_log("received SIGTERM while draining; waiting for server to exit");
+                } else if (drain_sec && ns_watchdog_initialized(&st_watchdog)) {
+                    if (ns_drain_start(&st_drain, drain_sec)) {
+                        ns_perror("error: failed to start draining");
+                        goto cleanup;
+                    }
+                    ns_log("received SIGTERM; draining for up to %lus (send SIGTERM again to stop now)", drain_sec);
+                    if (*drain_cmd) {
+                        char cmd[512];
+                        int n = snprintf(cmd, sizeof(cmd), "%s\n", drain_cmd);
+                        if (n >= (int) sizeof(cmd) || ns_ioproc_input(&st_ioproc, cmd, n)) {
+                            ns_perror("warning: drain: failed to write '%s' to the console", drain_cmd);
+                        } else {
+                            ns_log("drain: sent '%s'", drain_cmd);
+                        }
+                    }
+                    if (ns_drain_update(&st_drain, st_watchdog.title)) {
+                        ns_log("drain: %s; stopping server", st_drain.msg);
+                        st_stop = true;
+                    } else if (*st_drain.msg) {
+                        ns_log("drain: %s", st_drain.msg);
+                    }
+                    break;
                 } else {
                     ns_log("received SIGTERM; waiting for server to exit");
                 }
-                if (timerfd_settime(fd_timerfd_exit, 0, &(struct itimerspec) {
-                    .it_value.tv_sec = 4,
-                }, NULL)) {
-                    ns_perror("error: failed to set exit timer\n");
-                    goto cleanup;
-                }
-                if (kill(wine_pid, SIGTERM)) {
-                    ns_log("warning: failed to send SIGTERM to pid %ld", (long) (wine_pid));
+                st_stop = true;
+                break;
+            case SIGUSR1:
+                if (ns_prof_perf(&st_prof)) {
+                    if (errno == ENOTSUP) {
+                        ns_log("warning: received SIGUSR1, but perf recording is not enabled; ignoring");
+                    } else if (errno == EBUSY) {
+                        ns_log("warning: received SIGUSR1, but perf is already recording; ignoring");
+                    } else {
+                        ns_perror("warning: profile: failed to start perf");
+                    }
+                } else {
+                    ns_log("profile: recording stacks with perf for %lus", prof_perf_sec);
                 }
                 break;
             case SIGCHLD:
-                if (siginfo.ssi_code == CLD_EXITED || siginfo.ssi_code == CLD_KILLED || siginfo.ssi_code == CLD_DUMPED) {
-                    if ((pid_t)(siginfo.ssi_pid) == wine_pid) {
+                // SIGCHLD isn't queued, so if multiple children exit at once (e.g., wine and an orphaned grandchild),
+                // we only get one signal, and ssi_pid is only one of them; check all exited children instead
+                for (;;) {
+                    siginfo_t chld = {0};
+                    if (waitid(P_ALL, 0, &chld, WEXITED | WNOHANG | WNOWAIT) == -1 || !chld.si_pid) {
+                        break;
+                    }
+                    if (chld.si_pid == wine_pid) {
                         // note: the process will be reaped later
                         goto cleanup;
-                    } else if ((pid_t)(siginfo.ssi_pid) == xvfb_pid) {
-                        if (siginfo.ssi_code == CLD_EXITED) {
-                            ns_log("warning: xvfb terminated: exited with status %d", siginfo.ssi_status);
-                        } else if (siginfo.ssi_code == CLD_KILLED) {
-                            ns_log("warning: xvfb terminated: killed by signal %d", siginfo.ssi_status);
-                        } else if (siginfo.ssi_code == CLD_DUMPED) {
+                    } else if (chld.si_pid == xvfb_pid) {
+                        if (chld.si_code == CLD_EXITED) {
+                            ns_log("warning: xvfb terminated: exited with status %d", chld.si_status);
+                        } else if (chld.si_code == CLD_KILLED) {
+                            ns_log("warning: xvfb terminated: killed by signal %d", chld.si_status);
+                        } else if (chld.si_code == CLD_DUMPED) {
                             ns_log("warning: xvfb dumped core");
                         }
                         xvfb_pid = -1;
-                        waitpid(siginfo.ssi_pid, NULL, WNOHANG); // reap the process
                     } else {
-                        waitpid(siginfo.ssi_pid, NULL, WNOHANG); // reap the process
-                        //ns_log("debug: reaped child %ld", (long) (siginfo.ssi_pid));
+                        ns_prof_perf_reaped(&st_prof, chld.si_pid, chld.si_code, chld.si_status);
+                        //ns_log("debug: reaped child %ld", (long) (chld.si_pid));
                     }
+                    waitpid(chld.si_pid, NULL, WNOHANG); // reap the process
                 }
                 break;
             default:
@@ -1245,20 +5417,89 @@ int main(int argc, char **argv) {
             }
             continue;
         }
+        if (ns_drain_epoll_check(&st_drain, evt)) {
+            if (ns_drain_epoll_process(&st_drain)) {
+                ns_log("drain: deadline reached with %d players left; stopping server", st_drain.players);
+                st_stop = true;
+            }
+            continue;
+        }
+        if (fd_pidfd != -1 && evt.data.fd == fd_pidfd) {
+            goto cleanup; // note: the process will be reaped later
+        }
         if (ns_watchdog_epoll_check(&st_watchdog, evt)) {
-            const char *err = ns_watchdog_epoll_process(&st_watchdog);
+            bool hang;
+            const char *err = ns_watchdog_epoll_process(&st_watchdog, &hang);
             if (!err) {
                 ns_perror("error: watchdog is buggy");
                 goto cleanup;
             }
+            if (!hang) {
+                if (*err) {
+                    ns_log("watchdog: %s", err);
+                }
+                continue;
+            }
             if (ns_watchdog_initialized(&st_watchdog)) {
                 ns_log("error: watchdog: %s", err);
+                st_snapshot_reason = "watchdog";
                 goto cleanup;
             } else {
                 ns_log("warning: watchdog: %s", err);
                 continue;
             }
         }
+        if (ns_prof_epoll_check(&st_prof, evt)) {
+            if (ns_prof_epoll_process(&st_prof, evt)) {
+                ns_perror("warning: profile: failed to sample threads");
+            }
+            continue;
+        }
+        if (ns_conin_epoll_check(&st_conin, evt)) {
+            if (ns_conin_epoll_process(&st_conin, &st_ioproc)) {
+                ns_perror("warning: failed to read console input");
+                ns_conin_close(&st_conin);
+            }
+            continue;
+        }
+        if (ns_psi_epoll_check(&st_psi, evt)) {
+            const char *line = ns_psi_epoll_process(&st_psi, evt);
+            if (*line) {
+                ns_log("%s", line);
+            }
+            if (ns_watchdog_pause(&st_watchdog, st_psi.paused)) {
+                ns_perror("warning: failed to pause the watchdog boot timer");
+            }
+            continue;
+        }
+        if (ns_netstat_epoll_check(&st_netstat, evt)) {
+            const char *line = ns_netstat_epoll_process(&st_netstat);
+            if (!line) {
+                ns_perror("warning: failed to read traffic stats");
+            } else {
+                ns_log("traffic: %s", line);
+            }
+            continue;
+        }
+        if (ns_telemetry_epoll_check(&st_telemetry, evt)) {
+            const char *line = ns_telemetry_epoll_process(&st_telemetry, st_statuspage.d, &st_cadence);
+            if (*line) {
+                ns_log("%s", line);
+            }
+            continue;
+        }
+        if (ns_ioproc_input_epoll_check(&st_ioproc, evt)) {
+            if (ns_ioproc_input_epoll_process(&st_ioproc)) {
+                ns_perror("warning: failed to write console input");
+            }
+            if (ns_conin_resume(&st_conin, &st_ioproc)) {
+                ns_perror("warning: failed to read console input");
+                ns_conin_close(&st_conin);
+            }
+            if (!(evt.events & ~EPOLLOUT)) {
+                continue;
+            }
+        }
         if (ns_ioproc_output_epoll_check(&st_ioproc, evt)) {
             size_t output_sz;
             const char *output = ns_ioproc_output_epoll_process(&st_ioproc, &output_sz);
@@ -1267,8 +5508,45 @@ int main(int argc, char **argv) {
                 goto cleanup;
             }
             if (output_sz) {
-                fwrite(output, 1, output_sz, stdout);
-                fflush(stdout);
+                ns_statuspage_output(&st_statuspage, output_sz);
+                if (!st_startup.done && !st_watchdog.last_title_ms) {
+                    ns_startup_mark(&st_startup, "output");
+                }
+            }
+            if (output_sz && ns_outbuf_write(&st_outbuf, output, output_sz)) {
+                ns_perror("error: failed to write output");
+                goto cleanup;
+            }
+            if (output_sz && ns_conlog_write(&st_conlog, output, output_sz)) {
+                ns_perror("error: failed to write console log");
+                goto cleanup;
+            }
+            continue;
+        }
+        if (ns_outbuf_epoll_check(&st_outbuf, evt)) {
+            char buf[256];
+            const char *warn = ns_outbuf_epoll_process(&st_outbuf, buf, sizeof(buf));
+            if (!warn) {
+                ns_perror("error: failed to write output");
+                goto cleanup;
+            }
+            if (*warn) {
+                ns_log("warning: %s", warn);
+            }
+            continue;
+        }
+        if (st_errbuf.fd != -1 && ns_outbuf_epoll_check(&st_errbuf, evt)) {
+            char buf[256];
+            const char *warn = ns_outbuf_epoll_process(&st_errbuf, buf, sizeof(buf));
+            if (!warn) {
+                pthread_mutex_lock(&ns_log_mu);
+                ns_log_outbuf = NULL;
+                pthread_mutex_unlock(&ns_log_mu);
+                ns_perror("error: failed to write log");
+                goto cleanup;
+            }
+            if (*warn) {
+                ns_log("warning: %s (log)", warn);
             }
             continue;
         }
@@ -1279,10 +5557,41 @@ int main(int argc, char **argv) {
                 goto cleanup;
             }
             if (*title) {
-                if (ns_watchdog_update(&st_watchdog) == -1) {
+                ns_startup_mark(&st_startup, "title");
+                if (ns_watchdog_update(&st_watchdog, title) == -1) {
                     ns_perror("error: failed to update watchdog");
                     goto cleanup;
                 }
+                if (!st_startup.done && ns_watchdog_initialized(&st_watchdog)) {
+                    char buf[512];
+                    ns_startup_done(&st_startup, "ready", buf, sizeof(buf));
+                    ns_log("startup: %s", buf);
+                }
+                if (*st_watchdog.note) {
+                    ns_log("watchdog: %s", st_watchdog.note);
+                }
+                ns_statuspage_title(&st_statuspage, title, &st_watchdog);
+                if (ns_cadence_update(&st_cadence) == -1) {
+                    ns_perror("error: failed to update title cadence");
+                    goto cleanup;
+                }
+                ns_netstat_title(&st_netstat, title);
+                if (st_drain.active && !st_stop) {
+                    if (ns_drain_update(&st_drain, title)) {
+                        ns_log("drain: %s; stopping server", st_drain.msg);
+                        st_stop = true;
+                    } else if (*st_drain.msg) {
+                        ns_log("drain: %s", st_drain.msg);
+                    }
+                }
+                if (st_psi.pgid) {
+                    // it's ticking, so it's past the heavy part of the boot
+                    ns_psi_throttle_stop(&st_psi);
+                    ns_watchdog_pause(&st_watchdog, false);
+                    if (st_psi.paused_ms) {
+                        ns_log("server started after pausing the boot for %lums in total due to pressure", st_psi.paused_ms);
+                    }
+                }
                 if (!(nswrap_title && !*nswrap_title)) {
                     struct timespec ts;
                     if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts)) {
@@ -1307,6 +5616,10 @@ int main(int argc, char **argv) {
                         } else {
                             char sts[512];
                             ns_status_str(&st, sts, sizeof(sts));
+                            if (st_drain.active) {
+                                size_t n = strlen(sts);
+                                snprintf(sts + n, sizeof(sts) - n, ", draining %lds", ns_drain_left(&st_drain));
+                            }
                             if (nswrap_title) {
                                 setproctitle(argv, "northstar %s [%s]", nswrap_title, sts);
                             } else {
@@ -1322,11 +5635,18 @@ int main(int argc, char **argv) {
         }
         if (evt.data.fd == fd_timerfd_exit) {
             ns_log("warning: process did not exit in time; killing it");
+            st_snapshot_reason = "exit-timeout";
             goto cleanup;
         }
         if (evt.data.fd == fd_pipe_errno[0]) {
             int n;
-            if (read(fd_pipe_errno[0], &n, sizeof(n)) == -1) {
+            ssize_t r = read(fd_pipe_errno[0], &n, sizeof(n));
+            if (r == 0) {
+                ns_startup_mark(&st_startup, "wine");
+                epoll_ctl(fd_epoll, EPOLL_CTL_DEL, fd_pipe_errno[0], NULL);
+                continue;
+            }
+            if (r == -1) {
                 ns_perror("error: exec '%s' failed, but we couldn't read the error", wine_argv[0]);
             } else {
                 ns_log("error: exec '%s' failed: %s", wine_argv[0], strerror(n));
@@ -1338,17 +5658,91 @@ int main(int argc, char **argv) {
     }
 
 cleanup:
+    ns_psi_throttle_stop(&st_psi);
+    ns_outbuf_flush(&st_outbuf, 1000);
+    {
+        char buf[256];
+        if (*ns_outbuf_report(&st_outbuf, buf, sizeof(buf))) {
+            ns_log("warning: %s", buf);
+        }
+        if (st_errbuf.fd != -1 && *ns_outbuf_report(&st_errbuf, buf, sizeof(buf))) {
+            ns_log("warning: %s (log)", buf);
+        }
+    }
+    {
+        char buf[256];
+        ns_cadence_str(&st_cadence, buf, sizeof(buf));
+        ns_log("title cadence: %s", buf);
+        ns_watchdog_str(&st_watchdog, buf, sizeof(buf));
+        ns_log("watchdog: %s", buf);
+    }
+    if (st_telemetry.timerfd != -1 && ns_telemetry_send(&st_telemetry, st_statuspage.d, &st_cadence, NS_STATUSPAGE_EXITING | NS_TELEMETRY_FINAL)) {
+        ns_perror("warning: failed to send final telemetry");
+    }
     fflush(stdout);
     fflush(stderr);
 
+    if (st_snapshot_reason) {
+        char snap[384];
+        if (ns_conlog_snapshot(&st_conlog, st_snapshot_reason, snap, sizeof(snap))) {
+            if (errno != ENOENT) {
+                ns_perror("warning: failed to save console snapshot");
+            }
+            char ts[32];
+            ns_conlog_timestamp(ts, sizeof(ts));
+            snprintf(snap, sizeof(snap), "%s/snapshot-%s-%s.log", conlog_dir, ts, st_snapshot_reason);
+        } else {
+            ns_log("saved console snapshot to '%s'", snap);
+        }
+        if (diag_timeout && kill(wine_pid, 0) == 0) {
+            char dir[sizeof(snap)];
+            snprintf(dir, sizeof(dir), "%.*s.diag", (int)(strlen(snap) - 4), snap);
+            ns_log("capturing diagnostics (up to %lus)", diag_timeout);
+            if (ns_diag_capture(dir, wine_pid, getenv("NSWRAP_DIAG_CMD"), wine_envp, diag_timeout, fd_signalfd)) {
+                ns_perror("warning: failed to capture diagnostics");
+            } else {
+                ns_log("saved diagnostics to '%s'", dir);
+            }
+        }
+    }
+
     // get the wine exit status, but kill it first if it's still running
     siginfo_t siginfo = {};
+    bool st_killed = false;
     if (waitid(P_PID, wine_pid, &siginfo, WEXITED|WNOHANG) == -1 || siginfo.si_pid == 0) {
-        ns_log("killing wine");
-        if (kill(wine_pid, SIGKILL) == -1) {
-            ns_perror("error: failed to kill wine");
+        st_killed = true;
+        if (!ns_cgroup_kill(&st_cgroup)) {
+            ns_log("killing wine and everything in its cgroup");
+        } else {
+            ns_log("killing wine");
+            if ((fd_pidfd != -1 ? syscall(424 /* SYS_pidfd_send_signal */, fd_pidfd, SIGKILL, NULL, 0) : kill(wine_pid, SIGKILL)) == -1) {
+                ns_perror("error: failed to kill wine");
+            }
+        }
+        if (fd_pidfd != -1) {
+            // the pidfd becomes readable as soon as it exits
+            for (int i = 0; siginfo.si_pid == 0; i++) {
+                if (i > 2) {
+                    ns_log("error: failed to get northstar exit status");
+                    break;
+                }
+                if (i) {
+                    // it may have left the cgroup, or the first kill may have failed
+                    ns_log("warning: wine did not exit within 1s of being killed; killing it again");
+                    ns_cgroup_kill(&st_cgroup);
+                    if (syscall(424 /* SYS_pidfd_send_signal */, fd_pidfd, SIGKILL, NULL, 0) == -1 && errno != ESRCH) {
+                        ns_perror("error: failed to kill wine");
+                    }
+                }
+                if (poll(&(struct pollfd) { .fd = fd_pidfd, .events = POLLIN }, 1, 1000) == -1 && errno != EINTR) {
+                    ns_perror("warning: failed to wait for northstar to exit");
+                }
+                if (waitid(P_PID, wine_pid, &siginfo, WEXITED|WNOHANG) == -1) {
+                    break;
+                }
+            }
         }
-        for (int i = 0; siginfo.si_pid == 0; i++) {
+        for (int i = 0; fd_pidfd == -1 && siginfo.si_pid == 0; i++) {
             if (i > 10) {
                 ns_perror("error: failed to get northstar exit status");
                 break;
@@ -1376,6 +5770,18 @@ cleanup:
         ns_log("northstar dumped core");
     }
 
+    if (!st_snapshot_reason && (siginfo.si_code == CLD_DUMPED || (siginfo.si_code == CLD_KILLED && !st_killed && !(st_exiting && siginfo.si_status == SIGTERM)))) {
+        char snap[384];
+        if (ns_conlog_snapshot(&st_conlog, siginfo.si_code == CLD_DUMPED ? "core" : "signal", snap, sizeof(snap))) {
+            if (errno != ENOENT) {
+                ns_perror("warning: failed to save console snapshot");
+            }
+        } else {
+            ns_log("saved console snapshot to '%s'", snap);
+        }
+    }
+    st_conlog_clean = true;
+
     // kill xvfb if it's still running
     if (xvfb_pid != -1 && kill(xvfb_pid, 0) == 0 && errno != ESRCH) {
         ns_log("killing xvfb");
@@ -1383,32 +5789,23 @@ cleanup:
         xvfb_pid = -1;
     }
 
-    // the default wineserver timeout is 3s, so wait up to 5s for all children to exit
+    // the default wineserver timeout is 3s, so wait up to 4s for all children to exit
     ns_log("waiting for children to exit");
-    struct timespec ts, tc;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    for (;;) {
-        switch (waitpid(-1, NULL, WNOHANG)) {
-        case -1:
-            if (errno != EINTR) {
-                if (errno != ECHILD) {
-                    ns_perror("error: failed to reap remaining children to exit");
-                }
-                return 1;
-            }
-            continue; // try again immediately
-        case 0:
-            clock_gettime(CLOCK_MONOTONIC, &tc);
-            if (tc.tv_sec - ts.tv_sec > 4) {
-                ns_log("warning: children did not exit in time");
-                return 1;
-            }
-            break; // no children to wait for
-        default:
-            continue; // child reaped; try another one immediately
+    if (ns_reap_children(fd_signalfd, 4000)) {
+        if (errno != ETIMEDOUT && errno != EINTR) {
+            ns_perror("error: failed to reap remaining children");
+            return 1;
+        }
+        const char *why = errno == EINTR ? "received a signal while waiting for children to exit" : "children did not exit in time";
+        if (ns_cgroup_kill(&st_cgroup)) {
+            ns_log("warning: %s", why);
+            return 1;
+        }
+        ns_log("warning: %s; killed everything in the cgroup", why);
+        if (ns_reap_children(fd_signalfd, 1000)) {
+            ns_perror("error: failed to reap remaining children");
+            return 1;
         }
-        nanosleep(&(struct timespec){
-            .tv_nsec = 100 * 1000 * 1000,
-        }, NULL);
     }
+    return 1;
 }